@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/stat.h>
+
+#include "cachekey.h"
+#include "hash.h"
+#include "xmalloc.h"
+
+/* Hash of a file, valid as long as it has the same identity, size and modification time. */
+struct digest
+{
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	unsigned long long value;
+};
+
+/* Add a 64 bit value in the same byte order on every platform. */
+static void update_u64(struct hash64 *state, uint64_t value)
+{
+	unsigned char bytes[8];
+
+	for (int i = 0; i < 8; ++i)
+	{
+		bytes[i] = value >> (8 * i);
+	}
+
+	hash64_update(state, bytes, sizeof(bytes));
+}
+
+/* Add a string along with its terminator, so that adjacent strings can't be confused. */
+static void update_string(struct hash64 *state, const char *str)
+{
+	hash64_update(state, str ? str : "", str ? strlen(str) + 1 : 1);
+}
+
+void cachekey_exec(struct tracee *tracee, char **environment)
+{
+	struct hash64 state;
+	size_t argc = 0;
+
+	hash64_init(&state, 0);
+
+	for (char **arg = tracee->argv; arg && *arg; ++arg)
+	{
+		argc++;
+	}
+
+	update_u64(&state, argc);
+
+	for (size_t i = 0; i < argc; ++i)
+	{
+		update_string(&state, tracee->argv[i]);
+	}
+
+	update_string(&state, tracee->cwd);
+
+	for (char **name = environment; name && *name; ++name)
+	{
+		size_t len = strlen(*name);
+		const char *value = NULL;
+
+		for (char **var = tracee->envp; var && *var; ++var)
+		{
+			if (strncmp(*var, *name, len) == 0 && (*var)[len] == '=')
+			{
+				value = *var + len + 1;
+				break;
+			}
+		}
+
+		/* Unset variables differ from empty ones. */
+		update_string(&state, *name);
+		hash64_update(&state, value ? "=" : "", 1);
+		update_string(&state, value);
+	}
+
+	tracee->exec_key = hash64_digest(&state);
+	tracee->inputs_key = 0;
+}
+
+void cachekey_input(struct tracee *tracee, const char *path, unsigned long long digest)
+{
+	tracee->inputs_key += hash64(path, strlen(path) + 1, digest);
+}
+
+unsigned long long cachekey_update(struct tracee *tracee)
+{
+	struct hash64 state;
+	uint64_t children = 0;
+
+	for (size_t i = 0; i < tracee->nchildren; ++i)
+	{
+		children += cachekey_update(tracee->children[i]);
+	}
+
+	hash64_init(&state, 0);
+	update_u64(&state, tracee->exec_key);
+	update_u64(&state, tracee->inputs_key);
+	update_u64(&state, children);
+
+	tracee->cache_key = hash64_digest(&state);
+
+	return tracee->cache_key;
+}
+
+unsigned long long cachekey_digest_file(struct tidmap *cache, const char *path)
+{
+	char buf[1 << 16];
+	struct hash64 state;
+	struct digest *digest;
+	struct stat st;
+	ssize_t len;
+	long id;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK);
+	if (fd < 0)
+	{
+		return 0;
+	}
+
+	/* Files in /proc and /sys are regular, but have no size and change all the time. */
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+	{
+		close(fd);
+		return 0;
+	}
+
+	/* Keys of the cache must not be zero, entries are checked for collisions. */
+	id = (long) (hash64(&st.st_ino, sizeof(st.st_ino), st.st_dev) | 1);
+	digest = tidmap_get(cache, id);
+
+	if (digest && digest->dev == st.st_dev && digest->ino == st.st_ino
+	 && digest->size == st.st_size && digest->mtime.tv_sec == st.st_mtim.tv_sec
+	 && digest->mtime.tv_nsec == st.st_mtim.tv_nsec)
+	{
+		close(fd);
+		return digest->value;
+	}
+
+	hash64_init(&state, 0);
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0)
+	{
+		hash64_update(&state, buf, len);
+	}
+
+	close(fd);
+
+	if (len < 0)
+	{
+		return 0;
+	}
+
+	if (digest == NULL)
+	{
+		digest = xmalloc(sizeof(*digest));
+		tidmap_put(cache, id, digest);
+	}
+
+	digest->dev = st.st_dev;
+	digest->ino = st.st_ino;
+	digest->size = st.st_size;
+	digest->mtime = st.st_mtim;
+	digest->value = hash64_digest(&state);
+
+	return digest->value;
+}
@@ -0,0 +1,42 @@
+#ifndef CACHEKEY_H_INCLUDED
+#define CACHEKEY_H_INCLUDED
+
+#include "tracee.h"
+#include "tidmap.h"
+
+/*
+ * Cache keys identify the work done by a subtree of processes, so that
+ * runs can be compared and subtrees whose keys are unchanged can be reused.
+ * The key of a tracee hashes its arguments, its working directory and
+ * selected environment variables at its last exec, the paths and contents
+ * of the files it read, and the keys of its children. Inputs and children
+ * are combined regardless of their order, as they may vary with timing.
+ */
+
+/*
+ * Start the key of tracee over, after it executed a new program. Only the
+ * environment variables named in the NULL terminated list environment are
+ * included, which may be NULL.
+ */
+void cachekey_exec(struct tracee *tracee, char **environment);
+
+/*
+ * Add a file read by tracee to its key, with the hash of its contents or
+ * zero if they were not hashed. Each path must only be added once.
+ */
+void cachekey_input(struct tracee *tracee, const char *path, unsigned long long digest);
+
+/*
+ * Compute `cache_key` of tracee and all its descendants.
+ * Returns the key of tracee.
+ */
+unsigned long long cachekey_update(struct tracee *tracee);
+
+/*
+ * Hash the contents of the regular file at path, reusing the hash in
+ * cache while its size and modification time stay the same.
+ * Returns zero if the file could not be read or is empty.
+ */
+unsigned long long cachekey_digest_file(struct tidmap *cache, const char *path);
+
+#endif
@@ -0,0 +1,206 @@
+#include <string.h>
+#include <stdio.h>
+
+#include "collapse.h"
+#include "options.h"
+#include "output.h"
+#include "xmalloc.h"
+#include "hash.h"
+
+/*
+ * Table of the first tracee seen with each shape,
+ * using open addressing on the hash of the shape.
+ */
+struct shape_table
+{
+	size_t count;
+	size_t capacity;
+	struct shape_entry
+	{
+		unsigned long hash;
+		struct tracee *tracee;
+	} *entries;
+};
+
+static unsigned long hash_string(unsigned long hash, const char *str)
+{
+	/* Include the terminator, so that ["ab", "c"] and ["a", "bc"] differ. */
+	return str ? hash_fnv1a_bytes(str, strlen(str) + 1, hash) : hash;
+}
+
+static bool string_equal(const char *a, const char *b)
+{
+	return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+static bool string_list_equal(char **a, char **b)
+{
+	if (a == NULL || b == NULL)
+	{
+		return a == b;
+	}
+
+	for (; *a && *b; ++a, ++b)
+	{
+		if (strcmp(*a, *b) != 0)
+		{
+			return false;
+		}
+	}
+
+	return *a == *b;
+}
+
+/* Compare tracees whose children already have their shapes assigned. */
+static bool same_shape(struct tracee *a, struct tracee *b, struct options *options)
+{
+	size_t i = 0, j = 0;
+
+	if (a->is_a_thread != b->is_a_thread
+	    || !string_list_equal(a->argv, b->argv)
+	    || !string_equal(a->cwd, b->cwd))
+	{
+		return false;
+	}
+
+	for (;;)
+	{
+		while (i < a->nchildren && output_exclude(a->children[i], options))
+		{
+			i++;
+		}
+
+		while (j < b->nchildren && output_exclude(b->children[j], options))
+		{
+			j++;
+		}
+
+		if (i == a->nchildren || j == b->nchildren)
+		{
+			return i == a->nchildren && j == b->nchildren;
+		}
+
+		if (a->children[i++]->shape != b->children[j++]->shape)
+		{
+			return false;
+		}
+	}
+}
+
+static void shape_table_insert(struct shape_table *table, unsigned long hash, struct tracee *tracee)
+{
+	if ((table->count + 1) * 2 > table->capacity)
+	{
+		struct shape_entry *old = table->entries;
+		size_t oldcapacity = table->capacity;
+
+		table->capacity = oldcapacity ? oldcapacity * 2 : 256;
+		table->entries = xcalloc(table->capacity, sizeof(*table->entries));
+		table->count = 0;
+
+		for (size_t i = 0; i < oldcapacity; ++i)
+		{
+			if (old[i].tracee)
+			{
+				shape_table_insert(table, old[i].hash, old[i].tracee);
+			}
+		}
+
+		xfree(old);
+	}
+
+	size_t i = hash & (table->capacity - 1);
+	while (table->entries[i].tracee)
+	{
+		i = (i + 1) & (table->capacity - 1);
+	}
+
+	table->entries[i].hash = hash;
+	table->entries[i].tracee = tracee;
+	table->count++;
+}
+
+static void compute_shape(struct tracee *tracee, struct shape_table *table, struct options *options)
+{
+	unsigned long hash = HASH_FNV1A_SEED;
+
+	for (size_t i = 0; i < tracee->nchildren; ++i)
+	{
+		struct tracee *child = tracee->children[i];
+
+		if (output_exclude(child, options))
+		{
+			continue;
+		}
+
+		compute_shape(child, table, options);
+		hash = hash_fnv1a_bytes(&child->shape, sizeof(child->shape), hash);
+	}
+
+	hash = hash_fnv1a_bytes(&tracee->is_a_thread, sizeof(tracee->is_a_thread), hash);
+	hash = hash_string(hash, tracee->cwd);
+
+	for (char **arg = tracee->argv; arg && *arg; ++arg)
+	{
+		hash = hash_string(hash, *arg);
+	}
+
+	/* Shape ids are taken from the table size, so zero is never used. */
+	for (size_t i = table->capacity ? hash & (table->capacity - 1) : 0;
+	     table->capacity && table->entries[i].tracee;
+	     i = (i + 1) & (table->capacity - 1))
+	{
+		struct shape_entry *entry = &table->entries[i];
+
+		if (entry->hash == hash && same_shape(entry->tracee, tracee, options))
+		{
+			tracee->shape = entry->tracee->shape;
+			return;
+		}
+	}
+
+	tracee->shape = table->count + 1;
+	shape_table_insert(table, hash, tracee);
+}
+
+void collapse_compute_shapes(struct tracee *root, struct options *options)
+{
+	struct shape_table table = {0};
+
+	compute_shape(root, &table, options);
+
+	xfree(table.entries);
+}
+
+size_t collapse_run(struct tracee *parent, size_t i, struct options *options, size_t *count)
+{
+	size_t shape = parent->children[i]->shape;
+	size_t next = i + 1;
+
+	*count = 1;
+
+	if (!options->collapse)
+	{
+		return next;
+	}
+
+	for (size_t j = i + 1; j < parent->nchildren; ++j)
+	{
+		struct tracee *child = parent->children[j];
+
+		if (output_exclude(child, options))
+		{
+			continue;
+		}
+
+		if (child->shape != shape)
+		{
+			break;
+		}
+
+		(*count)++;
+		next = j + 1;
+	}
+
+	return next;
+}
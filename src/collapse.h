@@ -0,0 +1,24 @@
+#ifndef COLLAPSE_H_INCLUDED
+#define COLLAPSE_H_INCLUDED
+
+#include <stddef.h>
+
+#include "tracee.h"
+
+struct options;
+
+/*
+ * Assign the `shape` field of every tracee in the tree, such that two tracees
+ * have the same shape exactly when they have the same arguments, working directory
+ * and, recursively, children of the same shapes. Excluded tracees are ignored.
+ */
+void collapse_compute_shapes(struct tracee *root, struct options *options);
+
+/*
+ * Find the run of identical siblings starting at child i of parent.
+ * Stores the number of tracees in the run in *count and returns the index
+ * of the child following the run. Without --collapse every run has length one.
+ */
+size_t collapse_run(struct tracee *parent, size_t i, struct options *options, size_t *count);
+
+#endif
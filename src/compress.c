@@ -0,0 +1,380 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <zlib.h>
+
+#include "compress.h"
+#include "xmalloc.h"
+
+/* Bytes collected before they are compressed. */
+#define BLOCK_SIZE (1 << 20)
+
+/* Output is usually written once and read a few times, favour speed. */
+#define GZIP_LEVEL 1
+
+/* Window bits for deflateInit2() that select a gzip header and trailer. */
+#define GZIP_WINDOW_BITS (15 + 16)
+
+struct compressor
+{
+	int fd;
+	z_stream stream;
+
+	/* The block being filled by writes. */
+	unsigned char *block;
+	size_t filled;
+
+	/* The block handed to the helper thread, if `pending`. The last one
+	   is handed over with `finishing` set. */
+	unsigned char *pending_block;
+	size_t pending_size;
+	bool pending;
+	bool finishing;
+
+	/* Compressed output. */
+	unsigned char *out;
+
+	/* First error of the helper thread, or zero. */
+	int error;
+
+	pthread_t thread;
+	bool started;
+	bool threaded;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+enum compress_format compress_format_of(const char *path)
+{
+	size_t len = strlen(path);
+
+	if (len > 3 && strcmp(path + len - 3, ".gz") == 0)
+	{
+		return COMPRESS_GZIP;
+	}
+
+	return COMPRESS_NONE;
+}
+
+static int write_all(int fd, const unsigned char *data, size_t size)
+{
+	while (size > 0)
+	{
+		ssize_t count = write(fd, data, size);
+
+		if (count < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			return -1;
+		}
+
+		data += count;
+		size -= count;
+	}
+
+	return 0;
+}
+
+/* Compress size bytes at data, and write the output. */
+static int deflate_block(struct compressor *compressor, unsigned char *data, size_t size, bool finish)
+{
+	z_stream *stream = &compressor->stream;
+	int result;
+
+	stream->next_in = data;
+	stream->avail_in = size;
+
+	do
+	{
+		stream->next_out = compressor->out;
+		stream->avail_out = BLOCK_SIZE;
+
+		result = deflate(stream, finish ? Z_FINISH : Z_NO_FLUSH);
+
+		if (result == Z_STREAM_ERROR)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+
+		if (write_all(compressor->fd, compressor->out, BLOCK_SIZE - stream->avail_out) < 0)
+		{
+			return -1;
+		}
+	}
+	while (stream->avail_out == 0 || (finish && result != Z_STREAM_END));
+
+	return 0;
+}
+
+static void *compress_thread(void *data)
+{
+	struct compressor *compressor = data;
+	bool finishing = false;
+
+	pthread_mutex_lock(&compressor->lock);
+
+	while (!finishing)
+	{
+		while (!compressor->pending)
+		{
+			pthread_cond_wait(&compressor->cond, &compressor->lock);
+		}
+
+		finishing = compressor->finishing;
+		pthread_mutex_unlock(&compressor->lock);
+
+		if (compressor->error == 0 && deflate_block(compressor, compressor->pending_block,
+		                                            compressor->pending_size, finishing) < 0)
+		{
+			compressor->error = errno;
+		}
+
+		pthread_mutex_lock(&compressor->lock);
+		compressor->pending = false;
+		pthread_cond_broadcast(&compressor->cond);
+	}
+
+	pthread_mutex_unlock(&compressor->lock);
+	return NULL;
+}
+
+/* Start the helper thread, with all signals blocked so that they keep
+   going to the threads that wait for them. */
+static void start_thread(struct compressor *compressor)
+{
+	sigset_t all, saved;
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &saved);
+
+	/* Without a helper thread, blocks are compressed as they fill up. */
+	compressor->threaded = pthread_create(&compressor->thread, NULL, compress_thread, compressor) == 0;
+	compressor->started = true;
+
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+}
+
+/* Hand the filled block to the helper thread, and continue with the one it is done with. */
+static int hand_over(struct compressor *compressor, bool finishing)
+{
+	unsigned char *block = compressor->block;
+	size_t filled = compressor->filled;
+
+	/* Output that fits in one block is compressed right away. */
+	if (!compressor->started && !finishing)
+	{
+		start_thread(compressor);
+	}
+
+	if (!compressor->threaded)
+	{
+		compressor->filled = 0;
+		return deflate_block(compressor, block, filled, finishing);
+	}
+
+	pthread_mutex_lock(&compressor->lock);
+
+	while (compressor->pending)
+	{
+		pthread_cond_wait(&compressor->cond, &compressor->lock);
+	}
+
+	compressor->block = compressor->pending_block;
+	compressor->pending_block = block;
+	compressor->pending_size = filled;
+	compressor->pending = true;
+	compressor->finishing = finishing;
+	compressor->filled = 0;
+
+	pthread_cond_broadcast(&compressor->cond);
+	pthread_mutex_unlock(&compressor->lock);
+
+	if (compressor->error)
+	{
+		errno = compressor->error;
+		return -1;
+	}
+
+	return 0;
+}
+
+static ssize_t compress_write(void *cookie, const char *data, size_t size)
+{
+	struct compressor *compressor = cookie;
+	size_t written = 0;
+
+	while (written < size)
+	{
+		size_t chunk = BLOCK_SIZE - compressor->filled;
+
+		if (chunk > size - written)
+		{
+			chunk = size - written;
+		}
+
+		memcpy(compressor->block + compressor->filled, data + written, chunk);
+		compressor->filled += chunk;
+		written += chunk;
+
+		if (compressor->filled == BLOCK_SIZE && hand_over(compressor, false) < 0)
+		{
+			return -1;
+		}
+	}
+
+	return size;
+}
+
+static int compress_close(void *cookie)
+{
+	struct compressor *compressor = cookie;
+	int result = hand_over(compressor, true);
+
+	if (compressor->threaded)
+	{
+		pthread_join(compressor->thread, NULL);
+
+		if (result == 0 && compressor->error)
+		{
+			errno = compressor->error;
+			result = -1;
+		}
+	}
+
+	pthread_mutex_destroy(&compressor->lock);
+	pthread_cond_destroy(&compressor->cond);
+
+	deflateEnd(&compressor->stream);
+
+	if (close(compressor->fd) < 0)
+	{
+		result = -1;
+	}
+
+	xfree(compressor->block);
+	xfree(compressor->pending_block);
+	xfree(compressor->out);
+	xfree(compressor);
+
+	return result == 0 ? 0 : EOF;
+}
+
+FILE *compress_open(const char *path, enum compress_format format)
+{
+	cookie_io_functions_t functions = { .write = compress_write, .close = compress_close };
+	struct compressor *compressor;
+	FILE *f;
+
+	if (format != COMPRESS_GZIP)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	compressor = xcalloc(1, sizeof(*compressor));
+	compressor->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+
+	if (compressor->fd < 0)
+	{
+		xfree(compressor);
+		return NULL;
+	}
+
+	if (deflateInit2(&compressor->stream, GZIP_LEVEL, Z_DEFLATED, GZIP_WINDOW_BITS,
+	                 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		close(compressor->fd);
+		xfree(compressor);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	compressor->block = xmalloc(BLOCK_SIZE);
+	compressor->pending_block = xmalloc(BLOCK_SIZE);
+	compressor->out = xmalloc(BLOCK_SIZE);
+
+	pthread_mutex_init(&compressor->lock, NULL);
+	pthread_cond_init(&compressor->cond, NULL);
+
+	f = fopencookie(compressor, "w", functions);
+
+	if (f == NULL)
+	{
+		compress_close(compressor);
+		return NULL;
+	}
+
+	return f;
+}
+
+bool compress_detect(const unsigned char *data, size_t size)
+{
+	return size >= 2 && data[0] == 0x1f && data[1] == 0x8b;
+}
+
+unsigned char *compress_read_all(int fd, size_t *size)
+{
+	unsigned char *data = NULL;
+	size_t capacity = 0;
+	gzFile file;
+	int dupfd;
+
+	*size = 0;
+
+	if (lseek(fd, 0, SEEK_SET) < 0 || (dupfd = dup(fd)) < 0)
+	{
+		return NULL;
+	}
+
+	file = gzdopen(dupfd, "rb");
+
+	if (file == NULL)
+	{
+		close(dupfd);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	for (;;)
+	{
+		int count;
+
+		if (capacity - *size < BLOCK_SIZE)
+		{
+			capacity = capacity ? capacity * 2 : 4 * BLOCK_SIZE;
+			data = xrealloc(data, capacity);
+		}
+
+		count = gzread(file, data + *size, BLOCK_SIZE);
+
+		if (count < 0)
+		{
+			gzclose(file);
+			xfree(data);
+			errno = EINVAL;
+			return NULL;
+		}
+
+		if (count == 0)
+		{
+			break;
+		}
+
+		*size += count;
+	}
+
+	gzclose(file);
+	return data;
+}
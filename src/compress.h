@@ -0,0 +1,46 @@
+#ifndef COMPRESS_H_INCLUDED
+#define COMPRESS_H_INCLUDED
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Formats that output can be compressed with.
+ */
+enum compress_format
+{
+	COMPRESS_NONE,
+	COMPRESS_GZIP,
+};
+
+/*
+ * Format named by the extension of path, or COMPRESS_NONE for none or an
+ * unknown one.
+ */
+enum compress_format compress_format_of(const char *path);
+
+/*
+ * Open path for writing through a stream that compresses everything
+ * written to it with format. Writes are collected in large blocks, which
+ * are compressed and written by a helper thread while the next one is
+ * filled. The stream must be closed with fclose() for the output to be
+ * complete.
+ * Returns NULL on failure, errno is set by the corresponding libc call.
+ */
+FILE *compress_open(const char *path, enum compress_format format);
+
+/*
+ * The size bytes at data start a file compressed in a supported format.
+ */
+bool compress_detect(const unsigned char *data, size_t size);
+
+/*
+ * Read and decompress the whole compressed file fd, from its start, into
+ * a buffer that must be freed.
+ * Returns NULL on failure, errno is set by the corresponding libc call, or
+ * to EINVAL if the compressed data is corrupt.
+ */
+unsigned char *compress_read_all(int fd, size_t *size);
+
+#endif
@@ -0,0 +1,149 @@
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <err.h>
+
+#include <sys/socket.h>
+
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+
+#include "connector.h"
+
+static int send_op(struct connector *connector, enum proc_cn_mcast_op op)
+{
+	struct
+	{
+		struct nlmsghdr header;
+		struct cn_msg msg;
+		enum proc_cn_mcast_op op;
+	} __attribute__((packed)) request = {0};
+
+	request.header.nlmsg_len = sizeof(request);
+	request.header.nlmsg_type = NLMSG_DONE;
+	request.header.nlmsg_pid = getpid();
+	request.msg.id.idx = CN_IDX_PROC;
+	request.msg.id.val = CN_VAL_PROC;
+	request.msg.len = sizeof(op);
+	request.op = op;
+
+	return send(connector->fd, &request, sizeof(request), 0) < 0 ? -1 : 0;
+}
+
+static void handle_event(struct connector *connector, struct proc_event *event)
+{
+	timestamp_t time = event->timestamp_ns;
+
+	switch (event->what)
+	{
+	case PROC_EVENT_FORK:
+		/* The parent reported for a thread is the parent of its process. */
+		follower_fork(&connector->follower, event->event_data.fork.parent_pid,
+		              event->event_data.fork.parent_tgid, event->event_data.fork.child_pid,
+		              event->event_data.fork.child_tgid, time);
+		break;
+
+	case PROC_EVENT_EXEC:
+		follower_exec(&connector->follower, event->event_data.exec.process_pid, time);
+		break;
+
+	case PROC_EVENT_EXIT:
+		/* The exit code is a wait status. */
+		follower_exit(&connector->follower, event->event_data.exit.process_pid, time,
+		              event->event_data.exit.exit_code, true);
+		break;
+
+	default:
+		break;
+	}
+}
+
+int connector_open(struct connector *connector, struct options *options,
+                   void (*emit)(struct event *event, void *data), void *data)
+{
+	struct sockaddr_nl addr = { .nl_family = AF_NETLINK, .nl_groups = CN_IDX_PROC, .nl_pid = getpid() };
+
+	memset(connector, 0, sizeof(*connector));
+	follower_init(&connector->follower, options, emit, data);
+
+	connector->fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+	if (connector->fd < 0)
+	{
+		return -1;
+	}
+
+	if (bind(connector->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+	 || send_op(connector, PROC_CN_MCAST_LISTEN) < 0)
+	{
+		int saved = errno;
+		close(connector->fd);
+		connector->fd = -1;
+		errno = saved;
+		return -1;
+	}
+
+	return 0;
+}
+
+int connector_start(struct connector *connector)
+{
+	return follower_start(&connector->follower);
+}
+
+void connector_read(struct connector *connector)
+{
+	char buf[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+	ssize_t len;
+
+	while ((len = recv(connector->fd, buf, sizeof(buf), 0)) != 0)
+	{
+		if (len < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			if (errno == ENOBUFS)
+			{
+				if (!connector->overflowed)
+				{
+					warnx("Process events were lost, the tree is incomplete");
+				}
+
+				connector->overflowed = true;
+				continue;
+			}
+
+			break;
+		}
+
+		for (struct nlmsghdr *header = (struct nlmsghdr *) buf; NLMSG_OK(header, len);
+		     header = NLMSG_NEXT(header, len))
+		{
+			struct cn_msg *msg = NLMSG_DATA(header);
+
+			if (header->nlmsg_type != NLMSG_DONE || msg->id.idx != CN_IDX_PROC)
+			{
+				continue;
+			}
+
+			handle_event(connector, (struct proc_event *) msg->data);
+		}
+	}
+}
+
+void connector_close(struct connector *connector)
+{
+	if (connector->fd < 0)
+	{
+		return;
+	}
+
+	(void) send_op(connector, PROC_CN_MCAST_IGNORE);
+	close(connector->fd);
+	connector->fd = -1;
+
+	follower_clear(&connector->follower);
+}
@@ -0,0 +1,55 @@
+#ifndef CONNECTOR_H_INCLUDED
+#define CONNECTOR_H_INCLUDED
+
+#include <stdbool.h>
+
+#include "event.h"
+#include "follow.h"
+
+struct options;
+
+/*
+ * Backend that follows processes with the kernel proc connector instead
+ * of ptrace. The kernel reports every fork, exec and exit on the system
+ * without stopping the process, and the ones of traced processes and
+ * their descendants are turned into events by a follower.
+ * Requires CAP_NET_ADMIN.
+ */
+struct connector
+{
+	/* Netlink socket subscribed to process events. */
+	int fd;
+
+	struct follower follower;
+
+	/* Events were lost, since the socket buffer overflowed. */
+	bool overflowed;
+};
+
+/*
+ * Subscribe to process events. Processes started or attached to later
+ * are followed from the time of this call.
+ * Returns 0 on success and -1 on failure, errno is set by the
+ * corresponding libc call.
+ */
+int connector_open(struct connector *connector, struct options *options,
+                   void (*emit)(struct event *event, void *data), void *data);
+
+/*
+ * Start all commands and follow all pids given in the options, along with
+ * their existing descendants.
+ * Returns 0 on success and -1 if none of them could be followed.
+ */
+int connector_start(struct connector *connector);
+
+/*
+ * Handle the process events received since the last call, without blocking.
+ */
+void connector_read(struct connector *connector);
+
+/*
+ * Unsubscribe from process events.
+ */
+void connector_close(struct connector *connector);
+
+#endif
@@ -0,0 +1,542 @@
+#include <string.h>
+#include <stdio.h>
+
+#include "diff.h"
+#include "options.h"
+#include "output.h"
+#include "xmalloc.h"
+#include "hash.h"
+
+/* Running time changes below these limits are not reported. */
+#define DIFF_MIN_DURATION_DELTA (NS_PER_SEC / 100)
+#define DIFF_MIN_DURATION_RATIO 0.1
+
+/*
+ * Hash table from keys to indices, using open addressing.
+ */
+struct index_table
+{
+	size_t capacity;
+	struct index_entry
+	{
+		unsigned long key;
+		size_t index;
+		bool used;
+	} *entries;
+};
+
+/*
+ * Ancestors of the tracees being compared, printed as
+ * context before the first difference below them.
+ */
+struct diff_context
+{
+	FILE *f;
+	struct options *options;
+	size_t depth;
+	size_t printed;
+	struct tracee *stack[4096];
+	size_t ndifferences;
+	size_t added;
+	size_t removed;
+	size_t changed;
+};
+
+static unsigned long hash_string(unsigned long hash, const char *str)
+{
+	return str ? hash_fnv1a_bytes(str, strlen(str) + 1, hash) : hash;
+}
+
+/* Hash of the identity of a tracee. Exact identity includes all arguments,
+   loose identity only the command name. */
+static unsigned long identity_hash(struct tracee *tracee, bool exact)
+{
+	unsigned long hash = HASH_FNV1A_SEED;
+
+	hash = hash_string(hash, tracee->cwd);
+
+	for (char **arg = tracee->argv; arg && *arg; ++arg)
+	{
+		hash = hash_string(hash, *arg);
+
+		if (!exact)
+		{
+			break;
+		}
+	}
+
+	return hash;
+}
+
+static bool string_equal(const char *a, const char *b)
+{
+	return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+static bool string_list_equal(char **a, char **b, size_t limit)
+{
+	if (a == NULL || b == NULL)
+	{
+		return a == b;
+	}
+
+	for (size_t i = 0; i < limit && (*a || *b); ++i, ++a, ++b)
+	{
+		if (!string_equal(*a, *b))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool same_identity(struct tracee *a, struct tracee *b, bool exact)
+{
+	return string_equal(a->cwd, b->cwd) && string_list_equal(a->argv, b->argv, exact ? (size_t) -1 : 1);
+}
+
+static void table_init(struct index_table *table, size_t count)
+{
+	table->capacity = 16;
+	while (table->capacity < count * 2)
+	{
+		table->capacity *= 2;
+	}
+
+	table->entries = xcalloc(table->capacity, sizeof(*table->entries));
+}
+
+/* Find the entry for key, or the empty slot where it belongs. */
+static struct index_entry *table_slot(struct index_table *table, unsigned long key)
+{
+	size_t i = (key ^ (key >> 29)) & (table->capacity - 1);
+
+	while (table->entries[i].used && table->entries[i].key != key)
+	{
+		i = (i + 1) & (table->capacity - 1);
+	}
+
+	return &table->entries[i];
+}
+
+/* Number of times key has been counted before. */
+static size_t table_count(struct index_table *table, unsigned long key)
+{
+	struct index_entry *entry = table_slot(table, key);
+
+	if (!entry->used)
+	{
+		entry->used = true;
+		entry->key = key;
+		entry->index = 0;
+	}
+
+	return entry->index++;
+}
+
+static unsigned long ordinal_key(unsigned long hash, size_t ordinal)
+{
+	return hash_fnv1a_bytes(&ordinal, sizeof(ordinal), hash);
+}
+
+/*
+ * Match the children a[i] and b[j] that are not yet matched and have the same
+ * identity, pairing the n:th occurrence of an identity in a with the n:th in b.
+ */
+static void match_children(struct tracee **a, size_t na, struct tracee **b, size_t nb,
+                           long *match_a, long *match_b, bool exact)
+{
+	struct index_table counts, positions;
+
+	table_init(&counts, na + nb);
+	table_init(&positions, nb);
+
+	for (size_t j = 0; j < nb; ++j)
+	{
+		if (match_b[j] >= 0)
+		{
+			continue;
+		}
+
+		unsigned long hash = identity_hash(b[j], exact);
+		unsigned long key = ordinal_key(hash, table_count(&counts, hash));
+		struct index_entry *entry = table_slot(&positions, key);
+
+		entry->used = true;
+		entry->key = key;
+		entry->index = j;
+	}
+
+	xfree(counts.entries);
+	table_init(&counts, na);
+
+	for (size_t i = 0; i < na; ++i)
+	{
+		if (match_a[i] >= 0)
+		{
+			continue;
+		}
+
+		unsigned long hash = identity_hash(a[i], exact);
+		struct index_entry *entry = table_slot(&positions, ordinal_key(hash, table_count(&counts, hash)));
+
+		if (entry->used && match_b[entry->index] < 0 && same_identity(a[i], b[entry->index], exact))
+		{
+			match_a[i] = entry->index;
+			match_b[entry->index] = i;
+		}
+	}
+
+	xfree(counts.entries);
+	xfree(positions.entries);
+}
+
+static void print_label(FILE *f, struct tracee *tracee)
+{
+	if (tracee->argv)
+	{
+		for (char **arg = tracee->argv; *arg; ++arg)
+		{
+			fprintf(f, "%s%s", arg == tracee->argv ? "" : " ", *arg);
+		}
+	}
+	else
+	{
+		fprintf(f, "%ld", tracee->tid);
+	}
+}
+
+static void print_line_start(struct diff_context *context, char marker, size_t depth)
+{
+	fprintf(context->f, "%c ", marker);
+
+	for (size_t i = 0; i < depth; ++i)
+	{
+		fprintf(context->f, "    ");
+	}
+}
+
+static void print_duration_delta(struct diff_context *context, struct tracee *a, struct tracee *b)
+{
+	timestamp_t da = output_duration(a), db = output_duration(b);
+
+	if (!context->options->timing || da == 0 || db == 0)
+	{
+		return;
+	}
+
+	fprintf(context->f, " [%.3fs → %.3fs, %+.3fs]",
+	        timestamp_to_seconds(da), timestamp_to_seconds(db),
+	        timestamp_to_seconds(db) - timestamp_to_seconds(da));
+}
+
+/* Print the ancestors that have not been printed yet. */
+static void flush_context(struct diff_context *context)
+{
+	for (; context->printed < context->depth; ++context->printed)
+	{
+		print_line_start(context, ' ', context->printed);
+		print_label(context->f, context->stack[context->printed]);
+		fprintf(context->f, "\n");
+	}
+}
+
+static size_t count_tracees(struct tracee *tracee, struct options *options)
+{
+	size_t count = 1;
+
+	for (size_t i = 0; i < tracee->nchildren; ++i)
+	{
+		if (!output_exclude(tracee->children[i], options))
+		{
+			count += count_tracees(tracee->children[i], options);
+		}
+	}
+
+	return count;
+}
+
+static void report_subtree(struct diff_context *context, char marker, struct tracee *tracee)
+{
+	size_t count = count_tracees(tracee, context->options);
+
+	flush_context(context);
+	print_line_start(context, marker, context->depth);
+	print_label(context->f, tracee);
+
+	if (count > 1)
+	{
+		fprintf(context->f, " (%zu processes)", count);
+	}
+
+	fprintf(context->f, "\n");
+	context->ndifferences++;
+}
+
+static void print_detail(struct diff_context *context, const char *what)
+{
+	print_line_start(context, ' ', context->depth + 1);
+	fprintf(context->f, "%s: ", what);
+}
+
+/* Report environment variables that were added, removed or changed. */
+static size_t diff_environment(struct diff_context *context, char **a, char **b, bool print)
+{
+	struct index_table table;
+	size_t na = 0, nb = 0, ndifferences = 0;
+	bool *seen;
+
+	for (char **ptr = a; ptr && *ptr; ++ptr)
+	{
+		na++;
+	}
+
+	for (char **ptr = b; ptr && *ptr; ++ptr)
+	{
+		nb++;
+	}
+
+	table_init(&table, na);
+	seen = xcalloc(na + 1, sizeof(*seen));
+
+	for (size_t i = 0; i < na; ++i)
+	{
+		const char *eq = strchr(a[i], '=');
+		size_t keylen = eq ? (size_t) (eq - a[i]) : strlen(a[i]);
+		struct index_entry *entry = table_slot(&table, hash_fnv1a_bytes(a[i], keylen, HASH_FNV1A_SEED));
+
+		entry->used = true;
+		entry->key = hash_fnv1a_bytes(a[i], keylen, HASH_FNV1A_SEED);
+		entry->index = i;
+	}
+
+	for (size_t j = 0; j < nb; ++j)
+	{
+		const char *eq = strchr(b[j], '=');
+		size_t keylen = eq ? (size_t) (eq - b[j]) : strlen(b[j]);
+		struct index_entry *entry = table_slot(&table, hash_fnv1a_bytes(b[j], keylen, HASH_FNV1A_SEED));
+
+		if (entry->used && strncmp(a[entry->index], b[j], keylen) == 0
+		    && (a[entry->index][keylen] == '=' || a[entry->index][keylen] == 0))
+		{
+			seen[entry->index] = true;
+
+			if (strcmp(a[entry->index], b[j]) == 0)
+			{
+				continue;
+			}
+
+			if (print)
+			{
+				print_detail(context, "environment");
+				fprintf(context->f, "%s → %s\n", a[entry->index], b[j]);
+			}
+		}
+		else if (print)
+		{
+			print_detail(context, "environment");
+			fprintf(context->f, "+%s\n", b[j]);
+		}
+
+		ndifferences++;
+	}
+
+	for (size_t i = 0; i < na; ++i)
+	{
+		if (seen[i])
+		{
+			continue;
+		}
+
+		if (print)
+		{
+			print_detail(context, "environment");
+			fprintf(context->f, "-%s\n", a[i]);
+		}
+
+		ndifferences++;
+	}
+
+	xfree(seen);
+	xfree(table.entries);
+
+	return ndifferences;
+}
+
+static bool duration_changed(struct diff_context *context, struct tracee *a, struct tracee *b)
+{
+	timestamp_t da = output_duration(a), db = output_duration(b);
+	timestamp_t delta = da > db ? da - db : db - da;
+
+	if (!context->options->timing || da == 0 || db == 0)
+	{
+		return false;
+	}
+
+	return delta >= DIFF_MIN_DURATION_DELTA && delta >= DIFF_MIN_DURATION_RATIO * (da > db ? da : db);
+}
+
+static void diff_tracee(struct diff_context *context, struct tracee *a, struct tracee *b);
+
+static void diff_children(struct diff_context *context, struct tracee *a, struct tracee *b)
+{
+	struct tracee **ca, **cb;
+	size_t na = 0, nb = 0;
+	long *match_a, *match_b;
+
+	ca = xmalloc(sizeof(*ca) * (a->nchildren + 1));
+	cb = xmalloc(sizeof(*cb) * (b->nchildren + 1));
+
+	for (size_t i = 0; i < a->nchildren; ++i)
+	{
+		if (!output_exclude(a->children[i], context->options))
+		{
+			ca[na++] = a->children[i];
+		}
+	}
+
+	for (size_t j = 0; j < b->nchildren; ++j)
+	{
+		if (!output_exclude(b->children[j], context->options))
+		{
+			cb[nb++] = b->children[j];
+		}
+	}
+
+	match_a = xmalloc(sizeof(*match_a) * (na + 1));
+	match_b = xmalloc(sizeof(*match_b) * (nb + 1));
+	memset(match_a, 0xff, sizeof(*match_a) * (na + 1));
+	memset(match_b, 0xff, sizeof(*match_b) * (nb + 1));
+
+	match_children(ca, na, cb, nb, match_a, match_b, true);
+	match_children(ca, na, cb, nb, match_a, match_b, false);
+
+	for (size_t i = 0; i < na; ++i)
+	{
+		if (match_a[i] < 0)
+		{
+			report_subtree(context, '-', ca[i]);
+			context->removed++;
+			continue;
+		}
+
+		diff_tracee(context, ca[i], cb[match_a[i]]);
+	}
+
+	for (size_t j = 0; j < nb; ++j)
+	{
+		if (match_b[j] < 0)
+		{
+			report_subtree(context, '+', cb[j]);
+			context->added++;
+		}
+	}
+
+	xfree(match_a);
+	xfree(match_b);
+	xfree(ca);
+	xfree(cb);
+}
+
+/* Print what changed between a and b, returns false if nothing did. */
+static bool diff_details(struct diff_context *context, struct tracee *a, struct tracee *b, bool print)
+{
+	bool argv_changed = !string_list_equal(a->argv, b->argv, (size_t) -1);
+	bool cwd_changed = !string_equal(a->cwd, b->cwd);
+	bool env_changed = !context->options->exclude_environ
+	                   && diff_environment(context, a->envp, b->envp, false) > 0;
+
+	if (print)
+	{
+		if (argv_changed)
+		{
+			print_detail(context, "arguments");
+			print_label(context->f, a);
+			fprintf(context->f, " → ");
+			print_label(context->f, b);
+			fprintf(context->f, "\n");
+		}
+
+		if (cwd_changed)
+		{
+			print_detail(context, "directory");
+			fprintf(context->f, "%s → %s\n", a->cwd ? a->cwd : "?", b->cwd ? b->cwd : "?");
+		}
+
+		if (env_changed)
+		{
+			diff_environment(context, a->envp, b->envp, true);
+		}
+	}
+
+	return argv_changed || cwd_changed || env_changed;
+}
+
+static void diff_tracee(struct diff_context *context, struct tracee *a, struct tracee *b)
+{
+	if (diff_details(context, a, b, false) || duration_changed(context, a, b))
+	{
+		flush_context(context);
+		print_line_start(context, '~', context->depth);
+		print_label(context->f, b);
+		print_duration_delta(context, a, b);
+		fprintf(context->f, "\n");
+
+		diff_details(context, a, b, true);
+
+		context->printed = context->depth + 1;
+		context->ndifferences++;
+		context->changed++;
+	}
+
+	if (context->depth >= sizeof(context->stack) / sizeof(context->stack[0]))
+	{
+		return;
+	}
+
+	context->stack[context->depth++] = b;
+	diff_children(context, a, b);
+	context->depth--;
+
+	if (context->printed > context->depth)
+	{
+		context->printed = context->depth;
+	}
+}
+
+size_t diff_trees(FILE *f, struct tracee *old, struct tracee *new, struct options *options)
+{
+	struct diff_context *context = xcalloc(1, sizeof(*context));
+	size_t ndifferences;
+
+	context->f = f;
+	context->options = options;
+
+	bool root_changed = diff_details(context, old, new, false);
+
+	/* The roots are always shown, with the change in total running time. */
+	print_line_start(context, root_changed ? '~' : ' ', 0);
+	print_label(f, new);
+	print_duration_delta(context, old, new);
+	fprintf(f, "\n");
+
+	if (root_changed)
+	{
+		diff_details(context, old, new, true);
+		context->ndifferences++;
+		context->changed++;
+	}
+
+	context->printed = 1;
+	context->stack[context->depth++] = new;
+
+	diff_children(context, old, new);
+
+	fprintf(f, "%zu added, %zu removed, %zu changed\n", context->added, context->removed, context->changed);
+
+	ndifferences = context->ndifferences;
+	xfree(context);
+
+	return ndifferences;
+}
@@ -0,0 +1,22 @@
+#ifndef DIFF_H_INCLUDED
+#define DIFF_H_INCLUDED
+
+#include <stdio.h>
+
+#include "tracee.h"
+
+struct options;
+
+/*
+ * Align two trees and write a report of the differences to f.
+ *
+ * Children are matched first by identical arguments and working directory,
+ * then the remaining ones by command name and working directory, in both
+ * cases pairing the n:th occurrence in the old tree with the n:th in the new.
+ * Matched tracees are compared by arguments, working directory, environment
+ * and, with --timing, running time.
+ * Returns the number of differences found.
+ */
+size_t diff_trees(FILE *f, struct tracee *old, struct tracee *new, struct options *options);
+
+#endif
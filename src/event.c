@@ -0,0 +1,18 @@
+#include <stdio.h>
+
+#include "event.h"
+#include "tracee.h"
+#include "xmalloc.h"
+
+void event_free_data(struct event *event)
+{
+	free_string_list(event->argv);
+	free_string_list(event->envp);
+	xfree(event->cwd);
+	xfree(event->path);
+
+	event->argv = NULL;
+	event->envp = NULL;
+	event->cwd = NULL;
+	event->path = NULL;
+}
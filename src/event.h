@@ -0,0 +1,90 @@
+#ifndef EVENT_H_INCLUDED
+#define EVENT_H_INCLUDED
+
+#include <stdbool.h>
+
+#include "timestamp.h"
+
+/*
+ * Kinds of things that happen to a traced process.
+ */
+enum event_type
+{
+	/* A new tracee was created by `parent`, or is a root if `parent` is zero. */
+	EVENT_SPAWN,
+
+	/* The tracee executed a new program with `argv` and `envp`. */
+	EVENT_EXEC,
+
+	/* The tracee changed working directory to `cwd`. */
+	EVENT_CHDIR,
+
+	/* The tracee exited. */
+	EVENT_EXIT,
+
+	/* The tracee opened `path`, or wrote, created, renamed or removed it if `written`. */
+	EVENT_FILE,
+
+	/* CPU time and memory of the tracee were sampled. */
+	EVENT_SAMPLE,
+};
+
+/*
+ * Something that happened to a traced process, as captured by the tracer.
+ * Events are either built into a tree of tracees or recorded to a file.
+ */
+struct event
+{
+	enum event_type type;
+
+	/* Thread ID of the tracee the event happened to. */
+	long tid;
+
+	/* Time when the event happened. */
+	timestamp_t time;
+
+	/* EVENT_SPAWN: Thread ID of the parent tracee, or zero. */
+	long parent;
+
+	/* EVENT_SPAWN: The new tracee is a thread. */
+	bool is_a_thread;
+
+	/* EVENT_EXEC: Command line arguments and environment. */
+	char **argv;
+	char **envp;
+
+	/* EVENT_EXEC: Time from the first attempt to exec to the exec, or zero if unknown. */
+	timestamp_t exec_time;
+
+	/* EVENT_EXEC, EVENT_EXIT: Attempts to exec that failed since the
+	   previous exec, like the misses of a search of PATH. */
+	unsigned long failed_execs;
+
+	/* EVENT_EXIT: Wait status of the tracee, as from waitpid(), if known. */
+	int status;
+	bool has_status;
+
+	/* EVENT_CHDIR: New working directory. */
+	char *cwd;
+
+	/* EVENT_FILE: Path of the file, relative to the working directory
+	   of the tracee unless absolute. */
+	char *path;
+	bool written;
+
+	/* EVENT_FILE: Hash of the contents of a file that was read, or zero
+	   if they were not hashed. */
+	unsigned long long digest;
+
+	/* EVENT_SAMPLE: CPU time used since the previous sample in
+	   microseconds, and resident memory in KiB. */
+	unsigned long cpu_us;
+	unsigned long rss_kb;
+};
+
+/*
+ * Free the strings owned by an event.
+ */
+void event_free_data(struct event *event);
+
+#endif
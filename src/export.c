@@ -0,0 +1,507 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/mman.h>
+
+#include "export.h"
+#include "options.h"
+#include "xmalloc.h"
+
+#define NO_RECORD (-1)
+
+static size_t export_size(void)
+{
+	return sizeof(struct export_header)
+	     + sizeof(struct export_record) * EXPORT_CAPACITY
+	     + EXPORT_STRINGS_CAPACITY;
+}
+
+/* Make seq odd, so readers retry, before the data it protects is changed. */
+static void write_begin(_Atomic uint32_t *seq)
+{
+	uint32_t value = atomic_load_explicit(seq, memory_order_relaxed);
+
+	atomic_store_explicit(seq, value + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+static void write_end(_Atomic uint32_t *seq)
+{
+	atomic_fetch_add_explicit(seq, 1, memory_order_release);
+}
+
+static void generation_begin(struct export *export)
+{
+	uint64_t value = atomic_load_explicit(&export->header->generation, memory_order_relaxed);
+
+	atomic_store_explicit(&export->header->generation, value + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+static void generation_end(struct export *export)
+{
+	atomic_fetch_add_explicit(&export->header->generation, 1, memory_order_release);
+}
+
+static struct export_record *get_record(struct export *export, long tid)
+{
+	long index = (long) tidmap_get(&export->index, tid);
+
+	return index ? &export->records[index - 1] : NULL;
+}
+
+static int32_t index_of(struct export *export, struct export_record *record)
+{
+	return record ? record - export->records : NO_RECORD;
+}
+
+#define STRINGS_HALF (EXPORT_STRINGS_CAPACITY / 2)
+
+/* Bytes of strings moved per update while compacting, at most, plus those
+   of the last record moved. */
+#define COMPACT_STEP (256 << 10)
+
+/* Copy size bytes at data to the current half. Returns false if there is no room for them. */
+static bool append(struct export *export, struct export_string *string, const char *data, size_t size)
+{
+	if (export->strings_used + size > STRINGS_HALF)
+	{
+		string->offset = 0;
+		string->size = 0;
+		return false;
+	}
+
+	string->offset = export->strings_base + export->strings_used;
+	string->size = size;
+
+	memcpy(export->strings + string->offset, data, size);
+	export->strings_used += size;
+
+	return true;
+}
+
+/* Make the other half current. Strings in the previous half stay where they
+   are until compact_step() moved them. */
+static void compact_begin(struct export *export)
+{
+	export->strings_base = export->strings_base ? 0 : STRINGS_HALF;
+	export->strings_used = 0;
+	export->compacting = true;
+	export->compact_next = 0;
+}
+
+/* Move the strings of the next records from the previous half to the current one. */
+static void compact_step(struct export *export)
+{
+	uint32_t count = atomic_load_explicit(&export->header->count, memory_order_relaxed);
+	size_t moved = 0;
+
+	while (moved < COMPACT_STEP && export->compact_next < count)
+	{
+		struct export_record *record = &export->records[export->compact_next++];
+		struct export_string *strings[] = { &record->argv, &record->envp, &record->cwd };
+
+		if (!(record->flags & EXPORT_USED))
+		{
+			continue;
+		}
+
+		write_begin(&record->seq);
+
+		for (size_t j = 0; j < sizeof(strings) / sizeof(strings[0]); ++j)
+		{
+			struct export_string *string = strings[j];
+
+			/* Strings stored since compaction began are already in the current half. */
+			if (string->size == 0
+			    || (string->offset >= export->strings_base
+			        && string->offset < export->strings_base + STRINGS_HALF))
+			{
+				continue;
+			}
+
+			moved += string->size;
+
+			if (!append(export, string, export->strings + string->offset, string->size))
+			{
+				record->flags |= EXPORT_TRUNCATED;
+			}
+		}
+
+		write_end(&record->seq);
+	}
+
+	if (export->compact_next == count)
+	{
+		/* Let the strings still referenced take up at most half of the current
+		   half before the next compaction, so it doesn't start right away. */
+		export->compacting = false;
+		export->compact_at = export->strings_used * 2;
+
+		if (export->compact_at < STRINGS_HALF / 2)
+		{
+			export->compact_at = STRINGS_HALF / 2;
+		}
+	}
+}
+
+/* Copy size bytes of the string list to the current half.
+   Returns false if there is no room for them. */
+static bool store_strings(struct export *export, struct export_string *string, char **list, size_t size)
+{
+	string->offset = 0;
+	string->size = 0;
+
+	if (export->strings_used + size > STRINGS_HALF && !export->compacting)
+	{
+		compact_begin(export);
+	}
+
+	if (export->strings_used + size > STRINGS_HALF)
+	{
+		return false;
+	}
+
+	string->offset = export->strings_base + export->strings_used;
+	string->size = size;
+
+	for (; list && *list; ++list)
+	{
+		size_t len = strlen(*list) + 1;
+
+		memcpy(export->strings + export->strings_base + export->strings_used, *list, len);
+		export->strings_used += len;
+	}
+
+	return true;
+}
+
+static size_t list_size(char **list)
+{
+	size_t size = 0;
+
+	for (; list && *list; ++list)
+	{
+		size += strlen(*list) + 1;
+	}
+
+	return size;
+}
+
+static void link_child(struct export *export, struct export_record *parent, struct export_record *child)
+{
+	int32_t index = index_of(export, child);
+
+	write_begin(&parent->seq);
+
+	child->parent = index_of(export, parent);
+	child->prev_sibling = parent->last_child;
+
+	if (parent->last_child == NO_RECORD)
+	{
+		parent->first_child = index;
+	}
+	else
+	{
+		struct export_record *last = &export->records[parent->last_child];
+
+		write_begin(&last->seq);
+		last->next_sibling = index;
+		write_end(&last->seq);
+	}
+
+	parent->last_child = index;
+
+	write_end(&parent->seq);
+}
+
+/* Remove record from the children of its parent, and make its children roots. */
+static void unlink_record(struct export *export, struct export_record *record)
+{
+	struct export_record *prev = NULL, *next = NULL;
+
+	if (record->prev_sibling != NO_RECORD)
+	{
+		prev = &export->records[record->prev_sibling];
+
+		write_begin(&prev->seq);
+		prev->next_sibling = record->next_sibling;
+		write_end(&prev->seq);
+	}
+
+	if (record->next_sibling != NO_RECORD)
+	{
+		next = &export->records[record->next_sibling];
+
+		write_begin(&next->seq);
+		next->prev_sibling = record->prev_sibling;
+		write_end(&next->seq);
+	}
+
+	if (record->parent != NO_RECORD)
+	{
+		struct export_record *parent = &export->records[record->parent];
+
+		write_begin(&parent->seq);
+
+		if (prev == NULL)
+		{
+			parent->first_child = record->next_sibling;
+		}
+
+		if (next == NULL)
+		{
+			parent->last_child = record->prev_sibling;
+		}
+
+		write_end(&parent->seq);
+	}
+
+	for (int32_t i = record->first_child; i != NO_RECORD; i = export->records[i].next_sibling)
+	{
+		struct export_record *child = &export->records[i];
+
+		write_begin(&child->seq);
+		child->parent = NO_RECORD;
+		write_end(&child->seq);
+	}
+}
+
+static struct export_record *allocate(struct export *export)
+{
+	uint32_t count = atomic_load_explicit(&export->header->count, memory_order_relaxed);
+	struct export_record *record;
+
+	if (export->free != NO_RECORD)
+	{
+		record = &export->records[export->free];
+		export->free = record->next_sibling;
+		return record;
+	}
+
+	if (count == EXPORT_CAPACITY)
+	{
+		return NULL;
+	}
+
+	atomic_store_explicit(&export->header->count, count + 1, memory_order_release);
+
+	return &export->records[count];
+}
+
+static void apply_spawn(struct export *export, struct event *event)
+{
+	struct export_record *parent = event->parent ? get_record(export, event->parent) : NULL;
+	struct export_record *record = allocate(export);
+	struct export_string cwd = {0};
+	uint32_t flags = EXPORT_USED | (event->is_a_thread ? EXPORT_THREAD : 0);
+
+	if (record == NULL)
+	{
+		export->header->dropped++;
+		return;
+	}
+
+	/* Like in the tree, the working directory is inherited from the parent. */
+	if (parent && parent->cwd.size)
+	{
+		char *parent_cwd = strndup(export->strings + parent->cwd.offset, parent->cwd.size);
+
+		if (!store_strings(export, &cwd, (char *[]) { parent_cwd, NULL }, parent->cwd.size))
+		{
+			flags |= EXPORT_TRUNCATED;
+		}
+
+		xfree(parent_cwd);
+	}
+
+	write_begin(&record->seq);
+
+	record->flags = flags;
+	record->tid = event->tid;
+	record->parent = NO_RECORD;
+	record->first_child = NO_RECORD;
+	record->last_child = NO_RECORD;
+	record->prev_sibling = NO_RECORD;
+	record->next_sibling = NO_RECORD;
+	record->start_time = event->time;
+	memset(&record->argv, 0, sizeof(record->argv));
+	memset(&record->envp, 0, sizeof(record->envp));
+	record->cwd = cwd;
+
+	write_end(&record->seq);
+
+	tidmap_put(&export->index, event->tid, (void *) (long) (index_of(export, record) + 1));
+
+	if (parent)
+	{
+		link_child(export, parent, record);
+	}
+}
+
+static void apply_exit(struct export *export, struct export_record *record)
+{
+	unlink_record(export, record);
+	tidmap_remove(&export->index, record->tid);
+
+	write_begin(&record->seq);
+	record->flags = 0;
+	record->next_sibling = export->free;
+	write_end(&record->seq);
+
+	export->free = index_of(export, record);
+}
+
+/* Replace a string or string list of record. */
+static void apply_strings(struct export *export, struct export_record *record,
+                          struct export_string *string, char **list)
+{
+	struct export_string stored;
+	bool truncated = !store_strings(export, &stored, list, list_size(list));
+
+	write_begin(&record->seq);
+
+	*string = stored;
+
+	if (truncated)
+	{
+		record->flags |= EXPORT_TRUNCATED;
+	}
+
+	write_end(&record->seq);
+}
+
+int export_open(struct export *export, const char *path, struct options *options)
+{
+	size_t size = export_size();
+	void *map;
+
+	memset(export, 0, sizeof(*export));
+	export->free = NO_RECORD;
+	export->compact_at = STRINGS_HALF / 2;
+	export->environ = !options->exclude_environ;
+
+	export->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (export->fd < 0)
+	{
+		return -1;
+	}
+
+	export->path = strdup(path);
+
+	if (ftruncate(export->fd, size) < 0)
+	{
+		int saved = errno;
+		export_close(export);
+		errno = saved;
+		return -1;
+	}
+
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, export->fd, 0);
+	if (map == MAP_FAILED)
+	{
+		int saved = errno;
+		export_close(export);
+		errno = saved;
+		return -1;
+	}
+
+	export->header = map;
+	export->records = (struct export_record *) (export->header + 1);
+	export->strings = (char *) (export->records + EXPORT_CAPACITY);
+
+	export->header->version = EXPORT_VERSION;
+	export->header->record_size = sizeof(struct export_record);
+	export->header->capacity = EXPORT_CAPACITY;
+	export->header->records_offset = (char *) export->records - (char *) map;
+	export->header->strings_offset = export->strings - (char *) map;
+	export->header->strings_capacity = EXPORT_STRINGS_CAPACITY;
+
+	/* Readers check the magic last. */
+	atomic_thread_fence(memory_order_release);
+	export->header->magic = EXPORT_MAGIC;
+
+	return 0;
+}
+
+void export_apply(struct export *export, struct event *event)
+{
+	struct export_record *record;
+
+	if (export->header == NULL)
+	{
+		return;
+	}
+
+	generation_begin(export);
+
+	if (event->type == EVENT_SPAWN)
+	{
+		apply_spawn(export, event);
+	}
+	else if ((record = get_record(export, event->tid)))
+	{
+		switch (event->type)
+		{
+		case EVENT_EXEC:
+			apply_strings(export, record, &record->argv, event->argv);
+
+			if (export->environ)
+			{
+				apply_strings(export, record, &record->envp, event->envp);
+			}
+			break;
+
+		case EVENT_CHDIR:
+			apply_strings(export, record, &record->cwd, (char *[]) { event->cwd, NULL });
+			break;
+
+		case EVENT_EXIT:
+			apply_exit(export, record);
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	if (!export->compacting && export->strings_used > export->compact_at)
+	{
+		compact_begin(export);
+	}
+
+	if (export->compacting)
+	{
+		compact_step(export);
+	}
+
+	generation_end(export);
+}
+
+void export_close(struct export *export)
+{
+	if (export->header)
+	{
+		munmap(export->header, export_size());
+		export->header = NULL;
+	}
+
+	if (export->fd >= 0)
+	{
+		close(export->fd);
+		export->fd = -1;
+	}
+
+	if (export->path)
+	{
+		unlink(export->path);
+		xfree(export->path);
+		export->path = NULL;
+	}
+
+	tidmap_clear(&export->index);
+}
@@ -0,0 +1,161 @@
+#ifndef EXPORT_H_INCLUDED
+#define EXPORT_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "tidmap.h"
+#include "event.h"
+
+struct options;
+
+/*
+ * Shared memory export of the running tracees.
+ *
+ * The file starts with a struct export_header, followed by `capacity`
+ * fixed-size records and a region of strings. Every running tracee has a
+ * record, linked to its parent and children by record index, or -1. Records
+ * of exited tracees are unused, and reused for new tracees. String lists
+ * are stored as consecutive NUL terminated strings in the string region.
+ *
+ * The tracer never waits for readers. Readers check for concurrent updates
+ * instead, in the manner of a seqlock:
+ *   * One record is consistent if its `seq` was even before it, and its
+ *     strings, were copied, and is unchanged after.
+ *   * All records are consistent with each other if the same holds for
+ *     `generation` of the header, which changes with every update.
+ */
+
+/* "ptsh" */
+#define EXPORT_MAGIC 0x68737470
+#define EXPORT_VERSION 1
+
+/* Size of the export. The file is sparse, unused parts take no memory. */
+#define EXPORT_CAPACITY (1 << 16)
+#define EXPORT_STRINGS_CAPACITY (64 << 20)
+
+enum export_flags
+{
+	/* The record belongs to a running tracee. */
+	EXPORT_USED = 1,
+
+	/* The tracee is a thread. */
+	EXPORT_THREAD = 2,
+
+	/* Some strings of the tracee did not fit and are left empty. */
+	EXPORT_TRUNCATED = 4,
+};
+
+/* A string or string list, at offset in the string region. */
+struct export_string
+{
+	uint64_t offset;
+	uint64_t size;
+};
+
+struct export_record
+{
+	_Atomic uint32_t seq;
+	uint32_t flags;
+	int64_t tid;
+
+	/* Record indices, or -1. */
+	int32_t parent;
+	int32_t first_child;
+	int32_t last_child;
+	int32_t prev_sibling;
+	int32_t next_sibling;
+	int32_t reserved;
+
+	/* Monotonic time in nanoseconds when the tracee was first seen. */
+	uint64_t start_time;
+
+	struct export_string argv;
+	struct export_string envp;
+	struct export_string cwd;
+};
+
+struct export_header
+{
+	uint32_t magic;
+	uint32_t version;
+
+	/* Odd while an update is in progress. */
+	_Atomic uint64_t generation;
+
+	/* Size of a record, and number of records allocated. */
+	uint32_t record_size;
+	uint32_t capacity;
+
+	/* Records from index zero to count have been used. */
+	_Atomic uint32_t count;
+	uint32_t reserved;
+
+	/* Offsets from the start of the file. */
+	uint64_t records_offset;
+	uint64_t strings_offset;
+	uint64_t strings_capacity;
+
+	/* Tracees without a record, because all were in use. */
+	uint64_t dropped;
+};
+
+/*
+ * Writer of the export.
+ */
+struct export
+{
+	int fd;
+	char *path;
+
+	/* The mapped file, or NULL. */
+	struct export_header *header;
+	struct export_record *records;
+	char *strings;
+
+	/*
+	 * The string region is used one half at a time. Strings are stored in
+	 * the current half, at strings_base, of which strings_used bytes are in
+	 * use, including strings no longer referenced. When it fills up, the
+	 * other half becomes current and the strings still referenced are moved
+	 * there a few records per update, from compact_next up to count, so no
+	 * single update copies all of them.
+	 */
+	size_t strings_base;
+	size_t strings_used;
+	bool compacting;
+	uint32_t compact_next;
+
+	/* Compaction starts once strings_used exceeds this. */
+	size_t compact_at;
+
+	/* Record index plus one, by tid. */
+	struct tidmap index;
+
+	/* First unused record below count, linked through next_sibling, or -1. */
+	int32_t free;
+
+	/* Export environments. */
+	bool environ;
+};
+
+/*
+ * Create the export file at path, replacing any existing file.
+ * Returns 0 on success and -1 on failure, errno is set by the
+ * corresponding libc call.
+ */
+int export_open(struct export *export, const char *path, struct options *options);
+
+/*
+ * Update the export with event. Does nothing if the export is not open.
+ */
+void export_apply(struct export *export, struct event *event);
+
+/*
+ * Unmap and remove the export file. Readers that mapped it keep the last state.
+ */
+void export_close(struct export *export);
+
+#endif
@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <dirent.h>
+#include <err.h>
+
+#include <sys/wait.h>
+
+#include <linux/limits.h>
+
+#include "follow.h"
+#include "tracer.h"
+#include "options.h"
+#include "task.h"
+
+extern char **environ;
+
+static void emit(struct follower *follower, struct event *event)
+{
+	follower->emit(event, follower->data);
+}
+
+/* Emit the exec of pid, with its arguments read from /proc. */
+static void emit_exec(struct follower *follower, long pid, timestamp_t time)
+{
+	struct task task = { .tid = pid };
+	struct event exec = { .type = EVENT_EXEC, .tid = pid, .time = time };
+	struct event chdir = { .type = EVENT_CHDIR, .tid = pid, .time = time };
+
+	/* The process may already be gone, and keeps no arguments. */
+	if (task_read_info_from_proc_dir(&task, &follower->options->limits, &exec.argv, &exec.envp, &chdir.cwd) == 0)
+	{
+		emit(follower, &chdir);
+		emit(follower, &exec);
+	}
+}
+
+static void emit_spawn(struct follower *follower, long tid, long parent, bool is_a_thread, timestamp_t time)
+{
+	struct event spawn = { .type = EVENT_SPAWN, .tid = tid, .time = time };
+
+	spawn.parent = parent;
+	spawn.is_a_thread = is_a_thread;
+
+	tidmap_put(&follower->traced, tid, follower);
+	emit(follower, &spawn);
+}
+
+/* Follow the existing process pid and its threads. */
+static void follow_process(struct follower *follower, long pid, long parent)
+{
+	char path[PATH_MAX];
+	struct dirent *entry;
+	DIR *dir;
+
+	emit_spawn(follower, pid, parent, false, timestamp_now());
+	emit_exec(follower, pid, timestamp_now());
+
+	if (follower->options->no_threads)
+	{
+		return;
+	}
+
+	snprintf(path, sizeof(path), "/proc/%ld/task", pid);
+
+	dir = opendir(path);
+	if (dir == NULL)
+	{
+		return;
+	}
+
+	while ((entry = readdir(dir)))
+	{
+		long tid = strtol(entry->d_name, NULL, 10);
+
+		if (tid > 0 && tid != pid && !tidmap_get(&follower->traced, tid))
+		{
+			emit_spawn(follower, tid, pid, true, timestamp_now());
+		}
+	}
+
+	closedir(dir);
+}
+
+/* Parent of pid, from /proc/<pid>/stat, or zero. */
+static long read_parent(long pid)
+{
+	char path[PATH_MAX];
+	char stat[512];
+	long parent = 0;
+	ssize_t len;
+	char *end;
+	int fd;
+
+	snprintf(path, sizeof(path), "/proc/%ld/stat", pid);
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		return 0;
+	}
+
+	len = read(fd, stat, sizeof(stat) - 1);
+	close(fd);
+
+	if (len <= 0)
+	{
+		return 0;
+	}
+
+	stat[len] = 0;
+
+	/* The command name may contain any character, the state and parent follow it. */
+	end = strrchr(stat, ')');
+
+	if (end == NULL || sscanf(end + 1, " %*c %ld", &parent) != 1)
+	{
+		return 0;
+	}
+
+	return parent;
+}
+
+/* Follow the existing descendants of followed processes. Processes they
+   create from now on are reported by the backend. */
+static void follow_descendants(struct follower *follower)
+{
+	struct dirent *entry;
+	size_t count;
+	DIR *dir;
+
+	do
+	{
+		count = 0;
+
+		dir = opendir("/proc");
+		if (dir == NULL)
+		{
+			return;
+		}
+
+		while ((entry = readdir(dir)))
+		{
+			long pid = strtol(entry->d_name, NULL, 10);
+			long parent;
+
+			if (pid <= 0 || tidmap_get(&follower->traced, pid))
+			{
+				continue;
+			}
+
+			parent = read_parent(pid);
+
+			if (parent > 0 && tidmap_get(&follower->traced, parent))
+			{
+				follow_process(follower, pid, parent);
+				count++;
+			}
+		}
+
+		closedir(dir);
+	}
+	while (count > 0);
+}
+
+static long spawn(struct follower *follower, char **command)
+{
+	timestamp_t start_time = timestamp_now();
+	struct event exec = { .type = EVENT_EXEC, .time = start_time };
+	struct event chdir = { .type = EVENT_CHDIR, .time = start_time };
+	struct strcap cap;
+	long pid = fork();
+
+	if (pid < 0)
+	{
+		return -1;
+	}
+
+	if (pid == 0)
+	{
+		tracer_exec(follower->options, command);
+	}
+
+	exec.tid = pid;
+	chdir.tid = pid;
+
+	tidmap_put(&follower->children, pid, follower);
+	emit_spawn(follower, pid, 0, false, start_time);
+
+	/* A short-lived command is often gone before its exec notification is
+	   resolved through /proc, so its exec is emitted from what it was
+	   started with, like the ptrace backend does. */
+	strcap_init(&cap, &follower->options->limits);
+	exec.argv = strcap_copy_list(&cap, command);
+	exec.envp = strcap_copy_list(&cap, environ);
+	chdir.cwd = getcwd(NULL, 0);
+
+	if (chdir.cwd)
+	{
+		emit(follower, &chdir);
+	}
+
+	emit(follower, &exec);
+	tidmap_put(&follower->exec_emitted, pid, follower);
+
+	return pid;
+}
+
+void follower_init(struct follower *follower, struct options *options,
+                   void (*emit)(struct event *event, void *data), void *data)
+{
+	memset(follower, 0, sizeof(*follower));
+	follower->options = options;
+	follower->emit = emit;
+	follower->data = data;
+}
+
+int follower_start(struct follower *follower)
+{
+	struct options *options = follower->options;
+	size_t started = 0;
+
+	for (size_t i = 0; i < options->ncommands; ++i)
+	{
+		if (spawn(follower, options->commands[i]) < 0)
+		{
+			warn("Failed to start %s", options->commands[i][0]);
+			continue;
+		}
+
+		started++;
+	}
+
+	for (size_t i = 0; i < options->nattach; ++i)
+	{
+		long pid = options->attach[i];
+
+		if (tidmap_get(&follower->traced, pid))
+		{
+			continue;
+		}
+
+		if (kill(pid, 0) < 0)
+		{
+			warn("Failed to attach to process %ld", pid);
+			continue;
+		}
+
+		follow_process(follower, pid, 0);
+		started++;
+	}
+
+	if (started == 0)
+	{
+		return -1;
+	}
+
+	follow_descendants(follower);
+	return 0;
+}
+
+
+void follower_fork(struct follower *follower, long parent_tid, long parent_tgid,
+                   long child_tid, long child_tgid, timestamp_t time)
+{
+	long parent;
+
+	/* Already found by reading /proc, when its creator was followed. */
+	if (tidmap_get(&follower->traced, child_tid))
+	{
+		return;
+	}
+
+	if (child_tid != child_tgid)
+	{
+		/* Threads are children of their process in the tree. */
+		if (follower->options->no_threads || !tidmap_get(&follower->traced, child_tgid))
+		{
+			return;
+		}
+
+		emit_spawn(follower, child_tid, child_tgid, true, time);
+		return;
+	}
+
+	if (!tidmap_get(&follower->traced, parent_tgid))
+	{
+		return;
+	}
+
+	/* Attributed to the thread that forked, if threads are followed. */
+	parent = parent_tgid;
+
+	if (!follower->options->no_threads && tidmap_get(&follower->traced, parent_tid))
+	{
+		parent = parent_tid;
+	}
+
+	emit_spawn(follower, child_tid, parent, false, time);
+}
+
+void follower_exec(struct follower *follower, long pid, timestamp_t time)
+{
+	if (tidmap_remove(&follower->exec_emitted, pid))
+	{
+		return;
+	}
+
+	if (tidmap_get(&follower->traced, pid))
+	{
+		emit_exec(follower, pid, time);
+	}
+}
+
+void follower_exit(struct follower *follower, long tid, timestamp_t time, int status, bool has_status)
+{
+	struct event event = { .type = EVENT_EXIT, .tid = tid, .time = time };
+
+	event.status = status;
+	event.has_status = has_status;
+
+	if (!tidmap_remove(&follower->traced, tid))
+	{
+		return;
+	}
+
+	emit(follower, &event);
+
+	/* Spawned commands are reaped, the exit is reported just before they can be. */
+	if (tidmap_remove(&follower->children, tid))
+	{
+		tidmap_remove(&follower->exec_emitted, tid);
+		while (waitpid(tid, NULL, 0) < 0 && errno == EINTR);
+	}
+}
+
+void follower_clear(struct follower *follower)
+{
+	tidmap_clear(&follower->traced);
+	tidmap_clear(&follower->children);
+	tidmap_clear(&follower->exec_emitted);
+}
@@ -0,0 +1,77 @@
+#ifndef FOLLOW_H_INCLUDED
+#define FOLLOW_H_INCLUDED
+
+#include <stdbool.h>
+
+#include "tidmap.h"
+#include "event.h"
+#include "timestamp.h"
+
+struct options;
+
+/*
+ * Follows processes from notifications of every fork, exec and exit on
+ * the system, as received by the backends that don't stop processes.
+ * Notifications about processes that are not descendants of the followed
+ * ones are ignored. Arguments, environment and working directory are read
+ * from /proc at every exec, so they may be missing for processes that exit
+ * right away, except for the commands started by the follower itself.
+ * Changes of the working directory without an exec are not seen.
+ */
+struct follower
+{
+	/* Followed threads, by tid. */
+	struct tidmap traced;
+
+	/* Spawned commands, which are children of the tracer that must be reaped. */
+	struct tidmap children;
+
+	/* Spawned commands whose exec was emitted when they were started, and
+	   whose first exec notification is not emitted again. */
+	struct tidmap exec_emitted;
+
+	/* Options of the session. */
+	struct options *options;
+
+	/* Called with every event. Takes ownership of the strings in the event. */
+	void (*emit)(struct event *event, void *data);
+	void *data;
+};
+
+/*
+ * Initialize a follower without any followed processes.
+ */
+void follower_init(struct follower *follower, struct options *options,
+                   void (*emit)(struct event *event, void *data), void *data);
+
+/*
+ * Start all commands and follow all pids given in the options, along with
+ * their existing descendants. Notifications must be received from before
+ * this call.
+ * Returns 0 on success and -1 if none of them could be followed.
+ */
+int follower_start(struct follower *follower);
+
+/*
+ * Thread parent_tid of process parent_tgid created thread child_tid of
+ * process child_tgid, which is a new process if they are the same.
+ */
+void follower_fork(struct follower *follower, long parent_tid, long parent_tgid,
+                   long child_tid, long child_tgid, timestamp_t time);
+
+/*
+ * Process pid executed a new program.
+ */
+void follower_exec(struct follower *follower, long pid, timestamp_t time);
+
+/*
+ * Thread tid exited, with the wait status status if has_status.
+ */
+void follower_exit(struct follower *follower, long tid, timestamp_t time, int status, bool has_status);
+
+/*
+ * Stop following all processes.
+ */
+void follower_clear(struct follower *follower);
+
+#endif
@@ -0,0 +1,179 @@
+#include <string.h>
+
+#include "hash.h"
+
+#define PRIME1 0x9e3779b185ebca87ull
+#define PRIME2 0xc2b2ae3d27d4eb4full
+#define PRIME3 0x165667b19e3779f9ull
+#define PRIME4 0x85ebca77c2b2ae63ull
+#define PRIME5 0x27d4eb2f165667c5ull
+
+static uint64_t rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+/* Read little endian integers, regardless of the byte order of the host. */
+static uint64_t read64(const unsigned char *p)
+{
+	uint64_t value = 0;
+
+	for (int i = 7; i >= 0; --i)
+	{
+		value = (value << 8) | p[i];
+	}
+
+	return value;
+}
+
+static uint32_t read32(const unsigned char *p)
+{
+	return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static uint64_t round64(uint64_t lane, uint64_t input)
+{
+	lane += input * PRIME2;
+	lane = rotl(lane, 31);
+	return lane * PRIME1;
+}
+
+static uint64_t merge_round(uint64_t hash, uint64_t lane)
+{
+	hash ^= round64(0, lane);
+	return hash * PRIME1 + PRIME4;
+}
+
+static void consume_stripe(struct hash64 *state, const unsigned char *p)
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		state->lanes[i] = round64(state->lanes[i], read64(p + 8 * i));
+	}
+}
+
+void hash64_init(struct hash64 *state, uint64_t seed)
+{
+	memset(state, 0, sizeof(*state));
+
+	state->seed = seed;
+	state->lanes[0] = seed + PRIME1 + PRIME2;
+	state->lanes[1] = seed + PRIME2;
+	state->lanes[2] = seed;
+	state->lanes[3] = seed - PRIME1;
+}
+
+void hash64_update(struct hash64 *state, const void *data, size_t size)
+{
+	const unsigned char *p = data;
+	size_t fill;
+
+	state->total += size;
+
+	if (state->buflen + size < sizeof(state->buf))
+	{
+		memcpy(state->buf + state->buflen, p, size);
+		state->buflen += size;
+		return;
+	}
+
+	if (state->buflen > 0)
+	{
+		fill = sizeof(state->buf) - state->buflen;
+		memcpy(state->buf + state->buflen, p, fill);
+		consume_stripe(state, state->buf);
+
+		p += fill;
+		size -= fill;
+		state->buflen = 0;
+	}
+
+	for (; size >= sizeof(state->buf); p += sizeof(state->buf), size -= sizeof(state->buf))
+	{
+		consume_stripe(state, p);
+	}
+
+	memcpy(state->buf, p, size);
+	state->buflen = size;
+}
+
+uint64_t hash64_digest(const struct hash64 *state)
+{
+	const unsigned char *p = state->buf;
+	size_t size = state->buflen;
+	uint64_t hash;
+
+	if (state->total >= sizeof(state->buf))
+	{
+		hash = rotl(state->lanes[0], 1) + rotl(state->lanes[1], 7)
+		     + rotl(state->lanes[2], 12) + rotl(state->lanes[3], 18);
+
+		for (int i = 0; i < 4; ++i)
+		{
+			hash = merge_round(hash, state->lanes[i]);
+		}
+	}
+	else
+	{
+		hash = state->seed + PRIME5;
+	}
+
+	hash += state->total;
+
+	for (; size >= 8; p += 8, size -= 8)
+	{
+		hash ^= round64(0, read64(p));
+		hash = rotl(hash, 27) * PRIME1 + PRIME4;
+	}
+
+	if (size >= 4)
+	{
+		hash ^= (uint64_t) read32(p) * PRIME1;
+		hash = rotl(hash, 23) * PRIME2 + PRIME3;
+		p += 4;
+		size -= 4;
+	}
+
+	for (; size > 0; ++p, --size)
+	{
+		hash ^= *p * PRIME5;
+		hash = rotl(hash, 11) * PRIME1;
+	}
+
+	hash ^= hash >> 33;
+	hash *= PRIME2;
+	hash ^= hash >> 29;
+	hash *= PRIME3;
+	hash ^= hash >> 32;
+
+	return hash;
+}
+
+uint64_t hash64(const void *data, size_t size, uint64_t seed)
+{
+	struct hash64 state;
+
+	hash64_init(&state, seed);
+	hash64_update(&state, data, size);
+
+	return hash64_digest(&state);
+}
+
+uint64_t hash_fnv1a_bytes(const void *data, size_t size, uint64_t seed)
+{
+	const unsigned char *bytes = data;
+	uint64_t hash = seed;
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+uint64_t hash_fnv1a(const char *str, uint64_t seed)
+{
+	return hash_fnv1a_bytes(str, strlen(str), seed);
+}
@@ -0,0 +1,57 @@
+#ifndef HASH_H_INCLUDED
+#define HASH_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * XXH64, a fast non-cryptographic hash whose values are the same on every
+ * platform, so they can be compared across runs and machines.
+ */
+struct hash64
+{
+	uint64_t lanes[4];
+	uint64_t total;
+	uint64_t seed;
+
+	/* Input that doesn't fill a stripe of 32 bytes yet. */
+	unsigned char buf[32];
+	size_t buflen;
+};
+
+/* Initial value of FNV-1a hashes. */
+#define HASH_FNV1A_SEED 0xcbf29ce484222325ull
+
+/*
+ * FNV-1a, a simpler hash for short keys of in-memory tables. Hashes size
+ * bytes at data, continuing from seed, which is HASH_FNV1A_SEED or the
+ * hash of the input before it.
+ */
+uint64_t hash_fnv1a_bytes(const void *data, size_t size, uint64_t seed);
+
+/*
+ * FNV-1a of str without its terminating null byte, see hash_fnv1a_bytes().
+ */
+uint64_t hash_fnv1a(const char *str, uint64_t seed);
+
+/*
+ * Hash size bytes at data.
+ */
+uint64_t hash64(const void *data, size_t size, uint64_t seed);
+
+/*
+ * Start hashing input given in pieces.
+ */
+void hash64_init(struct hash64 *state, uint64_t seed);
+
+/*
+ * Add size bytes at data to the input.
+ */
+void hash64_update(struct hash64 *state, const void *data, size_t size);
+
+/*
+ * Hash of all input added so far.
+ */
+uint64_t hash64_digest(const struct hash64 *state);
+
+#endif
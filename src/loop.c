@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+
+#include "loop.h"
+#include "xmalloc.h"
+
+#define LOOP_MAX_EVENTS 16
+
+static int add_source(struct loop *loop, int type, int fd, loop_fn_t fn, void *data)
+{
+	struct loop_source *source = xcalloc(1, sizeof(*source));
+	struct epoll_event event = { .events = EPOLLIN, .data.ptr = source };
+
+	source->type = type;
+	source->fd = fd;
+	source->fn = fn;
+	source->data = data;
+
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &event) < 0)
+	{
+		xfree(source);
+		return -1;
+	}
+
+	source->next = loop->sources;
+	loop->sources = source;
+
+	return 0;
+}
+
+/* Free sources removed during the last dispatch. */
+static void collect_removed(struct loop *loop)
+{
+	struct loop_source **link = &loop->sources;
+
+	while (*link)
+	{
+		struct loop_source *source = *link;
+
+		if (source->removed)
+		{
+			*link = source->next;
+			xfree(source);
+		}
+		else
+		{
+			link = &source->next;
+		}
+	}
+}
+
+static void dispatch(struct loop_source *source, uint32_t events)
+{
+	long value = events;
+
+	if (source->type == LOOP_TIMER)
+	{
+		uint64_t expirations;
+
+		if (read(source->fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+		{
+			return;
+		}
+
+		value = expirations;
+	}
+	else if (source->type == LOOP_SIGNAL)
+	{
+		struct signalfd_siginfo info;
+
+		if (read(source->fd, &info, sizeof(info)) != sizeof(info))
+		{
+			return;
+		}
+
+		value = info.ssi_signo;
+	}
+
+	source->fn(value, source->data);
+}
+
+int loop_init(struct loop *loop)
+{
+	loop->sources = NULL;
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+
+	return loop->epfd < 0 ? -1 : 0;
+}
+
+int loop_add_fd(struct loop *loop, int fd, loop_fn_t fn, void *data)
+{
+	return add_source(loop, LOOP_FD, fd, fn, data);
+}
+
+int loop_set_writable(struct loop *loop, int fd, bool writable)
+{
+	for (struct loop_source *source = loop->sources; source; source = source->next)
+	{
+		if (source->fd == fd && !source->removed)
+		{
+			struct epoll_event event = { .events = EPOLLIN, .data.ptr = source };
+
+			if (writable)
+			{
+				event.events |= EPOLLOUT;
+			}
+
+			return epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &event);
+		}
+	}
+
+	errno = ENOENT;
+	return -1;
+}
+
+void loop_remove_fd(struct loop *loop, int fd)
+{
+	for (struct loop_source *source = loop->sources; source; source = source->next)
+	{
+		if (source->fd == fd && !source->removed)
+		{
+			epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+			source->removed = true;
+			return;
+		}
+	}
+}
+
+int loop_add_timer(struct loop *loop, timestamp_t interval, loop_fn_t fn, void *data)
+{
+	struct itimerspec spec = {0};
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0)
+	{
+		return -1;
+	}
+
+	spec.it_interval.tv_sec = interval / NS_PER_SEC;
+	spec.it_interval.tv_nsec = interval % NS_PER_SEC;
+	spec.it_value = spec.it_interval;
+
+	if (timerfd_settime(fd, 0, &spec, NULL) < 0 || add_source(loop, LOOP_TIMER, fd, fn, data) < 0)
+	{
+		int saved = errno;
+		close(fd);
+		errno = saved;
+		return -1;
+	}
+
+	return 0;
+}
+
+int loop_add_signals(struct loop *loop, const sigset_t *set, loop_fn_t fn, void *data)
+{
+	int fd;
+
+	if (sigprocmask(SIG_BLOCK, set, NULL) < 0)
+	{
+		return -1;
+	}
+
+	fd = signalfd(-1, set, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (fd < 0)
+	{
+		return -1;
+	}
+
+	if (add_source(loop, LOOP_SIGNAL, fd, fn, data) < 0)
+	{
+		int saved = errno;
+		close(fd);
+		errno = saved;
+		return -1;
+	}
+
+	return 0;
+}
+
+int loop_run_once(struct loop *loop)
+{
+	struct epoll_event events[LOOP_MAX_EVENTS];
+	int n;
+
+	n = epoll_wait(loop->epfd, events, LOOP_MAX_EVENTS, -1);
+
+	if (n < 0 && errno != EINTR)
+	{
+		return -1;
+	}
+
+	for (int i = 0; i < n; ++i)
+	{
+		struct loop_source *source = events[i].data.ptr;
+
+		if (!source->removed)
+		{
+			dispatch(source, events[i].events);
+		}
+	}
+
+	collect_removed(loop);
+	return 0;
+}
@@ -0,0 +1,84 @@
+#ifndef LOOP_H_INCLUDED
+#define LOOP_H_INCLUDED
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "timestamp.h"
+
+/*
+ * Callback of a source. The value is the ready epoll events for a file
+ * descriptor, the number of expirations for a timer, and the signal number
+ * for a signal.
+ */
+typedef void (*loop_fn_t)(long value, void *data);
+
+/*
+ * Event loop on epoll, multiplexing file descriptors, timers and signals.
+ */
+struct loop
+{
+	/* The epoll instance. */
+	int epfd;
+
+	/* All sources, including removed ones until the current dispatch is done. */
+	struct loop_source
+	{
+		enum { LOOP_FD, LOOP_TIMER, LOOP_SIGNAL } type;
+		int fd;
+		loop_fn_t fn;
+		void *data;
+		bool removed;
+		struct loop_source *next;
+	} *sources;
+};
+
+/*
+ * Create the epoll instance.
+ * Returns 0 on success and -1 on failure, errno is set by the
+ * corresponding libc call.
+ */
+int loop_init(struct loop *loop);
+
+/*
+ * Call fn when fd is readable, or has been closed by the other end.
+ * Returns 0 on success and -1 on failure, errno is set by the
+ * corresponding libc call.
+ */
+int loop_add_fd(struct loop *loop, int fd, loop_fn_t fn, void *data);
+
+/*
+ * Also call the callback of fd when it is writable, or stop doing so.
+ * Returns 0 on success and -1 on failure, errno is set by the
+ * corresponding libc call.
+ */
+int loop_set_writable(struct loop *loop, int fd, bool writable);
+
+/*
+ * Stop watching fd. The file descriptor is not closed.
+ */
+void loop_remove_fd(struct loop *loop, int fd);
+
+/*
+ * Call fn every interval nanoseconds.
+ * Returns 0 on success and -1 on failure, errno is set by the
+ * corresponding libc call.
+ */
+int loop_add_timer(struct loop *loop, timestamp_t interval, loop_fn_t fn, void *data);
+
+/*
+ * Block the signals in set and call fn when one of them is received.
+ * Returns 0 on success and -1 on failure, errno is set by the
+ * corresponding libc call.
+ */
+int loop_add_signals(struct loop *loop, const sigset_t *set, loop_fn_t fn, void *data);
+
+/*
+ * Wait for at least one source to become ready and call the callbacks of
+ * all ready sources.
+ * Returns 0 on success and -1 on failure, errno is set by epoll_wait().
+ */
+int loop_run_once(struct loop *loop);
+
+#endif
@@ -4,275 +4,288 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
+#include <fcntl.h>
 #include <err.h>
 
-#include <sys/ptrace.h>
-#include <sys/wait.h>
-#include <sys/syscall.h>
-
 #include <linux/limits.h>
 
 #include "options.h"
 #include "tracee.h"
-#include "status.h"
-
-extern char **environ;
-
-static struct tracee *create_root_tracee_from_command(char **command);
-static struct tracee *create_root_tracee_with_attach(long pid);
-
-static void handle_exit(struct tracee *tracee);
-static void handle_syscall(struct tracee *tracee);
-static void handle_new_tracee(int status, struct tracee *tracee);
-static void continue_tracee(long tid);
-
+#include "collapse.h"
+#include "event.h"
+#include "tree.h"
+#include "record.h"
+#include "diff.h"
+#include "snapshot.h"
+#include "session.h"
+
+static void replay(const char *path, struct tree *tree);
+static void replay_event(struct event *event, void *data);
+
+static void output(struct tracee *root);
+static void close_output(void);
 static void exit_fn(void);
-static void sigint_handler(int);
+
+static void setup_loop(void);
+static void handle_signal(long sig, void *data);
+static void read_control_fd(long events, void *data);
+static void handle_control_command(char *line);
+static void snapshot(output_fn_t fn);
 
 static struct options options = {0};
-static struct tracee *root = NULL;
 
-static char **execve_argv = NULL;
-static char **execve_envp = NULL;
+/* The traced processes, and the tree built from them. */
+static struct session session = {0};
+
+/* File descriptor commands are read from, and the unfinished line read from it. */
+static int control_fd = -1;
+static char control_buf[256];
+static size_t control_len = 0;
 
 int main(int argc, char **argv)
 {
 	options_parse_cmdline(&options, argc, argv);
 
-	if (options.command)
-	{
-		root = create_root_tracee_from_command(options.command);
-	}
-	else
-	{
-		root = create_root_tracee_with_attach(options.attach);
-	}
-
-	atexit(exit_fn);
-	signal(SIGINT, sigint_handler);
-
-	for (;;)
+	if (options.render)
 	{
-		struct tracee *tracee;
-		int status;
-		long tid;
-
-		tid = wait(&status);
+		struct tree tree = {0};
 
-		tracee = tracee_find_tid(root, tid);
-
-		if (tracee == NULL)
+		if (options.cache_keys)
 		{
-			continue_tracee(tid);
-			continue;
+			tree_set_cache_keys(&tree, options.cache_env);
 		}
 
-		if (WIFEXITED(status) || status_is_exit_event(status))
-		{
-			handle_exit(tracee);
-			continue;
-		}
-
-		if (!tracee->ptrace_options_set)
-		{
-			(void) tracee_set_ptrace_options(tracee);
-		}
+		replay(options.render, &tree);
+		output(tree.root);
+		close_output();
+		return EXIT_SUCCESS;
+	}
 
-		bool is_new_tracee = status_is_clone_event(status)
-		                  || status_is_fork_event(status)
-		                  || status_is_vfork_event(status);
+	if (options.diff_old)
+	{
+		struct tree old = {0}, new = {0};
 
-		if (is_new_tracee)
-		{
-			handle_new_tracee(status, tracee);
-			continue_tracee(tid);
-			continue;
-		}
+		replay(options.diff_old, &old);
+		replay(options.diff_new, &new);
 
-		if (status_is_syscall(status))
-		{
-			handle_syscall(tracee);
-			continue_tracee(tid);
-			continue;
-		}
+		diff_trees(options.outfile, old.root, new.root, &options);
+		close_output();
+		return EXIT_SUCCESS;
+	}
 
-		if (status_is_execve_event(status))
+	if (options.control_fd >= 0)
+	{
+		/* Not inherited by the traced command. */
+		if (fcntl(options.control_fd, F_SETFD, FD_CLOEXEC) < 0)
 		{
-			tracee->argv = execve_argv;
-			tracee->envp = execve_envp;
-
-			execve_argv = NULL;
-			execve_envp = NULL;
-
-			continue_tracee(tid);
-			continue;
+			err(EXIT_FAILURE, "Invalid control fd %d", options.control_fd);
 		}
 
-
-		continue_tracee(tid);
+		control_fd = options.control_fd;
 	}
-}
 
-static void exit_fn(void)
-{
-	if (root)
+	if (session_init(&session, &options, NULL) < 0)
 	{
-		tracee_detach(root);
+		exit(EXIT_FAILURE);
 	}
 
-	options.output_fn(options.outfile, root, &options);
-}
+	atexit(exit_fn);
 
-static void sigint_handler(int sig)
-{
-	exit(EXIT_SUCCESS);
-}
+	/* Before the session starts, so that worker threads don't receive the signals. */
+	setup_loop();
+	if (session_start(&session) < 0)
+	{
+		exit(EXIT_FAILURE);
+	}
 
-static void continue_tracee(long tid)
-{
-	if (ptrace(PTRACE_SYSCALL, tid, 0, 0) < 0)
+	session_run(&session, 0);
+
+	/* A server keeps answering queries after the session, until interrupted. */
+	while (options.serve && !session.failed)
 	{
-		err(EXIT_FAILURE, "ptrace(PTRACE_SYSCALL, %ld) failed", tid);
+		session_run(&session, 1);
 	}
+
+	return session.failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
-static struct tracee *create_root_tracee_from_command(char **command)
+static void handle_control_command(char *line)
 {
-	char cwdbuf[PATH_MAX];
-	long pid;
-	struct tracee *root;
-
-	pid = fork();
+	char *command = strtok(line, " \t");
+	char *arg = strtok(NULL, " \t");
 
-	if (pid < 0)
+	if (command == NULL)
 	{
-		err(EXIT_FAILURE, "Failed to fork process");
+		return;
 	}
 
-	if (pid > 0)
+	if (strcmp(command, "snapshot") == 0)
 	{
-		root = tracee_create();
+		output_fn_t fn = arg ? get_output_fn(arg) : options.output_fn;
 
-		root->tid = pid;
-		root->argv = copy_string_list(command);
-		root->envp = copy_string_list(environ);
-		root->cwd = strdup(getcwd(cwdbuf, sizeof(cwdbuf)));
+		if (fn == NULL)
+		{
+			warnx("Invalid snapshot format '%s'", arg);
+			return;
+		}
 
-		return root;
+		snapshot(fn);
+		return;
 	}
 
-	if (ptrace(PTRACE_TRACEME) < 0)
+	warnx("Invalid control command '%s'", command);
+}
+
+static void read_control_fd(long events, void *data)
+{
+	ssize_t n = read(control_fd, control_buf + control_len, sizeof(control_buf) - control_len);
+
+	if (n < 0 && errno == EINTR)
 	{
-		err(EXIT_FAILURE, "ptrace(PTRACE_TRACEME) failed");
+		return;
 	}
 
-	if (options.silent)
+	if (n <= 0)
 	{
-		FILE *devnull = fopen("/dev/null", "a");
-
-		if (devnull == NULL)
+		if (n < 0)
 		{
-			err(EXIT_FAILURE, "Failed to open /dev/null");
+			warn("Failed to read control fd %d", control_fd);
 		}
 
-		if (dup2(fileno(devnull), STDOUT_FILENO) < 0)
-		{
-			err(EXIT_FAILURE, "Failed to redirect stdout to /dev/null");
-		}
-
-		if (dup2(fileno(devnull), STDERR_FILENO) < 0)
-		{
-			err(EXIT_FAILURE, "Failed to redirect stderr to /dev/null");
-		}
+		loop_remove_fd(&session.loop, control_fd);
+		control_fd = -1;
+		return;
 	}
-	else if (options.redirect)
+
+	control_len += n;
+
+	char *line = control_buf;
+	char *newline;
+
+	while ((newline = memchr(line, '\n', control_buf + control_len - line)))
 	{
-		if (dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
-		{
-			err(EXIT_FAILURE, "Failed to redirect stderr to /dev/null");
-		}
+		*newline = 0;
+		handle_control_command(line);
+		line = newline + 1;
 	}
 
-	if (execvp(command[0], command) < 0)
+	control_len -= line - control_buf;
+	memmove(control_buf, line, control_len);
+
+	if (control_len == sizeof(control_buf))
 	{
-		err(EXIT_FAILURE, "Failed to execute %s", command[0]);
+		warnx("Control command too long, discarding it");
+		control_len = 0;
 	}
-
-	__builtin_unreachable();
 }
 
-static struct tracee *create_root_tracee_with_attach(long pid)
+static void setup_loop(void)
 {
-	struct tracee *root;
+	sigset_t signals;
+
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGUSR1);
 
-	if (ptrace(PTRACE_ATTACH, pid) < 0)
+	if (loop_add_signals(&session.loop, &signals, handle_signal, NULL) < 0)
 	{
-		err(EXIT_FAILURE, "Failed to attach to process %ld", pid);
+		err(EXIT_FAILURE, "Failed to create signalfd");
 	}
 
-	root = tracee_create();
-	root->tid = pid;
-
-	if (tracee_read_info_from_proc_dir(root) < 0)
+	if (control_fd >= 0 && loop_add_fd(&session.loop, control_fd, read_control_fd, NULL) < 0)
 	{
-		err(EXIT_FAILURE, "Failed to get info about root tracee %ld", pid);
+		err(EXIT_FAILURE, "Can't wait for control fd %d", control_fd);
 	}
-
-	return root;
 }
 
-static void handle_exit(struct tracee *tracee)
+static void handle_signal(long sig, void *data)
 {
-	if (tracee == root)
+	switch (sig)
 	{
+	case SIGINT:
 		exit(EXIT_SUCCESS);
+
+	case SIGUSR1:
+		snapshot(options.output_fn);
+		break;
 	}
 }
 
-static void handle_syscall(struct tracee *tracee)
+static void snapshot(output_fn_t fn)
 {
-	struct ptrace_syscall_info info;
-	(void) tracee_get_syscall_info(tracee, &info);
+	char path[PATH_MAX];
 
-	if (info.op != PTRACE_SYSCALL_INFO_ENTRY)
+	if (options.record)
 	{
+		warnx("Snapshots can't be taken when recording");
 		return;
 	}
 
-	switch (info.entry.nr)
+	if (snapshot_write(session.tree.root, fn, &options, path, sizeof(path)) < 0)
 	{
-	case SYS_execve:
-		execve_argv = tracee_read_string_list(tracee, info.entry.args[1]);
-		execve_envp = tracee_read_string_list(tracee, info.entry.args[2]);
-		break;
+		warn("Failed to write snapshot %s", path);
+	}
+}
 
-	case SYS_chdir:
-		(void) tracee_set_cwd_from_chdir_call(tracee, &info);
-		break;
 
-	case SYS_clone3:
-		(void) tracee_read_cl_args(tracee, &info);
-		break;
+static void replay(const char *path, struct tree *tree)
+{
+	if (record_replay(path, replay_event, tree) < 0)
+	{
+		exit(EXIT_FAILURE);
+	}
 
-	default:
-		break;
+	if (tree->root == NULL)
+	{
+		errx(EXIT_FAILURE, "Capture %s contains no processes", path);
 	}
 }
 
-static void handle_new_tracee(int status, struct tracee *tracee)
+static void replay_event(struct event *event, void *data)
 {
-	long newtid;
-	struct tracee *newtracee;
+	tree_apply_event(data, event);
+}
+
+
+static void output(struct tracee *root)
+{
+	if (options.collapse)
+	{
+		collapse_compute_shapes(root, &options);
+	}
+
+	output_sections(options.outfile, root, options.output_fn, &options);
+}
 
-	newtid = tracee_get_event_tid(tracee);
-	if (newtid < 0)
+/* Compressed output is only complete once closed. */
+static void close_output(void)
+{
+	if (options.outfile != stdout && fclose(options.outfile) == EOF)
 	{
-		err(EXIT_FAILURE, "ptrace(PTRACE_GETEVENTMSG, %ld, ...) failed", tracee->tid);
+		warn("Failed to write output file %s", options.output_path);
 	}
 
-	newtracee = tracee_create();
-	newtracee->tid = newtid;
+	options.outfile = stdout;
+
+	if (options.env_table && fclose(options.env_table) == EOF)
+	{
+		warn("Failed to write environment table %s", options.env_table_path);
+	}
 
-	tracee_add_child(tracee, newtracee);
+	options.env_table = NULL;
 }
 
+static void exit_fn(void)
+{
+	if (session_stop(&session) < 0)
+	{
+		warn("Failed to write capture file %s", options.record);
+	}
+
+	if (!options.record)
+	{
+		output(session.tree.root);
+	}
+
+	close_output();
+}
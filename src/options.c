@@ -2,24 +2,82 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 #include <err.h>
 
 #include "options.h"
+#include "compress.h"
+#include "xmalloc.h"
 
 static void usage(struct options *options, FILE *f)
 {
 	fprintf(f,
-	        "Usage: %s [options...] [args...]\n"
+	        "Usage: %s [options...] [--] [args...]\n"
+	        "       %s -m [options...] [--] [args...] [-- args...]...\n"
+	        "       %s render <capture> [options...]\n"
+	        "       %s diff <old capture> <new capture> [options...]\n"
 	        "Options:\n"
 	        "    -h, --help                Display this help message.\n"
-	        "    -a, --attach <pid>        Attach to a running process.\n"
+	        "    -a, --attach <pid>        Attach to a running process, with all its threads and descendants.\n"
+	        "                              May be repeated, and combined with commands.\n"
+	        "                              The session ends when all of them have exited.\n"
+	        "    -m, --multiple            Trace several commands, separated by --, which then can't be an\n"
+	        "                              argument of a command.\n"
 	        "    -o, --output <file>       Write output to <file>.\n"
+	        "    -N, --env-table <file>    With table output, write environments to <file>, one row per variable,\n"
+	        "                              and refer to them by id. Table snapshots get environment tables of\n"
+	        "                              their own.\n"
+	        "    -z, --compress            Compress output to <file> with gzip, which must end with .gz.\n"
+	        "                              Captures compressed with gzip are read by render and diff.\n"
+	        "    -R, --record <file>       Write a binary capture to <file> instead of output, see render.\n"
 	        "    -e, --exclude <pattern>   Exclude processes with arguments matching regular expression <pattern>.\n"
 	        "    -s, --silent              Redirect child processes stdout and stderr to /dev/null.\n"
 	        "    -r, --redirect            Redirect child processes stdout to stderr.\n"
 	        "    -n, --no-env              Exclude environment from output.\n"
+	        "    -k, --ring <count>        Only keep the <count> most recently exited processes, along with running\n"
+	        "                              ones and their ancestors.\n"
+	        "    -S, --snapshot-dir <dir>  Write snapshots, requested with SIGUSR1 or the control fd, to <dir>,\n"
+	        "                              the current directory by default. Snapshots are timestamped files of\n"
+	        "                              their own, SIGUSR1 doesn't write to the output.\n"
+	        "    -C, --control-fd <fd>     Read commands from file descriptor <fd>, one per line:\n"
+	        "                                * snapshot [format]\n"
+	        "    -U, --serve <socket>      Answer queries about the live tree on Unix socket <socket>, and keep\n"
+	        "                              running after the traced processes have exited, until interrupted.\n"
+	        "    -M, --shm <file>          Export running processes to <file>, to be mapped by other processes.\n"
+	        "                              Use a file in /dev/shm to keep it in memory. See src/export.h.\n"
+	        "    -c, --collapse            Collapse runs of identical sibling subtrees into one, with a count.\n"
+	        "    -t, --timing              Include running times in output.\n"
+	        "    -T, --no-threads          Don't show threads, attribute them to their process instead.\n"
+	        "    -F, --files               Trace files opened, renamed and removed, as inputs and outputs of\n"
+	        "                              each process. Started commands only stop for the syscalls that\n"
+	        "                              are traced, and can't gain privileges with setuid programs.\n"
+	        "                              They can't outlive process-tree, and are killed when it exits.\n"
+	        "    -K, --cache-keys          Include a key in JSON output that hashes the arguments and working\n"
+	        "                              directory of each process, the paths of the files it read, and the\n"
+	        "                              keys of its children. Equal keys across runs mean equal work.\n"
+	        "    -E, --cache-env <name>    Also include environment variable <name> in cache keys. May be repeated.\n"
+	        "    -I, --cache-inputs        Also include the contents of the files read in cache keys. Needs -F.\n"
+	        "    -i, --sample-interval <ms>\n"
+	        "                              Sample CPU time and memory of running processes every <ms>\n"
+	        "                              milliseconds, included in json and chrome output.\n"
+	        "    -L, --limits <string>[,<list>[,<node>]]\n"
+	        "                              Keep at most <string> bytes of each argument and variable, <list>\n"
+	        "                              bytes of all arguments or all variables, and <node> bytes of both,\n"
+	        "                              where 0 or a limit left out is unlimited. Longer values keep a\n"
+	        "                              prefix, their length and a hash. All are kept whole by default.\n"
+	        "    -j, --jobs <count>        Trace with <count> threads. New processes are handed over between\n"
+	        "                              threads with SIGSTOP, which their parents may notice.\n"
+	        "    -B, --backend <backend>   Follow processes with <backend>. May be one of:\n"
+	        "                                * ptrace     Stop processes at every event (default).\n"
+	        "                                * connector  Kernel proc connector, doesn't stop processes.\n"
+	        "                                             Needs CAP_NET_ADMIN, and misses chdir and\n"
+	        "                                             arguments of processes that exit right away,\n"
+	        "                                             except the command it starts.\n"
+	        "                                * perf       Scheduler tracepoints read in batches, cheaper\n"
+	        "                                             than connector under heavy forking. Needs\n"
+	        "                                             CAP_PERFMON and tracefs, misses the same.\n"
 	        "    -f, --format <format>     Specify output format. May be one of:\n",
-	        options->program_name);
+	        options->program_name, options->program_name, options->program_name, options->program_name);
 
 	const char **formats = get_output_formats();
 	for (; *formats; ++formats)
@@ -28,18 +86,70 @@ static void usage(struct options *options, FILE *f)
 	}
 }
 
+static void add_cache_env(struct options *options, char *name)
+{
+	options->cache_env = xrealloc(options->cache_env, sizeof(*options->cache_env) * (options->ncache_env + 2));
+	options->cache_env[options->ncache_env++] = name;
+	options->cache_env[options->ncache_env] = NULL;
+}
+
 static void parse_attach_option(struct options *options, char *arg)
 {
 	char *endptr;
+	long pid;
 
 	errno = 0;
-	options->attach = strtol(arg, &endptr, 10);
+	pid = strtol(arg, &endptr, 10);
 
-	if (errno != 0 || options->attach <= 0 || *endptr != 0)
+	if (errno != 0 || pid <= 0 || *endptr != 0)
 	{
 		fprintf(stderr, "%s: Invalid pid: %s\n", options->program_name, arg);
 		exit(EXIT_FAILURE);
 	}
+
+	options->attach = xrealloc(options->attach, sizeof(*options->attach) * (options->nattach + 1));
+	options->attach[options->nattach++] = pid;
+}
+
+/* Split the arguments from i into commands separated by "--" with -m,
+   or else take them as one command. */
+static void parse_commands(struct options *options, int argc, char **argv, int i)
+{
+	if (!options->multiple && i < argc)
+	{
+		options->commands = xmalloc(sizeof(*options->commands));
+		options->commands[options->ncommands++] = &argv[i];
+		return;
+	}
+
+	while (i < argc)
+	{
+		if (strcmp("--", argv[i]) == 0)
+		{
+			fprintf(stderr, "%s: Empty command\n", options->program_name);
+			exit(EXIT_FAILURE);
+		}
+
+		options->commands = xrealloc(options->commands, sizeof(*options->commands) * (options->ncommands + 1));
+		options->commands[options->ncommands++] = &argv[i];
+
+		while (i < argc && strcmp("--", argv[i]) != 0)
+		{
+			i++;
+		}
+
+		if (i < argc)
+		{
+			/* Terminate the command, argv[argc] terminates the last one. */
+			argv[i++] = NULL;
+
+			if (i == argc)
+			{
+				fprintf(stderr, "%s: Empty command\n", options->program_name);
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
 }
 
 static void parse_format_option(struct options *options, char *arg)
@@ -53,13 +163,182 @@ static void parse_format_option(struct options *options, char *arg)
 	}
 }
 
-static void parse_output_option(struct options *options, char *arg)
+static FILE *open_output_file(struct options *options, const char *path)
+{
+	FILE *f;
+
+	if (options->compress)
+	{
+		enum compress_format format = compress_format_of(path);
+
+		if (format == COMPRESS_NONE)
+		{
+			fprintf(stderr, "%s: Unknown compression format of %s, only .gz is supported\n", options->program_name, path);
+			exit(EXIT_FAILURE);
+		}
+
+		f = compress_open(path, format);
+	}
+	else
+	{
+		f = fopen(path, "w");
+	}
+
+	if (f == NULL)
+	{
+		err(EXIT_FAILURE, "Failed to open output file %s", path);
+	}
+
+	return f;
+}
+
+static void open_output(struct options *options)
+{
+	if (options->env_table_path)
+	{
+		if (options->output_fn != get_output_fn("table"))
+		{
+			fprintf(stderr, "%s: An environment table is only written with table output\n", options->program_name);
+			exit(EXIT_FAILURE);
+		}
+
+		options->env_table = open_output_file(options, options->env_table_path);
+	}
+
+	if (options->output_path == NULL)
+	{
+		if (options->compress)
+		{
+			fprintf(stderr, "%s: Only output to a file given with -o can be compressed\n", options->program_name);
+			exit(EXIT_FAILURE);
+		}
+
+		return;
+	}
+
+	options->outfile = open_output_file(options, options->output_path);
+}
+
+static void parse_ring_option(struct options *options, char *arg)
+{
+	char *endptr;
+	long count;
+
+	errno = 0;
+	count = strtol(arg, &endptr, 10);
+
+	if (errno != 0 || count <= 0 || *endptr != 0)
+	{
+		fprintf(stderr, "%s: Invalid ring size: %s\n", options->program_name, arg);
+		exit(EXIT_FAILURE);
+	}
+
+	options->ring = count;
+}
+
+static void parse_sample_interval_option(struct options *options, char *arg)
 {
-	options->outfile = fopen(arg, "w");
-	if (options->outfile == NULL)
+	char *endptr;
+	long ms;
+
+	errno = 0;
+	ms = strtol(arg, &endptr, 10);
+
+	if (errno != 0 || ms <= 0 || *endptr != 0)
 	{
-		err(EXIT_FAILURE, "Failed to open output file %s", arg);
+		fprintf(stderr, "%s: Invalid sample interval: %s\n", options->program_name, arg);
+		exit(EXIT_FAILURE);
 	}
+
+	options->sample_interval = ms * (NS_PER_SEC / 1000);
+}
+
+static void parse_limits_option(struct options *options, char *arg)
+{
+	size_t *limits[] = { &options->limits.string, &options->limits.list, &options->limits.node };
+	char *start = arg;
+	char *endptr;
+
+	for (size_t i = 0; i < sizeof(limits) / sizeof(limits[0]); ++i)
+	{
+		long long bytes;
+
+		errno = 0;
+		bytes = strtoll(arg, &endptr, 10);
+
+		if (errno != 0 || bytes < 0 || endptr == arg || (*endptr != 0 && *endptr != ','))
+		{
+			break;
+		}
+
+		*limits[i] = bytes;
+
+		if (*endptr == 0)
+		{
+			return;
+		}
+
+		arg = endptr + 1;
+	}
+
+	fprintf(stderr, "%s: Invalid limits: %s\n", options->program_name, start);
+	exit(EXIT_FAILURE);
+}
+
+static void parse_jobs_option(struct options *options, char *arg)
+{
+	char *endptr;
+	long count;
+
+	errno = 0;
+	count = strtol(arg, &endptr, 10);
+
+	if (errno != 0 || count <= 0 || count > 1024 || *endptr != 0)
+	{
+		fprintf(stderr, "%s: Invalid number of jobs: %s\n", options->program_name, arg);
+		exit(EXIT_FAILURE);
+	}
+
+	options->jobs = count;
+}
+
+static const char *backends[] = {
+	[BACKEND_PTRACE] = "ptrace",
+	[BACKEND_CONNECTOR] = "connector",
+	[BACKEND_PERF] = "perf",
+	NULL,
+};
+
+static void parse_backend_option(struct options *options, char *arg)
+{
+	for (size_t i = 0; backends[i]; ++i)
+	{
+		if (strcasecmp(backends[i], arg) == 0)
+		{
+			options->backend = i;
+			return;
+		}
+	}
+
+	fprintf(stderr, "%s: Invalid backend: %s\n", options->program_name, arg);
+	exit(EXIT_FAILURE);
+}
+
+static void parse_control_fd_option(struct options *options, char *arg)
+{
+	char *endptr;
+	long fd;
+
+	errno = 0;
+	fd = strtol(arg, &endptr, 10);
+
+	if (errno != 0 || fd < 0 || fd > INT_MAX || *endptr != 0)
+	{
+		fprintf(stderr, "%s: Invalid file descriptor: %s\n", options->program_name, arg);
+		exit(EXIT_FAILURE);
+	}
+
+	options->control_fd = fd;
 }
 
 static void parse_exclude_option(struct options *options, char *arg)
@@ -83,21 +362,39 @@ static void require_argument(struct options *options, char **argv, int *i)
 	(*i)++;
 }
 
-void options_parse_cmdline(struct options *options, int argc, char **argv)
+void options_init(struct options *options, const char *program_name)
 {
 	memset(options, 0, sizeof(*options));
 
-	options->program_name = strrchr(argv[0], '/');
-	if (options->program_name) {
-		options->program_name++;
-	} else {
-		options->program_name = argv[0];
-	}
-
+	options->program_name = program_name;
 	options->output_fn = default_output_fn;
 	options->outfile = stdout;
+	options->snapshot_dir = ".";
+	options->control_fd = -1;
+	options->jobs = 1;
+}
+
+void options_parse_cmdline(struct options *options, int argc, char **argv)
+{
+	const char *program_name = strrchr(argv[0], '/');
+
+	options_init(options, program_name ? program_name + 1 : argv[0]);
 
-	for (int i = 1; i < argc; ++i)
+	int i = 1;
+
+	if (argc > 2 && strcmp("render", argv[1]) == 0)
+	{
+		options->render = argv[2];
+		i = 3;
+	}
+	else if (argc > 3 && strcmp("diff", argv[1]) == 0)
+	{
+		options->diff_old = argv[2];
+		options->diff_new = argv[3];
+		i = 4;
+	}
+
+	for (; i < argc; ++i)
 	{
 		if (strcmp("-a", argv[i]) == 0 || strcmp("--attach", argv[i]) == 0)
 		{
@@ -144,31 +441,211 @@ void options_parse_cmdline(struct options *options, int argc, char **argv)
 			continue;
 		}
 
+		if (strcmp("-k", argv[i]) == 0 || strcmp("--ring", argv[i]) == 0)
+		{
+			require_argument(options, argv, &i);
+			parse_ring_option(options, argv[i]);
+			continue;
+		}
+
+		if (strcmp("-S", argv[i]) == 0 || strcmp("--snapshot-dir", argv[i]) == 0)
+		{
+			require_argument(options, argv, &i);
+			options->snapshot_dir = argv[i];
+			continue;
+		}
+
+		if (strcmp("-C", argv[i]) == 0 || strcmp("--control-fd", argv[i]) == 0)
+		{
+			require_argument(options, argv, &i);
+			parse_control_fd_option(options, argv[i]);
+			continue;
+		}
+
+		if (strcmp("-U", argv[i]) == 0 || strcmp("--serve", argv[i]) == 0)
+		{
+			require_argument(options, argv, &i);
+			options->serve = argv[i];
+			continue;
+		}
+
+		if (strcmp("-M", argv[i]) == 0 || strcmp("--shm", argv[i]) == 0)
+		{
+			require_argument(options, argv, &i);
+			options->shm = argv[i];
+			continue;
+		}
+
+		if (strcmp("-c", argv[i]) == 0 || strcmp("--collapse", argv[i]) == 0)
+		{
+			options->collapse = true;
+			continue;
+		}
+
+		if (strcmp("-t", argv[i]) == 0 || strcmp("--timing", argv[i]) == 0)
+		{
+			options->timing = true;
+			continue;
+		}
+
+		if (strcmp("-m", argv[i]) == 0 || strcmp("--multiple", argv[i]) == 0)
+		{
+			options->multiple = true;
+			continue;
+		}
+
+		if (strcmp("-T", argv[i]) == 0 || strcmp("--no-threads", argv[i]) == 0)
+		{
+			options->no_threads = true;
+			continue;
+		}
+
+		if (strcmp("-F", argv[i]) == 0 || strcmp("--files", argv[i]) == 0)
+		{
+			options->files = true;
+			continue;
+		}
+
+		if (strcmp("-K", argv[i]) == 0 || strcmp("--cache-keys", argv[i]) == 0)
+		{
+			options->cache_keys = true;
+			continue;
+		}
+
+		if (strcmp("-E", argv[i]) == 0 || strcmp("--cache-env", argv[i]) == 0)
+		{
+			require_argument(options, argv, &i);
+			add_cache_env(options, argv[i]);
+			options->cache_keys = true;
+			continue;
+		}
+
+		if (strcmp("-i", argv[i]) == 0 || strcmp("--sample-interval", argv[i]) == 0)
+		{
+			require_argument(options, argv, &i);
+			parse_sample_interval_option(options, argv[i]);
+			continue;
+		}
+
+		if (strcmp("-L", argv[i]) == 0 || strcmp("--limits", argv[i]) == 0)
+		{
+			require_argument(options, argv, &i);
+			parse_limits_option(options, argv[i]);
+			continue;
+		}
+
+		if (strcmp("-I", argv[i]) == 0 || strcmp("--cache-inputs", argv[i]) == 0)
+		{
+			options->cache_inputs = true;
+			options->cache_keys = true;
+			continue;
+		}
+
+		if (strcmp("-j", argv[i]) == 0 || strcmp("--jobs", argv[i]) == 0)
+		{
+			require_argument(options, argv, &i);
+			parse_jobs_option(options, argv[i]);
+			continue;
+		}
+
+		if (strcmp("-B", argv[i]) == 0 || strcmp("--backend", argv[i]) == 0)
+		{
+			require_argument(options, argv, &i);
+			parse_backend_option(options, argv[i]);
+			continue;
+		}
+
 		if (strcmp("-o", argv[i]) == 0 || strcmp("--output", argv[i]) == 0)
 		{
 			require_argument(options, argv, &i);
-			parse_output_option(options, argv[i]);
+			options->output_path = argv[i];
+			continue;
+		}
+
+		if (strcmp("-N", argv[i]) == 0 || strcmp("--env-table", argv[i]) == 0)
+		{
+			require_argument(options, argv, &i);
+			options->env_table_path = argv[i];
+			continue;
+		}
+
+		if (strcmp("-z", argv[i]) == 0 || strcmp("--compress", argv[i]) == 0)
+		{
+			options->compress = true;
+			continue;
+		}
+
+		if (strcmp("-R", argv[i]) == 0 || strcmp("--record", argv[i]) == 0)
+		{
+			require_argument(options, argv, &i);
+			options->record = argv[i];
 			continue;
 		}
 
-		if (argv[i][0] == '-')
+		if (strcmp("--", argv[i]) == 0)
+		{
+			i++;
+		}
+		else if (argv[i][0] == '-')
 		{
 			fprintf(stderr, "%s: Invalid option: %s\n", options->program_name, argv[i]);
 			exit(EXIT_FAILURE);
 		}
 
-		options->command = &argv[i];
+		if (i < argc && (options->render || options->diff_old))
+		{
+			fprintf(stderr, "%s: Unexpected argument: %s\n", options->program_name, argv[i]);
+			exit(EXIT_FAILURE);
+		}
+
+		parse_commands(options, argc, argv, i);
 		break;
 	}
 
-	if (options->attach && options->command)
+	open_output(options);
+
+	if (options->render || options->diff_old)
+	{
+		if (options->nattach || options->record || options->serve || options->shm)
+		{
+			fprintf(stderr, "%s: render and diff don't trace, -a, -R, -U and -M can't be used\n", options->program_name);
+			exit(EXIT_FAILURE);
+		}
+
+		return;
+	}
+
+	if (options->ring && options->record)
 	{
-		usage(options, stderr);
-		fprintf(stderr, "%s: Both command and external pid provided\n", options->program_name);
+		fprintf(stderr, "%s: A ring can't be used when recording\n", options->program_name);
+		exit(EXIT_FAILURE);
+	}
+
+	if (options->backend != BACKEND_PTRACE && options->jobs > 1)
+	{
+		fprintf(stderr, "%s: Only the ptrace backend can use several jobs\n", options->program_name);
+		exit(EXIT_FAILURE);
+	}
+
+	if (options->backend != BACKEND_PTRACE && options->files)
+	{
+		fprintf(stderr, "%s: Only the ptrace backend can trace files\n", options->program_name);
+		exit(EXIT_FAILURE);
+	}
+
+	if (options->cache_inputs && !options->files)
+	{
+		fprintf(stderr, "%s: The contents of files can only be hashed when tracing files with -F\n", options->program_name);
+		exit(EXIT_FAILURE);
+	}
+
+	if (options->serve && options->record)
+	{
+		fprintf(stderr, "%s: Queries can't be served when recording\n", options->program_name);
 		exit(EXIT_FAILURE);
 	}
 
-	if (!options->attach && !options->command)
+	if (!options->nattach && !options->ncommands)
 	{
 		usage(options, stderr);
 		fprintf(stderr, "%s: Neither command nor external pid provided\n", options->program_name);
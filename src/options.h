@@ -4,6 +4,7 @@
 #include <regex.h>
 
 #include "output.h"
+#include "strcap.h"
 
 /*
  * Result of parsing command line arguments.
@@ -13,11 +14,26 @@ struct options {
 	/* The name of this program as invoked on the command line. */
 	const char *program_name;
 
-	/* Non-zero if the user provided a pid for an external process. */
-	long attach;
+	/* Pids of external processes to attach to. */
+	long *attach;
+	size_t nattach;
 
-	/* Non-NULL, NULL terminated list of strings if the user provided a command. */
-	char **command;
+	/* Commands to trace, each a NULL terminated list of strings. */
+	char ***commands;
+	size_t ncommands;
+
+	/* Commands are separated by "--", rather than "--" being an argument. */
+	bool multiple;
+
+	/* Path of a capture file to write events to instead of producing output. */
+	const char *record;
+
+	/* Path of a capture file to render, for the render subcommand. */
+	const char *render;
+
+	/* Paths of the old and new capture files, for the diff subcommand. */
+	const char *diff_old;
+	const char *diff_new;
 
 	/* The function used for output formatting. */
 	output_fn_t output_fn;
@@ -25,6 +41,16 @@ struct options {
 	/* File pointer for output */
 	FILE *outfile;
 
+	/* Path of the output file, or NULL for stdout. */
+	const char *output_path;
+
+	/* Compress output, in the format named by the extension of the output file. */
+	bool compress;
+
+	/* File the environment table of table output is written to, and its path, or NULL. */
+	FILE *env_table;
+	const char *env_table_path;
+
 	/* Regular expression for excluding branches in the process tree. */
 	regex_t exclude;
 
@@ -39,8 +65,72 @@ struct options {
 
 	/* Exclude environment from output. */
 	bool exclude_environ;
+
+	/* Number of exited tracees to keep, or zero to keep all. */
+	size_t ring;
+
+	/* Directory to write snapshots to. */
+	const char *snapshot_dir;
+
+	/* File descriptor to read commands from, or -1. */
+	int control_fd;
+
+	/* Path of a Unix socket to answer queries on, or NULL. */
+	const char *serve;
+
+	/* Path of a file to export running tracees to, or NULL. */
+	const char *shm;
+
+	/* Collapse runs of identical sibling subtrees in output. */
+	bool collapse;
+
+	/* Include running times in output. */
+	bool timing;
+
+	/* Number of threads tracing, each one tracing a share of the processes. */
+	size_t jobs;
+
+	/* How processes are followed. */
+	enum backend
+	{
+		/* Stop processes at every event with ptrace. */
+		BACKEND_PTRACE,
+
+		/* Receive events from the kernel proc connector, see connector.h. */
+		BACKEND_CONNECTOR,
+
+		/* Record scheduler tracepoints with perf_event_open(), see perf.h. */
+		BACKEND_PERF,
+	} backend;
+
+	/* Fold threads into their thread group leader instead of tracking them as tracees. */
+	bool no_threads;
+
+	/* Trace the files that are opened, renamed and removed, as inputs and outputs. */
+	bool files;
+
+	/* Compute cache keys of subtrees and include them in JSON output, see cachekey.h. */
+	bool cache_keys;
+
+	/* Environment variables included in cache keys, NULL terminated. */
+	char **cache_env;
+	size_t ncache_env;
+
+	/* Include the contents of the files read in cache keys, not only their paths. */
+	bool cache_inputs;
+
+	/* Interval at which CPU time and memory of running processes are sampled, or zero. */
+	timestamp_t sample_interval;
+
+	/* Bytes kept of the arguments and environment of each exec, see strcap.h. */
+	struct strcap_limits limits;
 };
 
+/*
+ * Set all options to their defaults, without any commands or pids.
+ */
+void options_init(struct options *options, const char *program_name);
+
 /*
  * Parse command line arguments.
  */
@@ -0,0 +1,106 @@
+#include <string.h>
+#include <stdio.h>
+
+#include "tracee.h"
+#include "output.h"
+#include "options.h"
+
+/*
+ * Trace Event Format, as read by chrome://tracing, Perfetto and Speedscope.
+ * Every process is a complete event on its own track, threads on tracks of
+ * their process, and samples are counters of the process.
+ */
+
+static double to_us(timestamp_t time)
+{
+	return (double) time / (NS_PER_SEC / 1000000);
+}
+
+/* Latest time seen in the subtree, which ends the spans of running tracees. */
+static timestamp_t last_time(struct tracee *tracee)
+{
+	timestamp_t last = tracee->end_time > tracee->start_time ? tracee->end_time : tracee->start_time;
+
+	if (tracee->nsamples > 0 && tracee->samples[tracee->nsamples - 1].time > last)
+	{
+		last = tracee->samples[tracee->nsamples - 1].time;
+	}
+
+	for (size_t i = 0; i < tracee->nchildren; ++i)
+	{
+		timestamp_t child = last_time(tracee->children[i]);
+
+		if (child > last)
+		{
+			last = child;
+		}
+	}
+
+	return last;
+}
+
+static void output_name(FILE *f, struct tracee *tracee)
+{
+	if (tracee->argv && tracee->argv[0])
+	{
+		output_json_escaped(f, tracee->argv[0], strlen(tracee->argv[0]));
+	}
+	else
+	{
+		fprintf(f, "%ld", tracee->tid);
+	}
+}
+
+static void output_fn_chrome_rec(FILE *f, struct tracee *tracee, struct options *options,
+                                 long pid, timestamp_t epoch, timestamp_t last)
+{
+	timestamp_t end = tracee->end_time != 0 ? tracee->end_time : last;
+
+	if (output_exclude(tracee, options))
+	{
+		return;
+	}
+
+	if (!tracee->is_a_thread)
+	{
+		pid = tracee->tid;
+
+		fprintf(f, ",\n{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%ld,\"args\":{\"name\":\"", pid);
+		output_name(f, tracee);
+		fprintf(f, "\"}}");
+	}
+
+	fprintf(f, ",\n{\"ph\":\"X\",\"name\":\"");
+	output_name(f, tracee);
+	fprintf(f, "\",\"pid\":%ld,\"tid\":%ld,\"ts\":%.3f,\"dur\":%.3f}", pid, tracee->tid,
+	        to_us(tracee->start_time - epoch), to_us(end - tracee->start_time));
+
+	for (size_t i = 0; i < tracee->nsamples; ++i)
+	{
+		struct tracee_sample *sample = &tracee->samples[i];
+		double ts = to_us(sample->time - epoch);
+
+		fprintf(f, ",\n{\"ph\":\"C\",\"name\":\"cpu_us\",\"pid\":%ld,\"ts\":%.3f,\"args\":{\"cpu_us\":%u}}",
+		        pid, ts, sample->cpu_us);
+		fprintf(f, ",\n{\"ph\":\"C\",\"name\":\"rss_kb\",\"pid\":%ld,\"ts\":%.3f,\"args\":{\"rss_kb\":%u}}",
+		        pid, ts, sample->rss_kb);
+	}
+
+	for (size_t i = 0; i < tracee->nchildren; ++i)
+	{
+		output_fn_chrome_rec(f, tracee->children[i], options, pid, epoch, last);
+	}
+}
+
+void output_fn_chrome(FILE *f, struct tracee *tracee, struct options *options)
+{
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+	/* Metadata first, so that every following event starts with a comma. */
+	fprintf(f, "\n{\"ph\":\"M\",\"name\":\"process_sort_index\",\"pid\":%ld,\"args\":{\"sort_index\":0}}",
+	        tracee->tid);
+
+	output_fn_chrome_rec(f, tracee, options, tracee->tid, tracee->start_time, last_time(tracee));
+
+	fprintf(f, "\n]}\n");
+}
@@ -4,8 +4,11 @@
 #include "tracee.h"
 #include "output.h"
 #include "options.h"
+#include "collapse.h"
+#include "cachekey.h"
+#include "parallel.h"
 
-static void fputs_escaped(FILE *f, const char *str, int len)
+void output_json_escaped(FILE *f, const char *str, int len)
 {
 	for (int i = 0; i < len; ++i)
 	{
@@ -34,19 +37,84 @@ static void fputs_escaped(FILE *f, const char *str, int len)
 	}
 }
 
-void output_fn_json(FILE *f, struct tracee *tracee, struct options *options)
+static void output_paths(FILE *f, const char *key, struct pathset *set)
+{
+	if (set->count == 0)
+	{
+		return;
+	}
+
+	fprintf(f, ",\"%s\":[", key);
+
+	for (size_t i = 0; i < set->count; ++i)
+	{
+		fprintf(f, "%s\"", i > 0 ? "," : "");
+		output_json_escaped(f, set->paths[i], strlen(set->paths[i]));
+		fprintf(f, "\"");
+	}
+
+	fprintf(f, "]");
+}
+
+/* What a tracee is formatted with, given by its parent. */
+struct json_state
+{
+	size_t count;
+	timestamp_t duration;
+	timestamp_t epoch;
+};
+
+static void output_fn_json_rec(FILE *f, struct tracee *tracee, struct options *options,
+                               struct parallel *parallel, size_t count, timestamp_t duration,
+                               timestamp_t epoch)
 {
 	char **ptr;
 	bool first;
+	size_t childcount, next;
 
 	fprintf(f, "{");
 
 	fprintf(f, "\"tid\":%ld", tracee->tid);
 
+	if (tracee->generation > 0)
+	{
+		fprintf(f, ",\"generation\":%lu", tracee->generation);
+	}
+
+	if (count > 1)
+	{
+		fprintf(f, ",\"count\":%zu", count);
+	}
+
+	if (options->timing)
+	{
+		fprintf(f, ",\"start\":%.6f", timestamp_to_seconds(tracee->start_time - epoch));
+
+		if (count > 1 || tracee->end_time != 0)
+		{
+			fprintf(f, ",\"duration\":%.6f", timestamp_to_seconds(duration));
+		}
+	}
+
+	if (output_exit_code(tracee) >= 0)
+	{
+		fprintf(f, ",\"exit_code\":%d", output_exit_code(tracee));
+	}
+
+	if (tracee->failed_execs)
+	{
+		fprintf(f, ",\"failed_execs\":%lu", tracee->failed_execs);
+	}
+
+	if (options->timing && tracee->exec_time)
+	{
+		fprintf(f, ",\"exec_time\":%.6f", timestamp_to_seconds(tracee->exec_time));
+	}
+
 	if (tracee->cwd)
 	{
 		fprintf(f, ",\"directory\":\"");
-		fputs_escaped(f, tracee->cwd, strlen(tracee->cwd));
+		output_json_escaped(f, tracee->cwd, strlen(tracee->cwd));
 		fprintf(f, "\"");
 	}
 
@@ -61,7 +129,7 @@ void output_fn_json(FILE *f, struct tracee *tracee, struct options *options)
 			first = false;
 
 			fprintf(f, "%s\"", comma);
-			fputs_escaped(f, *ptr, strlen(*ptr));
+			output_json_escaped(f, *ptr, strlen(*ptr));
 			fprintf(f, "\"");
 		}
 
@@ -75,40 +143,62 @@ void output_fn_json(FILE *f, struct tracee *tracee, struct options *options)
 		first = true;
 		for (ptr = tracee->envp; *ptr; ++ptr)
 		{
-			const char *eq = strchr(*ptr, '=');
+			const char *key = *ptr;
+			const char *value;
+			size_t keylen;
 
-			if (eq == NULL)
+			if (!strcap_split_variable(key, &keylen, &value))
 			{
 				continue;
 			}
 
-			const char *key = *ptr;
-			int keylen = eq-key;
-			const char *value = eq+1;
-
 			const char *comma = first ? "" : ",";
 			first = false;
 
 
 			fprintf(f, "%s\"", comma);
-			fputs_escaped(f, key, keylen);
+			output_json_escaped(f, key, keylen);
 			fprintf(f, "\":\"");
-			fputs_escaped(f, value, strlen(value));
+			output_json_escaped(f, value, strlen(value));
 			fprintf(f, "\"");
 		}
 
 		fprintf(f, "}");
 	}
 
-	if (tracee->children)
+	output_paths(f, "inputs", &tracee->inputs);
+	output_paths(f, "outputs", &tracee->outputs);
+
+	if (tracee->nsamples > 0)
+	{
+		fprintf(f, ",\"samples\":[");
+
+		for (size_t i = 0; i < tracee->nsamples; ++i)
+		{
+			struct tracee_sample *sample = &tracee->samples[i];
+
+			fprintf(f, "%s[%.6f,%u,%u]", i > 0 ? "," : "",
+			        timestamp_to_seconds(sample->time - epoch), sample->cpu_us, sample->rss_kb);
+		}
+
+		fprintf(f, "]");
+	}
+
+	if (options->cache_keys)
+	{
+		fprintf(f, ",\"cache_key\":\"%016llx\"", tracee->cache_key);
+	}
+
+	if (tracee->nchildren > 0)
 	{
 		fprintf(f, ",\"children\":[");
 
 		first = true;
-		for (int i = 0; i < tracee->nchildren; ++i)
+		for (size_t i = 0; i < tracee->nchildren; i = next)
 		{
 			if (output_exclude(tracee->children[i], options))
 			{
+				next = i + 1;
 				continue;
 			}
 
@@ -119,7 +209,17 @@ void output_fn_json(FILE *f, struct tracee *tracee, struct options *options)
 
 			first = false;
 
-			output_fn_json(f, tracee->children[i], options);
+			next = collapse_run(tracee, i, options, &childcount);
+
+			struct json_state state = {
+				childcount, output_run_duration(tracee, i, next, options), epoch,
+			};
+
+			if (!parallel_unit(parallel, f, tracee->children[i], &state, sizeof(state)))
+			{
+				output_fn_json_rec(f, tracee->children[i], options, parallel,
+				                   state.count, state.duration, state.epoch);
+			}
 		}
 
 		fprintf(f, "]");
@@ -127,3 +227,23 @@ void output_fn_json(FILE *f, struct tracee *tracee, struct options *options)
 
 	fprintf(f, "}");
 }
+
+static void output_fn_json_unit(FILE *f, struct tracee *tracee, struct options *options,
+                                struct parallel *parallel, const void *data, size_t size)
+{
+	const struct json_state *state = data;
+
+	output_fn_json_rec(f, tracee, options, parallel, state->count, state->duration, state->epoch);
+}
+
+void output_fn_json(FILE *f, struct tracee *tracee, struct options *options)
+{
+	if (options->cache_keys)
+	{
+		cachekey_update(tracee);
+	}
+
+	struct json_state state = { 1, output_duration(tracee), tracee->start_time };
+
+	parallel_output(f, tracee, options, output_fn_json_unit, &state, sizeof(state));
+}
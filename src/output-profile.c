@@ -0,0 +1,500 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "tracee.h"
+#include "output.h"
+#include "options.h"
+#include "xmalloc.h"
+
+/*
+ * Number of processes running at once over time, for finding where a
+ * build runs serially. A process waiting for its children is not counted
+ * as running, so that make, shells and compiler drivers don't hide the
+ * jobs they start, and threads are counted as their process. Written as a
+ * histogram of the time spent at each count, a chart of the count over
+ * time, and the intervals where only one process runs.
+ */
+
+/* Columns of the chart, and rows at most. */
+#define CHART_WIDTH 64
+#define CHART_HEIGHT 16
+
+/* Columns of the longest bar of the histogram. */
+#define BAR_WIDTH 40
+
+/* Intervals with one process running are listed on their own from
+   this part of the whole time. */
+#define SERIAL_MIN_SHARE 0.01
+
+/* Bytes of process names. */
+#define NAME_WIDTH 60
+
+#define NO_PARENT SIZE_MAX
+
+/* A process, numbered in depth first order. */
+struct process
+{
+	struct tracee *tracee;
+
+	/* Number of the parent process, or NO_PARENT. */
+	size_t parent;
+
+	timestamp_t start;
+	timestamp_t end;
+
+	bool running;
+	size_t running_children;
+};
+
+/* A process starting or ending. */
+struct change
+{
+	timestamp_t time;
+	size_t process;
+	bool start;
+};
+
+/* An interval with one process running, and the process that ran longest in it. */
+struct serial
+{
+	timestamp_t start;
+	timestamp_t end;
+
+	size_t process;
+	timestamp_t longest;
+};
+
+struct profile
+{
+	struct options *options;
+
+	struct process *processes;
+	size_t nprocesses;
+	size_t capacity;
+
+	/* Processes that run and have no running children, and the sum of
+	   their numbers, which is the number of the one running when there is one. */
+	size_t running;
+	size_t running_sum;
+
+	/* Time spent at each count. */
+	timestamp_t *levels;
+	size_t nlevels;
+
+	/* Span of the chart, and the integral of the count over each column. */
+	timestamp_t first;
+	timestamp_t last;
+	double columns[CHART_WIDTH];
+
+	/* Intervals with one process running, the last one possibly unfinished. */
+	struct serial *serials;
+	size_t nserials;
+	size_t serials_capacity;
+};
+
+/* Latest time seen in the subtree, which ends the spans of running tracees. */
+static timestamp_t last_time(struct tracee *tracee)
+{
+	timestamp_t last = tracee->end_time > tracee->start_time ? tracee->end_time : tracee->start_time;
+
+	for (size_t i = 0; i < tracee->nchildren; ++i)
+	{
+		timestamp_t child = last_time(tracee->children[i]);
+
+		if (child > last)
+		{
+			last = child;
+		}
+	}
+
+	return last;
+}
+
+/* Add the processes of the subtree of tracee, whose parent process is parent. */
+static void add_processes(struct profile *profile, struct tracee *tracee, size_t parent)
+{
+	struct process *process;
+
+	if (output_exclude(tracee, profile->options))
+	{
+		return;
+	}
+
+	/* The session tracee, see struct tree, and threads are not processes. */
+	if (tracee->tid != 0 && !tracee->is_a_thread)
+	{
+		if (profile->nprocesses == profile->capacity)
+		{
+			profile->capacity = profile->capacity ? profile->capacity * 2 : 64;
+			profile->processes = xrealloc(profile->processes,
+			                              profile->capacity * sizeof(*profile->processes));
+		}
+
+		process = &profile->processes[profile->nprocesses];
+		process->tracee = tracee;
+		process->parent = parent;
+		process->start = tracee->start_time;
+		process->end = tracee->end_time ? tracee->end_time : profile->last;
+		process->running = false;
+		process->running_children = 0;
+
+		parent = profile->nprocesses++;
+	}
+
+	for (size_t i = 0; i < tracee->nchildren; ++i)
+	{
+		add_processes(profile, tracee->children[i], parent);
+	}
+}
+
+static int compare_changes(const void *a, const void *b)
+{
+	const struct change *x = a, *y = b;
+
+	if (x->time != y->time)
+	{
+		return x->time < y->time ? -1 : 1;
+	}
+
+	/* A process starts before it ends, also when it does so at once. */
+	if (x->start != y->start)
+	{
+		return x->start ? -1 : 1;
+	}
+
+	return (x->process > y->process) - (x->process < y->process);
+}
+
+static void set_running(struct profile *profile, size_t i, bool running)
+{
+	if (running)
+	{
+		profile->running += 1;
+		profile->running_sum += i;
+	}
+	else
+	{
+		profile->running -= 1;
+		profile->running_sum -= i;
+	}
+}
+
+static void apply_change(struct profile *profile, struct change *change)
+{
+	struct process *process = &profile->processes[change->process];
+	struct process *parent = process->parent == NO_PARENT ? NULL : &profile->processes[process->parent];
+
+	process->running = change->start;
+
+	if (process->running_children == 0)
+	{
+		set_running(profile, change->process, change->start);
+	}
+
+	if (parent == NULL)
+	{
+		return;
+	}
+
+	/* The parent waits while it has children running. */
+	if (change->start && parent->running_children++ == 0 && parent->running)
+	{
+		set_running(profile, process->parent, false);
+	}
+	else if (!change->start && --parent->running_children == 0 && parent->running)
+	{
+		set_running(profile, process->parent, true);
+	}
+}
+
+/* Account for the time from start to end, with the current count. */
+static void add_segment(struct profile *profile, timestamp_t start, timestamp_t end)
+{
+	timestamp_t span = profile->last - profile->first;
+	struct serial *serial;
+
+	if (end == start)
+	{
+		return;
+	}
+
+	if (profile->running >= profile->nlevels)
+	{
+		size_t nlevels = profile->running + 1;
+
+		profile->levels = xrealloc(profile->levels, nlevels * sizeof(*profile->levels));
+		memset(profile->levels + profile->nlevels, 0, (nlevels - profile->nlevels) * sizeof(*profile->levels));
+		profile->nlevels = nlevels;
+	}
+
+	profile->levels[profile->running] += end - start;
+
+	/* The columns the segment overlaps. */
+	for (size_t column = (start - profile->first) * CHART_WIDTH / span; column < CHART_WIDTH; ++column)
+	{
+		timestamp_t column_start = profile->first + span * column / CHART_WIDTH;
+		timestamp_t column_end = profile->first + span * (column + 1) / CHART_WIDTH;
+		timestamp_t from = start > column_start ? start : column_start;
+		timestamp_t to = end < column_end ? end : column_end;
+
+		if (from >= end)
+		{
+			break;
+		}
+
+		if (to > from)
+		{
+			profile->columns[column] += (double) (to - from) * profile->running;
+		}
+	}
+
+	if (profile->running != 1)
+	{
+		return;
+	}
+
+	serial = profile->nserials > 0 ? &profile->serials[profile->nserials - 1] : NULL;
+
+	if (serial == NULL || serial->end != start)
+	{
+		if (profile->nserials == profile->serials_capacity)
+		{
+			profile->serials_capacity = profile->serials_capacity ? profile->serials_capacity * 2 : 16;
+			profile->serials = xrealloc(profile->serials,
+			                            profile->serials_capacity * sizeof(*profile->serials));
+		}
+
+		serial = &profile->serials[profile->nserials++];
+		serial->start = start;
+		serial->longest = 0;
+	}
+
+	serial->end = end;
+
+	if (end - start > serial->longest)
+	{
+		serial->longest = end - start;
+		serial->process = profile->running_sum;
+	}
+}
+
+static void sweep(struct profile *profile)
+{
+	struct change *changes = xmalloc(2 * profile->nprocesses * sizeof(*changes));
+	size_t nchanges = 0;
+
+	for (size_t i = 0; i < profile->nprocesses; ++i)
+	{
+		changes[nchanges++] = (struct change) { profile->processes[i].start, i, true };
+		changes[nchanges++] = (struct change) { profile->processes[i].end, i, false };
+	}
+
+	qsort(changes, nchanges, sizeof(*changes), compare_changes);
+
+	/* All changes at the same time are applied before the count is taken. */
+	for (size_t i = 0; i < nchanges; )
+	{
+		timestamp_t time = changes[i].time;
+
+		for (; i < nchanges && changes[i].time == time; ++i)
+		{
+			apply_change(profile, &changes[i]);
+		}
+
+		if (i < nchanges)
+		{
+			add_segment(profile, time, changes[i].time);
+		}
+	}
+
+	xfree(changes);
+}
+
+static void output_name(FILE *f, struct tracee *tracee)
+{
+	char name[NAME_WIDTH + 1] = "";
+	size_t len = 0;
+
+	if (tracee->argv == NULL)
+	{
+		fprintf(f, "%ld", tracee->tid);
+		return;
+	}
+
+	for (char **arg = tracee->argv; *arg && len < NAME_WIDTH; ++arg)
+	{
+		len += snprintf(name + len, sizeof(name) - len, "%s%s", arg == tracee->argv ? "" : " ", *arg);
+	}
+
+	if (len > NAME_WIDTH)
+	{
+		strcpy(name + NAME_WIDTH - 3, "...");
+	}
+
+	fprintf(f, "%s", name);
+}
+
+static void output_histogram(FILE *f, struct profile *profile)
+{
+	timestamp_t span = profile->last - profile->first;
+	timestamp_t most = 0;
+	double average = 0;
+
+	for (size_t i = 0; i < profile->nlevels; ++i)
+	{
+		most = profile->levels[i] > most ? profile->levels[i] : most;
+		average += (double) profile->levels[i] * i / span;
+	}
+
+	fprintf(f, "Processes running at once, over %.3fs:\n\n", timestamp_to_seconds(span));
+	fprintf(f, "Running         Time   Share\n");
+
+	for (size_t i = 0; i < profile->nlevels; ++i)
+	{
+		if (profile->levels[i] == 0)
+		{
+			continue;
+		}
+
+		fprintf(f, "%7zu %11.3fs %6.1f%% ", i, timestamp_to_seconds(profile->levels[i]),
+		        100.0 * profile->levels[i] / span);
+
+		/* Every count with time has a bar. */
+		for (size_t j = 0; j < (profile->levels[i] * BAR_WIDTH + most - 1) / most; ++j)
+		{
+			fputc('#', f);
+		}
+
+		fputc('\n', f);
+	}
+
+	fprintf(f, "\nAverage %.2f, peak %zu.\n", average, profile->nlevels - 1);
+}
+
+static void output_chart(FILE *f, struct profile *profile)
+{
+	timestamp_t span = profile->last - profile->first;
+	size_t peak = profile->nlevels - 1;
+	size_t rows = peak < CHART_HEIGHT ? peak : CHART_HEIGHT;
+
+	fprintf(f, "\nRunning over time, in columns of %.3fs:\n\n",
+	        timestamp_to_seconds(span) / CHART_WIDTH);
+
+	for (size_t row = rows; row > 0; --row)
+	{
+		/* The lowest count drawn in the row. */
+		double level = (double) peak * row / rows;
+
+		fprintf(f, "%7.0f |", level);
+
+		for (size_t column = 0; column < CHART_WIDTH; ++column)
+		{
+			double width = (double) span / CHART_WIDTH;
+
+			fputc(profile->columns[column] / width + 0.5 >= level ? '#' : ' ', f);
+		}
+
+		fputc('\n', f);
+	}
+
+	fprintf(f, "        +");
+
+	for (size_t column = 0; column < CHART_WIDTH; ++column)
+	{
+		fputc('-', f);
+	}
+
+	fprintf(f, "\n        0s%*.3fs\n", CHART_WIDTH - 3, timestamp_to_seconds(span));
+}
+
+static void output_serials(FILE *f, struct profile *profile)
+{
+	timestamp_t span = profile->last - profile->first;
+	timestamp_t total = profile->nlevels > 1 ? profile->levels[1] : 0;
+	timestamp_t short_total = 0;
+	size_t nshort = 0;
+
+	fprintf(f, "\nOne process running for %.3fs (%.1f%%), in %zu intervals",
+	        timestamp_to_seconds(total), 100.0 * total / span, profile->nserials);
+
+	if (profile->nserials == 0)
+	{
+		fprintf(f, ".\n");
+		return;
+	}
+
+	fprintf(f, ":\n\n");
+	fprintf(f, "      Start         End    Duration  Process\n");
+
+	for (size_t i = 0; i < profile->nserials; ++i)
+	{
+		struct serial *serial = &profile->serials[i];
+		timestamp_t duration = serial->end - serial->start;
+
+		if (duration < span * SERIAL_MIN_SHARE)
+		{
+			short_total += duration;
+			++nshort;
+			continue;
+		}
+
+		fprintf(f, "%10.3fs %10.3fs %10.3fs  ", timestamp_to_seconds(serial->start - profile->first),
+		        timestamp_to_seconds(serial->end - profile->first), timestamp_to_seconds(duration));
+		output_name(f, profile->processes[serial->process].tracee);
+		fputc('\n', f);
+	}
+
+	if (nshort > 0)
+	{
+		fprintf(f, "and %zu shorter intervals, %.3fs in total.\n", nshort, timestamp_to_seconds(short_total));
+	}
+}
+
+void output_fn_profile(FILE *f, struct tracee *tracee, struct options *options)
+{
+	struct profile profile = { .options = options };
+
+	profile.last = last_time(tracee);
+	add_processes(&profile, tracee, NO_PARENT);
+
+	if (profile.nprocesses == 0)
+	{
+		fprintf(f, "No processes.\n");
+		return;
+	}
+
+	/* The span of the processes that are not excluded. */
+	profile.first = profile.processes[0].start;
+	profile.last = profile.processes[0].end;
+
+	for (size_t i = 1; i < profile.nprocesses; ++i)
+	{
+		if (profile.processes[i].start < profile.first)
+		{
+			profile.first = profile.processes[i].start;
+		}
+
+		if (profile.processes[i].end > profile.last)
+		{
+			profile.last = profile.processes[i].end;
+		}
+	}
+
+	if (profile.last == profile.first)
+	{
+		fprintf(f, "No time spent running.\n");
+		xfree(profile.processes);
+		return;
+	}
+
+	sweep(&profile);
+	output_histogram(f, &profile);
+	output_chart(f, &profile);
+	output_serials(f, &profile);
+
+	xfree(profile.processes);
+	xfree(profile.levels);
+	xfree(profile.serials);
+}
@@ -0,0 +1,367 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "tracee.h"
+#include "output.h"
+#include "options.h"
+#include "hash.h"
+#include "xmalloc.h"
+
+/*
+ * Tab separated values with one row per tracee, numbered in depth first
+ * order and linked to their parent by that number, for bulk loading into
+ * databases without flattening the tree. Environments are interned, and
+ * written to their own table with one row per variable when one is given
+ * with -N, so that identical environments are stored once.
+ */
+
+#define HEADER "id\tparent\ttid\tdepth\tstart\tend\texit_code\targuments\tdirectory\tenvironment\n"
+#define ENV_HEADER "environment\tname\tvalue\n"
+
+/* Bytes of output collected before they are written. */
+#define BUFFER_SIZE (1 << 16)
+
+struct writer
+{
+	FILE *f;
+	char buf[BUFFER_SIZE];
+	size_t len;
+};
+
+/* An interned environment. */
+struct environment
+{
+	uint64_t hash;
+	char **envp;
+	size_t id;
+};
+
+struct environments
+{
+	/* Open addressing table, the capacity is zero or a power of two. */
+	struct environment *slots;
+	size_t count;
+	size_t capacity;
+
+	struct writer *writer;
+};
+
+static void flush(struct writer *writer)
+{
+	fwrite(writer->buf, 1, writer->len, writer->f);
+	writer->len = 0;
+}
+
+static void put(struct writer *writer, const char *data, size_t len)
+{
+	while (len > 0)
+	{
+		size_t chunk = BUFFER_SIZE - writer->len;
+
+		if (chunk > len)
+		{
+			chunk = len;
+		}
+
+		memcpy(writer->buf + writer->len, data, chunk);
+		writer->len += chunk;
+		data += chunk;
+		len -= chunk;
+
+		if (writer->len == BUFFER_SIZE)
+		{
+			flush(writer);
+		}
+	}
+}
+
+/* Formatted values are short, numbers and times. */
+#define put_format(writer, ...)                                         \
+	do                                                              \
+	{                                                               \
+		char formatted[64];                                     \
+		int n = snprintf(formatted, sizeof(formatted), __VA_ARGS__); \
+		put(writer, formatted, n);                              \
+	}                                                               \
+	while (0)
+
+/* Write str with backslashes, tabs and line breaks escaped. */
+static void put_escaped(struct writer *writer, const char *str, size_t len)
+{
+	size_t start = 0;
+
+	for (size_t i = 0; i < len; ++i)
+	{
+		const char *escape;
+
+		switch (str[i])
+		{
+		case '\\':
+			escape = "\\\\";
+			break;
+		case '\t':
+			escape = "\\t";
+			break;
+		case '\n':
+			escape = "\\n";
+			break;
+		case '\r':
+			escape = "\\r";
+			break;
+		default:
+			continue;
+		}
+
+		put(writer, str + start, i - start);
+		put(writer, escape, 2);
+		start = i + 1;
+	}
+
+	put(writer, str + start, len - start);
+}
+
+static uint64_t hash_list(char **list)
+{
+	struct hash64 state;
+
+	hash64_init(&state, 0);
+
+	for (char **ptr = list; *ptr; ++ptr)
+	{
+		hash64_update(&state, *ptr, strlen(*ptr) + 1);
+	}
+
+	return hash64_digest(&state);
+}
+
+static bool list_equal(char **a, char **b)
+{
+	for (; *a && *b; ++a, ++b)
+	{
+		if (strcmp(*a, *b) != 0)
+		{
+			return false;
+		}
+	}
+
+	return *a == *b;
+}
+
+static void grow(struct environments *environments)
+{
+	struct environment *old = environments->slots;
+	size_t capacity = environments->capacity;
+
+	environments->capacity = capacity ? capacity * 2 : 64;
+	environments->slots = xcalloc(environments->capacity, sizeof(*environments->slots));
+
+	for (size_t i = 0; i < capacity; ++i)
+	{
+		if (old[i].envp)
+		{
+			size_t slot = old[i].hash & (environments->capacity - 1);
+
+			while (environments->slots[slot].envp)
+			{
+				slot = (slot + 1) & (environments->capacity - 1);
+			}
+
+			environments->slots[slot] = old[i];
+		}
+	}
+
+	xfree(old);
+}
+
+/* Id of envp, writing its rows to the environment table the first time it is seen. */
+static size_t intern(struct environments *environments, char **envp)
+{
+	uint64_t hash = hash_list(envp);
+	struct environment *environment;
+	size_t slot;
+
+	if (2 * (environments->count + 1) > environments->capacity)
+	{
+		grow(environments);
+	}
+
+	for (slot = hash & (environments->capacity - 1); environments->slots[slot].envp;
+	     slot = (slot + 1) & (environments->capacity - 1))
+	{
+		environment = &environments->slots[slot];
+
+		if (environment->hash == hash && list_equal(environment->envp, envp))
+		{
+			return environment->id;
+		}
+	}
+
+	environment = &environments->slots[slot];
+	environment->hash = hash;
+	environment->envp = envp;
+	environment->id = ++environments->count;
+
+	for (char **ptr = envp; *ptr; ++ptr)
+	{
+		const char *value;
+		size_t length;
+
+		if (!strcap_split_variable(*ptr, &length, &value))
+		{
+			continue;
+		}
+
+		put_format(environments->writer, "%zu\t", environment->id);
+		put_escaped(environments->writer, *ptr, length);
+		put(environments->writer, "\t", 1);
+		put_escaped(environments->writer, value, strlen(value));
+		put(environments->writer, "\n", 1);
+	}
+
+	return environment->id;
+}
+
+static void put_row(struct writer *writer, struct environments *environments, struct tracee *tracee,
+                    size_t id, size_t parent, size_t depth, timestamp_t epoch)
+{
+	put_format(writer, "%zu\t", id);
+
+	if (parent)
+	{
+		put_format(writer, "%zu", parent);
+	}
+
+	put_format(writer, "\t%ld\t%zu\t%.6f\t", tracee->tid, depth,
+	           timestamp_to_seconds(tracee->start_time - epoch));
+
+	if (tracee->end_time)
+	{
+		put_format(writer, "%.6f", timestamp_to_seconds(tracee->end_time - epoch));
+	}
+
+	put(writer, "\t", 1);
+
+	if (output_exit_code(tracee) >= 0)
+	{
+		put_format(writer, "%d", output_exit_code(tracee));
+	}
+
+	put(writer, "\t", 1);
+
+	for (char **arg = tracee->argv; arg && *arg; ++arg)
+	{
+		if (arg != tracee->argv)
+		{
+			put(writer, " ", 1);
+		}
+
+		put_escaped(writer, *arg, strlen(*arg));
+	}
+
+	put(writer, "\t", 1);
+
+	if (tracee->cwd)
+	{
+		put_escaped(writer, tracee->cwd, strlen(tracee->cwd));
+	}
+
+	put(writer, "\t", 1);
+
+	if (environments && tracee->envp)
+	{
+		put_format(writer, "%zu", intern(environments, tracee->envp));
+	}
+
+	put(writer, "\n", 1);
+}
+
+void output_fn_table(FILE *f, struct tracee *tracee, struct options *options)
+{
+	/* Tracees still to be written, with the row of their parent and their depth. */
+	struct pending
+	{
+		struct tracee *tracee;
+		size_t parent;
+		size_t depth;
+	} *stack = NULL;
+	size_t count = 0, capacity = 0;
+
+	struct writer *writer = xmalloc(sizeof(*writer));
+	struct writer *env_writer = NULL;
+	struct environments environments = {0};
+	size_t id = 0;
+	timestamp_t epoch = tracee->start_time;
+
+	writer->f = f;
+	writer->len = 0;
+
+	if (options->env_table && !options->exclude_environ)
+	{
+		env_writer = xmalloc(sizeof(*env_writer));
+		env_writer->f = options->env_table;
+		env_writer->len = 0;
+		environments.writer = env_writer;
+
+		put(env_writer, ENV_HEADER, strlen(ENV_HEADER));
+	}
+
+	put(writer, HEADER, strlen(HEADER));
+
+	/* The session tracee has no row, see struct tree. */
+	if (tracee->tid == 0)
+	{
+		for (size_t i = tracee->nchildren; i > 0; --i)
+		{
+			if (count == capacity)
+			{
+				capacity = capacity ? capacity * 2 : 64;
+				stack = xrealloc(stack, capacity * sizeof(*stack));
+			}
+
+			stack[count++] = (struct pending) { tracee->children[i - 1], 0, 0 };
+		}
+	}
+	else
+	{
+		capacity = 64;
+		stack = xmalloc(capacity * sizeof(*stack));
+		stack[count++] = (struct pending) { tracee, 0, 0 };
+	}
+
+	while (count > 0)
+	{
+		struct pending next = stack[--count];
+
+		if (output_exclude(next.tracee, options))
+		{
+			continue;
+		}
+
+		put_row(writer, env_writer ? &environments : NULL, next.tracee, ++id,
+		        next.parent, next.depth, epoch);
+
+		/* Children are pushed in reverse, to be written in order. */
+		for (size_t i = next.tracee->nchildren; i > 0; --i)
+		{
+			if (count == capacity)
+			{
+				capacity *= 2;
+				stack = xrealloc(stack, capacity * sizeof(*stack));
+			}
+
+			stack[count++] = (struct pending) { next.tracee->children[i - 1], id, next.depth + 1 };
+		}
+	}
+
+	flush(writer);
+	xfree(writer);
+	xfree(stack);
+
+	if (env_writer)
+	{
+		flush(env_writer);
+		xfree(env_writer);
+		xfree(environments.slots);
+	}
+}
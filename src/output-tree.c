@@ -4,11 +4,51 @@
 
 #include "tracee.h"
 #include "output.h"
+#include "options.h"
+#include "collapse.h"
+#include "parallel.h"
 
-static void output_fn_tree_rec(FILE *f, struct tracee *tracee, struct options *options, bool *prefix, size_t indent)
+static void output_label(FILE *f, struct tracee *tracee, struct options *options, size_t count, timestamp_t duration)
+{
+	char **argv = tracee->argv;
+
+	if (argv)
+	{
+		for (; *argv; ++argv)
+		{
+			fprintf(f, "%s ", *argv);
+		}
+	}
+	else
+	{
+		fprintf(f, "%ld ", tracee->tid);
+	}
+
+	if (count > 1)
+	{
+		fprintf(f, "×%zu ", count);
+	}
+
+	if (options->timing)
+	{
+		if (count == 1 && tracee->end_time == 0)
+		{
+			fprintf(f, "[running] ");
+		}
+		else
+		{
+			fprintf(f, "[%.3fs] ", timestamp_to_seconds(duration));
+		}
+	}
+
+	fprintf(f, "\n");
+}
+
+static void output_fn_tree_rec(FILE *f, struct tracee *tracee, struct options *options,
+                               struct parallel *parallel, bool *prefix, size_t indent)
 {
 	struct tracee *child;
-	char **argv;
+	size_t count, next;
 
 	size_t last_child = 0;
 	for (size_t i = 0; i < tracee->nchildren; ++i)
@@ -19,15 +59,18 @@ static void output_fn_tree_rec(FILE *f, struct tracee *tracee, struct options *o
 		}
 	}
 
-	for (size_t i = 0; tracee->children && i <= last_child; ++i)
+	for (size_t i = 0; tracee->nchildren > 0 && i <= last_child; i = next)
 	{
 		child = tracee->children[i];
 
 		if (output_exclude(child, options))
 		{
+			next = i + 1;
 			continue;
 		}
 
+		next = collapse_run(tracee, i, options, &count);
+
 		for (size_t j = 0; j < indent; ++j)
 		{
 			if (prefix[j])
@@ -40,7 +83,7 @@ static void output_fn_tree_rec(FILE *f, struct tracee *tracee, struct options *o
 			}
 		}
 
-		if (i < last_child)
+		if (next <= last_child)
 		{
 			prefix[indent] = true;
 			fprintf(f, "├───");
@@ -51,41 +94,34 @@ static void output_fn_tree_rec(FILE *f, struct tracee *tracee, struct options *o
 			fprintf(f, "└───");
 		}
 
-		argv = child->argv;
+		output_label(f, child, options, count, output_run_duration(tracee, i, next, options));
 
-		if (argv)
-		{
-			for (; *argv; ++argv)
-			{
-				fprintf(f, "%s ", *argv);
-			}
-		}
-		else
+		/* The prefix state of a subtree is the prefix of its lines. */
+		if (!parallel_unit(parallel, f, child, prefix, indent+1))
 		{
-			fprintf(f, "%ld ", child->tid);
+			output_fn_tree_rec(f, child, options, parallel, prefix, indent+1);
 		}
-
-		fprintf(f, "\n");
-		output_fn_tree_rec(f, child, options, prefix, indent+1);
 	}
 }
 
-void output_fn_tree(FILE *f, struct tracee *tracee, struct options *options)
+static void output_fn_tree_unit(FILE *f, struct tracee *tracee, struct options *options,
+                                struct parallel *parallel, const void *state, size_t size)
 {
 	bool prefix[4096] = {0};
-	size_t indent = 0;
+
+	memcpy(prefix, state, size);
+	output_fn_tree_rec(f, tracee, options, parallel, prefix, size / sizeof(*prefix));
+}
+
+void output_fn_tree(FILE *f, struct tracee *tracee, struct options *options)
+{
+	bool prefix[1] = {0};
 
 	if (output_exclude(tracee, options))
 	{
 		return;
 	}
 
-	for (char **arg = tracee->argv; *arg; ++arg)
-	{
-		fprintf(f, "%s ", *arg);
-	}
-
-	fprintf(f, "\n");
-
-	output_fn_tree_rec(f, tracee, options, prefix, indent);
+	output_label(f, tracee, options, 1, output_duration(tracee));
+	parallel_output(f, tracee, options, output_fn_tree_unit, prefix, 0);
 }
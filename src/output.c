@@ -1,23 +1,39 @@
 #include <string.h>
 
+#include <sys/wait.h>
+
 #include "output.h"
 #include "options.h"
 
 void output_fn_tree(FILE*, struct tracee*, struct options*);
 void output_fn_json(FILE*, struct tracee*, struct options*);
 void output_fn_plain(FILE*, struct tracee*, struct options*);
+void output_fn_chrome(FILE*, struct tracee*, struct options*);
+void output_fn_table(FILE*, struct tracee*, struct options*);
+void output_fn_profile(FILE*, struct tracee*, struct options*);
 
 typedef struct {
 	const char *name;
 	output_fn_t fn;
+
+	/* A session tracee is output as a whole, rather than in sections. */
+	bool whole;
+
+	/* Sections are elements of a JSON array, so that the output stays one document. */
+	bool array;
 } output_fn_entry_t;
 
-#define output_fn_entry(fn) { #fn, output_fn_ ## fn }
+#define output_fn_entry(fn) { #fn, output_fn_ ## fn, false, false }
+#define output_fn_entry_whole(fn) { #fn, output_fn_ ## fn, true, false }
+#define output_fn_entry_array(fn) { #fn, output_fn_ ## fn, false, true }
 
 static const output_fn_entry_t output_fns[] = {
 	output_fn_entry(tree),
-	output_fn_entry(json),
+	output_fn_entry_array(json),
 	output_fn_entry(plain),
+	output_fn_entry(chrome),
+	output_fn_entry_whole(table),
+	output_fn_entry_whole(profile),
 	{0},
 };
 
@@ -36,6 +52,21 @@ output_fn_t get_output_fn(const char *name)
 	return NULL;
 }
 
+const char *get_output_format_name(output_fn_t fn)
+{
+	const output_fn_entry_t *entry;
+
+	for (entry = output_fns; entry->name; ++entry)
+	{
+		if (entry->fn == fn)
+		{
+			return entry->name;
+		}
+	}
+
+	return NULL;
+}
+
 const output_fn_t default_output_fn = output_fn_tree;
 
 static const char *formats[sizeof(output_fns) / sizeof(output_fns[0])];
@@ -54,6 +85,60 @@ const char **get_output_formats(void)
 	return formats;
 }
 
+static const output_fn_entry_t *find_entry(output_fn_t fn)
+{
+	const output_fn_entry_t *entry;
+
+	for (entry = output_fns; entry->name; ++entry)
+	{
+		if (entry->fn == fn)
+		{
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+void output_sections(FILE *f, struct tracee *root, output_fn_t fn, struct options *options)
+{
+	const output_fn_entry_t *entry = find_entry(fn);
+	bool array = entry && entry->array;
+
+	if (root == NULL)
+	{
+		return;
+	}
+
+	/* See struct tree for the session tracee. */
+	if (root->tid != 0 || (entry && entry->whole))
+	{
+		fn(f, root, options);
+		return;
+	}
+
+	if (array)
+	{
+		fputc('[', f);
+	}
+
+	for (size_t i = 0; i < root->nchildren; ++i)
+	{
+		/* A blank line after line based formats, a new line after JSON. */
+		if (i > 0)
+		{
+			fputs(array ? ",\n" : "\n", f);
+		}
+
+		fn(f, root->children[i], options);
+	}
+
+	if (array)
+	{
+		fputc(']', f);
+	}
+}
+
 bool output_exclude(struct tracee *tracee, struct options *options)
 {
 	regmatch_t match;
@@ -73,3 +158,43 @@ bool output_exclude(struct tracee *tracee, struct options *options)
 
 	return false;
 }
+
+int output_exit_code(struct tracee *tracee)
+{
+	if (!tracee->has_exit_status)
+	{
+		return -1;
+	}
+
+	if (WIFSIGNALED(tracee->exit_status))
+	{
+		return 128 + WTERMSIG(tracee->exit_status);
+	}
+
+	return WEXITSTATUS(tracee->exit_status);
+}
+
+timestamp_t output_duration(struct tracee *tracee)
+{
+	if (tracee->end_time == 0)
+	{
+		return 0;
+	}
+
+	return tracee->end_time - tracee->start_time;
+}
+
+timestamp_t output_run_duration(struct tracee *parent, size_t begin, size_t end, struct options *options)
+{
+	timestamp_t duration = 0;
+
+	for (size_t i = begin; i < end; ++i)
+	{
+		if (!output_exclude(parent->children[i], options))
+		{
+			duration += output_duration(parent->children[i]);
+		}
+	}
+
+	return duration;
+}
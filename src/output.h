@@ -22,14 +22,47 @@ extern const output_fn_t default_output_fn;
  */
 output_fn_t get_output_fn(const char *name);
 
+/*
+ * Get the format name of the given output function.
+ */
+const char *get_output_format_name(output_fn_t fn);
+
 /*
  * Get a NULL-terminated list of supported output formats.
  */
 const char **get_output_formats(void);
 
+/*
+ * Output the tree of root with fn. A session root is output as one
+ * section per traced root, separated by a new line, unless fn outputs
+ * sessions as a whole. JSON sections are elements of an array.
+ */
+void output_sections(FILE *f, struct tracee *root, output_fn_t fn, struct options *options);
+
+/*
+ * Write the first len characters of str, escaped for a JSON string.
+ */
+void output_json_escaped(FILE *f, const char *str, int len);
+
 /*
  * Tracee (and its children) should be excluded based on user-provided pattern.
  */
 bool output_exclude(struct tracee *tracee, struct options *options);
 
+/*
+ * Exit code of tracee as a shell reports it, 128 plus the signal number
+ * for a tracee killed by a signal, or -1 if it is not known.
+ */
+int output_exit_code(struct tracee *tracee);
+
+/*
+ * Running time of tracee, or zero if it is still running.
+ */
+timestamp_t output_duration(struct tracee *tracee);
+
+/*
+ * Total running time of the non-excluded children of parent in the range [begin, end).
+ */
+timestamp_t output_run_duration(struct tracee *parent, size_t begin, size_t end, struct options *options);
+
 #endif
@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "parallel.h"
+#include "xmalloc.h"
+
+/* Trees with fewer tracees are formatted serially. */
+#define MIN_TRACEES (1 << 14)
+
+/* Subtrees per thread, so that threads done early take over the rest. */
+#define UNITS_PER_THREAD 16
+
+#define MAX_THREADS 64
+
+/* A subtree formatted by the pool. */
+struct unit
+{
+	struct tracee *tracee;
+
+	/* State it is formatted with. */
+	void *state;
+	size_t size;
+
+	/* Where its output goes in the output of the rest of the tree. */
+	size_t offset;
+
+	/* Its output, once done. */
+	char *text;
+	size_t length;
+	bool done;
+};
+
+struct parallel
+{
+	struct options *options;
+	parallel_fn_t fn;
+
+	/* Roots of the subtrees formatted by the pool, sorted by address. */
+	struct tracee **roots;
+	size_t nroots;
+
+	/* Subtrees in output order, as they are reached by fn. */
+	struct unit *units;
+	size_t nunits;
+	size_t capacity;
+
+	/* The next unit to be taken by a thread. */
+	size_t next;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+/* Store the size of each subtree of tracee in sizes, in depth first order. */
+static size_t subtree_sizes(struct tracee *tracee, size_t *sizes, size_t *index)
+{
+	size_t i = (*index)++;
+
+	sizes[i] = 1;
+
+	for (size_t j = 0; j < tracee->nchildren; ++j)
+	{
+		sizes[i] += subtree_sizes(tracee->children[j], sizes, index);
+	}
+
+	return sizes[i];
+}
+
+static size_t count_tracees(struct tracee *tracee)
+{
+	size_t count = 1;
+
+	for (size_t i = 0; i < tracee->nchildren; ++i)
+	{
+		count += count_tracees(tracee->children[i]);
+	}
+
+	return count;
+}
+
+/* Split the subtrees below tracee until each has at most limit tracees. */
+static void choose_roots(struct parallel *parallel, struct tracee *tracee, size_t *sizes,
+                         size_t *index, size_t limit)
+{
+	++*index;
+
+	for (size_t i = 0; i < tracee->nchildren; ++i)
+	{
+		if (sizes[*index] > limit)
+		{
+			choose_roots(parallel, tracee->children[i], sizes, index, limit);
+			continue;
+		}
+
+		parallel->roots[parallel->nroots++] = tracee->children[i];
+		*index += sizes[*index];
+	}
+}
+
+static int compare_roots(const void *a, const void *b)
+{
+	uintptr_t x = (uintptr_t) *(struct tracee **) a;
+	uintptr_t y = (uintptr_t) *(struct tracee **) b;
+
+	return (x > y) - (x < y);
+}
+
+bool parallel_unit(struct parallel *parallel, FILE *f, struct tracee *tracee, const void *state, size_t size)
+{
+	struct unit *unit;
+
+	if (parallel == NULL || !bsearch(&tracee, parallel->roots, parallel->nroots,
+	                                 sizeof(*parallel->roots), compare_roots))
+	{
+		return false;
+	}
+
+	if (parallel->nunits == parallel->capacity)
+	{
+		parallel->capacity = parallel->capacity ? parallel->capacity * 2 : 64;
+		parallel->units = xrealloc(parallel->units, parallel->capacity * sizeof(*parallel->units));
+	}
+
+	unit = &parallel->units[parallel->nunits++];
+	unit->tracee = tracee;
+	unit->state = xmalloc(size ? size : 1);
+	unit->size = size;
+	unit->offset = ftell(f);
+	unit->text = NULL;
+	unit->length = 0;
+	unit->done = false;
+
+	memcpy(unit->state, state, size);
+	return true;
+}
+
+static void *format_units(void *data)
+{
+	struct parallel *parallel = data;
+
+	pthread_mutex_lock(&parallel->lock);
+
+	while (parallel->next < parallel->nunits)
+	{
+		struct unit *unit = &parallel->units[parallel->next++];
+		char *text = NULL;
+		size_t length = 0;
+		FILE *f;
+
+		pthread_mutex_unlock(&parallel->lock);
+
+		/* Without memory for a buffer, the unit is left empty. */
+		if ((f = open_memstream(&text, &length)))
+		{
+			parallel->fn(f, unit->tracee, parallel->options, NULL, unit->state, unit->size);
+			fclose(f);
+		}
+
+		pthread_mutex_lock(&parallel->lock);
+		unit->text = text;
+		unit->length = length;
+		unit->done = true;
+		pthread_cond_broadcast(&parallel->cond);
+	}
+
+	pthread_mutex_unlock(&parallel->lock);
+	return NULL;
+}
+
+/* Number of threads to format with, one per online CPU. */
+static size_t thread_count(void)
+{
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (count < 1)
+	{
+		return 1;
+	}
+
+	return count < MAX_THREADS ? count : MAX_THREADS;
+}
+
+void parallel_output(FILE *f, struct tracee *root, struct options *options,
+                     parallel_fn_t fn, const void *state, size_t size)
+{
+	struct parallel parallel = { .options = options, .fn = fn };
+	pthread_t threads[MAX_THREADS];
+	size_t nthreads = 0, threadcount = thread_count();
+	size_t count, index, written;
+	size_t *sizes;
+	char *text = NULL;
+	size_t length = 0;
+	sigset_t all, saved;
+	FILE *skeleton;
+
+	count = count_tracees(root);
+
+	if (threadcount < 2 || count < MIN_TRACEES || !(skeleton = open_memstream(&text, &length)))
+	{
+		fn(f, root, options, NULL, state, size);
+		return;
+	}
+
+	sizes = xmalloc(count * sizeof(*sizes));
+	parallel.roots = xmalloc(count * sizeof(*parallel.roots));
+
+	index = 0;
+	subtree_sizes(root, sizes, &index);
+
+	index = 0;
+	choose_roots(&parallel, root, sizes, &index, count / (threadcount * UNITS_PER_THREAD));
+	qsort(parallel.roots, parallel.nroots, sizeof(*parallel.roots), compare_roots);
+	xfree(sizes);
+
+	/* The tree above the units, with their offsets in it. */
+	fn(skeleton, root, options, &parallel, state, size);
+	fclose(skeleton);
+
+	pthread_mutex_init(&parallel.lock, NULL);
+	pthread_cond_init(&parallel.cond, NULL);
+
+	/* Signals keep going to the threads that wait for them. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &saved);
+
+	for (size_t i = 0; i < threadcount && i < parallel.nunits; ++i)
+	{
+		if (pthread_create(&threads[nthreads], NULL, format_units, &parallel) == 0)
+		{
+			++nthreads;
+		}
+	}
+
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+	if (nthreads == 0)
+	{
+		format_units(&parallel);
+	}
+
+	/* Units are written as soon as they are done, in order. */
+	written = 0;
+
+	for (size_t i = 0; i < parallel.nunits; ++i)
+	{
+		struct unit *unit = &parallel.units[i];
+
+		fwrite(text + written, 1, unit->offset - written, f);
+		written = unit->offset;
+
+		pthread_mutex_lock(&parallel.lock);
+
+		while (!unit->done)
+		{
+			pthread_cond_wait(&parallel.cond, &parallel.lock);
+		}
+
+		pthread_mutex_unlock(&parallel.lock);
+
+		fwrite(unit->text, 1, unit->length, f);
+		free(unit->text);
+		xfree(unit->state);
+	}
+
+	fwrite(text + written, 1, length - written, f);
+
+	for (size_t i = 0; i < nthreads; ++i)
+	{
+		pthread_join(threads[i], NULL);
+	}
+
+	pthread_cond_destroy(&parallel.cond);
+	pthread_mutex_destroy(&parallel.lock);
+
+	free(text);
+	xfree(parallel.units);
+	xfree(parallel.roots);
+}
@@ -0,0 +1,38 @@
+#ifndef PARALLEL_H_INCLUDED
+#define PARALLEL_H_INCLUDED
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "tracee.h"
+
+struct options;
+struct parallel;
+
+/*
+ * Format the subtree of tracee, given the state it is formatted with by
+ * its parent, which is size bytes at state. Formats that support parallel
+ * output call parallel_unit() before formatting each subtree, with
+ * parallel as they got it, and are called with NULL to format serially.
+ */
+typedef void (*parallel_fn_t)(FILE *f, struct tracee *tracee, struct options *options,
+                              struct parallel *parallel, const void *state, size_t size);
+
+/*
+ * Format the tree of root with fn, starting with state. A large tree is
+ * split into subtrees that are formatted by a pool of threads into buffers
+ * of their own, and written in order with the parts of the tree above them,
+ * so that the output is the same as the output of fn on its own.
+ */
+void parallel_output(FILE *f, struct tracee *root, struct options *options,
+                     parallel_fn_t fn, const void *state, size_t size);
+
+/*
+ * Called by fn before formatting the subtree of tracee with state, as
+ * described above. Returns true if the subtree is formatted by the pool,
+ * and should be skipped.
+ */
+bool parallel_unit(struct parallel *parallel, FILE *f, struct tracee *tracee, const void *state, size_t size);
+
+#endif
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "pathset.h"
+#include "xmalloc.h"
+#include "hash.h"
+
+/* Slot that holds path, or the empty slot where it belongs. */
+static size_t find_slot(struct pathset *set, const char *path)
+{
+	size_t i = hash_fnv1a(path, HASH_FNV1A_SEED) & (set->capacity - 1);
+
+	while (set->slots[i] && strcmp(set->paths[set->slots[i] - 1], path) != 0)
+	{
+		i = (i + 1) & (set->capacity - 1);
+	}
+
+	return i;
+}
+
+static void grow(struct pathset *set)
+{
+	set->capacity = set->capacity ? set->capacity * 2 : 16;
+
+	xfree(set->slots);
+	set->slots = xcalloc(set->capacity, sizeof(*set->slots));
+
+	for (size_t i = 0; i < set->count; ++i)
+	{
+		set->slots[find_slot(set, set->paths[i])] = i + 1;
+	}
+}
+
+bool pathset_add(struct pathset *set, const char *path)
+{
+	size_t i;
+
+	/* Keep load factor below 3/4, the paths array grows along with the slots. */
+	if ((set->count + 1) * 4 > set->capacity * 3)
+	{
+		grow(set);
+		set->paths = xrealloc(set->paths, set->capacity * sizeof(*set->paths));
+	}
+
+	i = find_slot(set, path);
+
+	if (set->slots[i])
+	{
+		return false;
+	}
+
+	set->paths[set->count++] = strdup(path);
+	set->slots[i] = set->count;
+
+	return true;
+}
+
+void pathset_clear(struct pathset *set)
+{
+	for (size_t i = 0; i < set->count; ++i)
+	{
+		xfree(set->paths[i]);
+	}
+
+	xfree(set->paths);
+	xfree(set->slots);
+	memset(set, 0, sizeof(*set));
+}
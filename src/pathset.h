@@ -0,0 +1,34 @@
+#ifndef PATHSET_H_INCLUDED
+#define PATHSET_H_INCLUDED
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Set of paths, which keeps the order they were first added in.
+ */
+struct pathset
+{
+	/* Paths, in the order they were added. */
+	char **paths;
+	size_t count;
+
+	/* Number of allocated hash slots, always zero or a power of two. */
+	size_t capacity;
+
+	/* Hash slots with one more than the index of a path, zero marks an empty slot. */
+	size_t *slots;
+};
+
+/*
+ * Add a copy of path unless it is in the set already.
+ * Returns true if it was added.
+ */
+bool pathset_add(struct pathset *set, const char *path);
+
+/*
+ * Free memory used by the set and its paths.
+ */
+void pathset_clear(struct pathset *set);
+
+#endif
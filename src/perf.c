@@ -0,0 +1,496 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <err.h>
+
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <linux/perf_event.h>
+#include <linux/sched.h>
+#include <linux/limits.h>
+
+#include "perf.h"
+#include "xmalloc.h"
+
+/* Pages of the ring buffer of each CPU, a power of two. */
+#define RING_PAGES 128
+
+/* Interval at which the rings are read when they don't fill up. */
+#define READ_INTERVAL (NS_PER_SEC / 50)
+
+static const char *tracefs_dirs[] = {
+	"/sys/kernel/tracing",
+	"/sys/kernel/debug/tracing",
+	NULL,
+};
+
+/* Notification read from a ring. */
+struct perf_sample
+{
+	timestamp_t time;
+
+	/* Order in which samples were read, which breaks ties of time. */
+	size_t seq;
+
+	enum { SAMPLE_FORK, SAMPLE_EXEC, SAMPLE_EXIT } type;
+
+	/* Thread the tracepoint was hit in. */
+	long tid;
+	long tgid;
+
+	/* Created thread, for forks. */
+	long child_tid;
+	long child_tgid;
+};
+
+/* The samples requested in perf_event_attr.sample_type. */
+struct sample_record
+{
+	struct perf_event_header header;
+	uint32_t pid;
+	uint32_t tid;
+	uint64_t time;
+	uint32_t size;
+	unsigned char data[];
+};
+
+static FILE *open_format(const char *event)
+{
+	char path[PATH_MAX];
+	FILE *f = NULL;
+
+	for (size_t i = 0; tracefs_dirs[i] && f == NULL; ++i)
+	{
+		snprintf(path, sizeof(path), "%s/events/%s/format", tracefs_dirs[i], event);
+		f = fopen(path, "r");
+	}
+
+	return f;
+}
+
+/*
+ * Read the id of event, and the offset and size of one of its fields if
+ * field is not NULL, from its format file in tracefs. Field lines look like
+ *     field:pid_t pid;	offset:8;	size:4;	signed:1;
+ */
+static int read_format(const char *event, unsigned short *id,
+                       const char *field, size_t *offset, size_t *size)
+{
+	char line[512];
+	bool found_id = false;
+	bool found_field = field == NULL;
+	FILE *f = open_format(event);
+
+	if (f == NULL)
+	{
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f))
+	{
+		char *decl = strstr(line, "field:");
+		char *end;
+		char *name;
+
+		if (sscanf(line, "ID: %hu", id) == 1)
+		{
+			found_id = true;
+			continue;
+		}
+
+		if (found_field || decl == NULL || (end = strchr(decl, ';')) == NULL)
+		{
+			continue;
+		}
+
+		/* The name is the last word of the declaration, before any array size. */
+		*end = 0;
+		name = strrchr(decl, ' ');
+		name = name ? name + 1 : decl + strlen("field:");
+		name[strcspn(name, "[")] = 0;
+
+		if (strcmp(name, field) == 0
+		 && sscanf(end + 1, " offset:%zu; size:%zu;", offset, size) == 2)
+		{
+			found_field = true;
+		}
+	}
+
+	fclose(f);
+
+	if (!found_id || !found_field)
+	{
+		errno = ENOENT;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int open_event(unsigned short id, int cpu, size_t ring_size)
+{
+	struct perf_event_attr attr = {0};
+
+	attr.type = PERF_TYPE_TRACEPOINT;
+	attr.size = sizeof(attr);
+	attr.config = id;
+	attr.sample_period = 1;
+	attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_RAW;
+	attr.use_clockid = 1;
+	attr.clockid = CLOCK_MONOTONIC;
+
+	/* Wake up when a quarter of the ring is used, the timer reads the rest. */
+	attr.watermark = 1;
+	attr.wakeup_watermark = ring_size / 4;
+
+	return syscall(SYS_perf_event_open, &attr, -1, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+static void close_cpu(struct perf_cpu *cpu)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+
+	if (cpu->ring)
+	{
+		munmap(cpu->ring, (RING_PAGES + 1) * page_size);
+		cpu->ring = NULL;
+	}
+
+	for (size_t i = 0; i < sizeof(cpu->fds) / sizeof(*cpu->fds); ++i)
+	{
+		if (cpu->fds[i] >= 0)
+		{
+			close(cpu->fds[i]);
+			cpu->fds[i] = -1;
+		}
+	}
+}
+
+/* Open the events of cpu, all of them writing to the ring of the first one. */
+static int open_cpu(struct perf *perf, struct perf_cpu *cpu, int index)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	unsigned short ids[] = { perf->newtask_id, perf->exec_id, perf->exit_id };
+
+	for (size_t i = 0; i < sizeof(ids) / sizeof(*ids); ++i)
+	{
+		cpu->fds[i] = open_event(ids[i], index, RING_PAGES * page_size);
+
+		if (cpu->fds[i] < 0)
+		{
+			return -1;
+		}
+
+		if (i == 0)
+		{
+			cpu->ring = mmap(NULL, (RING_PAGES + 1) * page_size, PROT_READ | PROT_WRITE,
+			                 MAP_SHARED, cpu->fds[0], 0);
+
+			if (cpu->ring == MAP_FAILED)
+			{
+				cpu->ring = NULL;
+				return -1;
+			}
+		}
+		else if (ioctl(cpu->fds[i], PERF_EVENT_IOC_SET_OUTPUT, cpu->fds[0]) < 0)
+		{
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static unsigned long read_field(const unsigned char *data, size_t offset, size_t size)
+{
+	uint32_t u32;
+	uint64_t u64;
+
+	if (size == sizeof(u64))
+	{
+		memcpy(&u64, data + offset, sizeof(u64));
+		return u64;
+	}
+
+	memcpy(&u32, data + offset, sizeof(u32));
+	return u32;
+}
+
+static void add_sample(struct perf *perf, const struct sample_record *record)
+{
+	struct perf_sample sample = { .time = record->time, .tid = record->tid, .tgid = record->pid };
+	unsigned short type;
+
+	if (record->size < sizeof(type))
+	{
+		return;
+	}
+
+	memcpy(&type, record->data, sizeof(type));
+
+	if (type == perf->newtask_id)
+	{
+		if (record->size < perf->child_offset + sizeof(uint32_t)
+		 || record->size < perf->flags_offset + perf->flags_size)
+		{
+			return;
+		}
+
+		/* The new thread is created by the thread hitting the tracepoint. */
+		sample.type = SAMPLE_FORK;
+		sample.child_tid = read_field(record->data, perf->child_offset, sizeof(uint32_t));
+		sample.child_tgid = sample.child_tid;
+
+		if (read_field(record->data, perf->flags_offset, perf->flags_size) & CLONE_THREAD)
+		{
+			sample.child_tgid = sample.tgid;
+		}
+	}
+	else if (type == perf->exec_id)
+	{
+		sample.type = SAMPLE_EXEC;
+	}
+	else if (type == perf->exit_id)
+	{
+		sample.type = SAMPLE_EXIT;
+	}
+	else
+	{
+		return;
+	}
+
+	if (perf->npending == perf->pending_capacity)
+	{
+		perf->pending_capacity = perf->pending_capacity ? perf->pending_capacity * 2 : 256;
+		perf->pending = xrealloc(perf->pending, perf->pending_capacity * sizeof(*perf->pending));
+	}
+
+	sample.seq = perf->npending;
+	perf->pending[perf->npending++] = sample;
+}
+
+/* Copy len bytes at offset of the ring, which may wrap around its end. */
+static void copy_from_ring(const unsigned char *ring, size_t size, uint64_t offset, void *dst, size_t len)
+{
+	size_t start = offset & (size - 1);
+	size_t first = len < size - start ? len : size - start;
+
+	memcpy(dst, ring + start, first);
+	memcpy((unsigned char *) dst + first, ring, len - first);
+}
+
+static void read_ring(struct perf *perf, struct perf_cpu *cpu)
+{
+	static unsigned char buf[1 << 16] __attribute__((aligned(8)));
+	struct perf_event_mmap_page *meta = cpu->ring;
+	const unsigned char *ring = (unsigned char *) cpu->ring + meta->data_offset;
+	uint64_t head = __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+	uint64_t tail = meta->data_tail;
+	struct perf_event_header header;
+
+	while (tail < head)
+	{
+		copy_from_ring(ring, meta->data_size, tail, &header, sizeof(header));
+		copy_from_ring(ring, meta->data_size, tail, buf, header.size);
+
+		if (header.type == PERF_RECORD_SAMPLE && header.size >= sizeof(struct sample_record))
+		{
+			add_sample(perf, (struct sample_record *) buf);
+		}
+		else if (header.type == PERF_RECORD_LOST)
+		{
+			if (!perf->overflowed)
+			{
+				warnx("Process events were lost, the tree is incomplete");
+			}
+
+			perf->overflowed = true;
+		}
+
+		tail += header.size;
+	}
+
+	__atomic_store_n(&meta->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+	const struct perf_sample *x = a;
+	const struct perf_sample *y = b;
+
+	if (x->time != y->time)
+	{
+		return x->time < y->time ? -1 : 1;
+	}
+
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static void handle_sample(struct perf *perf, struct perf_sample *sample)
+{
+	switch (sample->type)
+	{
+	case SAMPLE_FORK:
+		follower_fork(&perf->follower, sample->tid, sample->tgid,
+		              sample->child_tid, sample->child_tgid, sample->time);
+		break;
+
+	/* The thread that executes takes over the tid of the process. */
+	case SAMPLE_EXEC:
+		follower_exec(&perf->follower, sample->tgid, sample->time);
+		break;
+
+	case SAMPLE_EXIT:
+		/* The tracepoint doesn't carry the exit code. */
+		follower_exit(&perf->follower, sample->tid, sample->time, 0, false);
+		break;
+	}
+}
+
+/*
+ * Read all rings, and hand over the samples up to the time of the previous
+ * read, or all of them if flush is set. A sample of another CPU that is
+ * older than a read sample may still be written during the read, but not
+ * after the next one started.
+ */
+static void read_rings(struct perf *perf, bool flush)
+{
+	timestamp_t now = timestamp_now();
+	size_t count = 0;
+
+	for (size_t i = 0; i < perf->ncpus; ++i)
+	{
+		read_ring(perf, &perf->cpus[i]);
+	}
+
+	qsort(perf->pending, perf->npending, sizeof(*perf->pending), compare_samples);
+
+	while (count < perf->npending && (flush || perf->pending[count].time <= perf->complete_time))
+	{
+		handle_sample(perf, &perf->pending[count++]);
+	}
+
+	perf->npending -= count;
+	memmove(perf->pending, perf->pending + count, perf->npending * sizeof(*perf->pending));
+	perf->complete_time = now;
+
+	for (size_t i = 0; i < perf->npending; ++i)
+	{
+		perf->pending[i].seq = i;
+	}
+}
+
+static void handle_ring(long events, void *data)
+{
+	read_rings(data, false);
+}
+
+static void handle_read_timer(long expirations, void *data)
+{
+	struct perf *perf = data;
+
+	/* The timer stays in the loop after closing. */
+	if (perf->cpus)
+	{
+		read_rings(perf, false);
+	}
+}
+
+int perf_open(struct perf *perf, struct loop *loop, struct options *options,
+              void (*emit)(struct event *event, void *data), void *data)
+{
+	long ncpus = sysconf(_SC_NPROCESSORS_CONF);
+	size_t child_size;
+
+	memset(perf, 0, sizeof(*perf));
+	follower_init(&perf->follower, options, emit, data);
+	perf->loop = loop;
+
+	/* Only task_newtask tells threads from processes, with its clone flags. */
+	if (read_format("task/task_newtask", &perf->newtask_id, "pid", &perf->child_offset, &child_size) < 0
+	 || read_format("task/task_newtask", &perf->newtask_id, "clone_flags",
+	                &perf->flags_offset, &perf->flags_size) < 0
+	 || read_format("sched/sched_process_exec", &perf->exec_id, NULL, NULL, NULL) < 0
+	 || read_format("sched/sched_process_exit", &perf->exit_id, NULL, NULL, NULL) < 0)
+	{
+		return -1;
+	}
+
+	perf->cpus = xmalloc(ncpus * sizeof(*perf->cpus));
+
+	for (long i = 0; i < ncpus; ++i)
+	{
+		struct perf_cpu *cpu = &perf->cpus[perf->ncpus];
+
+		memset(cpu->fds, -1, sizeof(cpu->fds));
+		cpu->ring = NULL;
+
+		if (open_cpu(perf, cpu, i) < 0)
+		{
+			int saved = errno;
+			close_cpu(cpu);
+
+			/* Offline CPUs have no events to record. */
+			if (saved == ENODEV)
+			{
+				continue;
+			}
+
+			perf_close(perf);
+			errno = saved;
+			return -1;
+		}
+
+		perf->ncpus++;
+
+		if (loop_add_fd(loop, cpu->fds[0], handle_ring, perf) < 0)
+		{
+			perf_close(perf);
+			return -1;
+		}
+	}
+
+	if (loop_add_timer(loop, READ_INTERVAL, handle_read_timer, perf) < 0)
+	{
+		perf_close(perf);
+		return -1;
+	}
+
+	return 0;
+}
+
+int perf_start(struct perf *perf)
+{
+	return follower_start(&perf->follower);
+}
+
+void perf_close(struct perf *perf)
+{
+	if (perf->cpus == NULL)
+	{
+		return;
+	}
+
+	read_rings(perf, true);
+
+	for (size_t i = 0; i < perf->ncpus; ++i)
+	{
+		loop_remove_fd(perf->loop, perf->cpus[i].fds[0]);
+		close_cpu(&perf->cpus[i]);
+	}
+
+	xfree(perf->cpus);
+	xfree(perf->pending);
+	perf->cpus = NULL;
+	perf->ncpus = 0;
+	perf->pending = NULL;
+	perf->npending = 0;
+	perf->pending_capacity = 0;
+
+	follower_clear(&perf->follower);
+}
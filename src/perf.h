@@ -0,0 +1,85 @@
+#ifndef PERF_H_INCLUDED
+#define PERF_H_INCLUDED
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "event.h"
+#include "follow.h"
+#include "loop.h"
+#include "timestamp.h"
+
+struct options;
+
+/*
+ * Backend that follows processes with scheduler tracepoints recorded by
+ * perf_event_open() on every CPU. Like the connector backend processes are
+ * never stopped, but the kernel writes notifications to per CPU ring
+ * buffers that are read in batches, instead of sending a message for each
+ * one. Notifications are ordered by time before they are handed to a
+ * follower, and are held back for one batch so that the ones of other CPUs
+ * that were still being written are not overtaken.
+ * Requires CAP_PERFMON or CAP_SYS_ADMIN, and tracefs for the tracepoint ids.
+ */
+struct perf
+{
+	/* Ring buffer of each CPU, along with its tracepoint events. */
+	struct perf_cpu
+	{
+		/* Events of the tracepoints, the first one owns the ring. */
+		int fds[3];
+
+		/* Metadata page followed by the ring. */
+		void *ring;
+	} *cpus;
+	size_t ncpus;
+
+	/* Tracepoint ids, the first field of every raw sample. */
+	unsigned short newtask_id;
+	unsigned short exec_id;
+	unsigned short exit_id;
+
+	/* Fields of task:task_newtask. */
+	size_t child_offset;
+	size_t flags_offset;
+	size_t flags_size;
+
+	/* Notifications read from the rings but not handed to the follower yet,
+	   ordered by time. */
+	struct perf_sample *pending;
+	size_t npending;
+	size_t pending_capacity;
+
+	/* Notifications up to this time were complete when read. */
+	timestamp_t complete_time;
+
+	struct follower follower;
+	struct loop *loop;
+
+	/* Notifications were lost, since a ring buffer overflowed. */
+	bool overflowed;
+};
+
+/*
+ * Start recording the tracepoints on every CPU, and read them from loop.
+ * Processes started or attached to later are followed from the time of
+ * this call.
+ * Returns 0 on success and -1 on failure, errno is set by the
+ * corresponding libc call.
+ */
+int perf_open(struct perf *perf, struct loop *loop, struct options *options,
+              void (*emit)(struct event *event, void *data), void *data);
+
+/*
+ * Start all commands and follow all pids given in the options, along with
+ * their existing descendants.
+ * Returns 0 on success and -1 if none of them could be followed.
+ */
+int perf_start(struct perf *perf);
+
+/*
+ * Hand all notifications read so far to the follower, and stop recording.
+ */
+void perf_close(struct perf *perf);
+
+#endif
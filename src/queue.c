@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+
+#include "queue.h"
+#include "xmalloc.h"
+
+int queue_init(struct queue *queue)
+{
+	atomic_init(&queue->head, NULL);
+	queue->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	return queue->fd < 0 ? -1 : 0;
+}
+
+void queue_push(struct queue *queue, struct event *event)
+{
+	struct queue_node *node = xmalloc(sizeof(*node));
+	struct queue_node *head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+
+	node->event = *event;
+
+	do
+	{
+		node->next = head;
+	}
+	while (!atomic_compare_exchange_weak_explicit(&queue->head, &head, node,
+	                                              memory_order_release, memory_order_relaxed));
+
+	/* The consumer is woken up once for every batch. */
+	if (head == NULL)
+	{
+		uint64_t one = 1;
+		(void) !write(queue->fd, &one, sizeof(one));
+	}
+}
+
+void queue_drain(struct queue *queue, void (*fn)(struct event *event, void *data), void *data)
+{
+	struct queue_node *node, *reversed = NULL;
+	uint64_t count;
+
+	(void) !read(queue->fd, &count, sizeof(count));
+
+	node = atomic_exchange_explicit(&queue->head, NULL, memory_order_acquire);
+
+	while (node)
+	{
+		struct queue_node *next = node->next;
+		node->next = reversed;
+		reversed = node;
+		node = next;
+	}
+
+	while (reversed)
+	{
+		node = reversed;
+		reversed = node->next;
+
+		fn(&node->event, data);
+		xfree(node);
+	}
+}
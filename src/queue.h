@@ -0,0 +1,48 @@
+#ifndef QUEUE_H_INCLUDED
+#define QUEUE_H_INCLUDED
+
+#include <stdatomic.h>
+
+#include "event.h"
+
+/*
+ * Lock-free queue of events from any number of threads to one consumer.
+ * Producers push onto a shared stack, and the consumer takes the whole
+ * stack at once and reverses it, so events are consumed in the order they
+ * were pushed. An eventfd becomes readable when events are pushed onto an
+ * empty queue.
+ */
+struct queue
+{
+	/* Most recently pushed event. */
+	_Atomic(struct queue_node *) head;
+
+	/* Readable when there are events to consume. */
+	int fd;
+};
+
+struct queue_node
+{
+	struct event event;
+	struct queue_node *next;
+};
+
+/*
+ * Create the eventfd of an empty queue.
+ * Returns 0 on success and -1 on failure, errno is set by the
+ * corresponding libc call.
+ */
+int queue_init(struct queue *queue);
+
+/*
+ * Push a copy of event. The queue takes ownership of the strings in the event.
+ */
+void queue_push(struct queue *queue, struct event *event);
+
+/*
+ * Call fn with all events pushed so far, in order. fn takes ownership
+ * of the strings in the event.
+ */
+void queue_drain(struct queue *queue, void (*fn)(struct event *event, void *data), void *data);
+
+#endif
@@ -0,0 +1,794 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "record.h"
+#include "tracee.h"
+#include "compress.h"
+#include "xmalloc.h"
+#include "hash.h"
+
+#define RECORD_MAGIC "PTREE\0\0\1"
+#define RECORD_INDEX_MAGIC "PTBINDEX"
+#define RECORD_MAGIC_SIZE 8
+#define RECORD_BLOCK_HEADER_SIZE 8
+#define RECORD_TRAILER_SIZE 16
+#define RECORD_BLOCK_SIZE (1 << 16)
+
+/* Block size value that marks the start of the index. */
+#define RECORD_INDEX_MARKER 0xffffffffu
+
+enum record_type
+{
+	RECORD_STRING = 1,
+	RECORD_SPAWN,
+	RECORD_EXEC,
+	RECORD_CHDIR,
+	RECORD_EXIT,
+	RECORD_FILE,
+	RECORD_SAMPLE,
+};
+
+static int write_all(int fd, const void *data, size_t size)
+{
+	const unsigned char *ptr = data;
+
+	while (size > 0)
+	{
+		ssize_t n = write(fd, ptr, size);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			return -1;
+		}
+
+		ptr += n;
+		size -= n;
+	}
+
+	return 0;
+}
+
+static void put_u32(unsigned char *dst, uint32_t value)
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		dst[i] = value >> (8 * i);
+	}
+}
+
+static uint32_t get_u32(const unsigned char *src)
+{
+	uint32_t value = 0;
+
+	for (int i = 0; i < 4; ++i)
+	{
+		value |= (uint32_t) src[i] << (8 * i);
+	}
+
+	return value;
+}
+
+static void reserve(struct record_writer *writer, size_t size)
+{
+	if (writer->len + size <= writer->capacity)
+	{
+		return;
+	}
+
+	while (writer->len + size > writer->capacity)
+	{
+		writer->capacity = writer->capacity ? writer->capacity * 2 : RECORD_BLOCK_SIZE;
+	}
+
+	writer->buf = xrealloc(writer->buf, writer->capacity);
+}
+
+static void put_byte(struct record_writer *writer, unsigned char byte)
+{
+	reserve(writer, 1);
+	writer->buf[writer->len++] = byte;
+}
+
+static void put_varint(struct record_writer *writer, unsigned long long value)
+{
+	reserve(writer, 10);
+
+	while (value >= 0x80)
+	{
+		writer->buf[writer->len++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+
+	writer->buf[writer->len++] = value;
+}
+
+static void put_bytes(struct record_writer *writer, const void *data, size_t size)
+{
+	reserve(writer, size);
+	memcpy(writer->buf + writer->len, data, size);
+	writer->len += size;
+}
+
+static void insert_string(struct record_writer *writer, unsigned long hash, size_t id, char *str)
+{
+	size_t mask = writer->strings_capacity - 1;
+	size_t i = hash & mask;
+
+	while (writer->strings[i].str)
+	{
+		i = (i + 1) & mask;
+	}
+
+	writer->strings[i].hash = hash;
+	writer->strings[i].id = id;
+	writer->strings[i].str = str;
+}
+
+/* Get the id of str, emitting a definition record if it is new. */
+static size_t intern_string(struct record_writer *writer, const char *str)
+{
+	unsigned long hash = hash_fnv1a(str, HASH_FNV1A_SEED);
+	size_t mask = writer->strings_capacity - 1;
+	size_t len;
+
+	for (size_t i = hash & mask; writer->strings_capacity && writer->strings[i].str; i = (i + 1) & mask)
+	{
+		if (writer->strings[i].hash == hash && strcmp(writer->strings[i].str, str) == 0)
+		{
+			return writer->strings[i].id;
+		}
+	}
+
+	if ((writer->nstrings + 1) * 2 > writer->strings_capacity)
+	{
+		struct record_string *old = writer->strings;
+		size_t oldcapacity = writer->strings_capacity;
+
+		writer->strings_capacity = oldcapacity ? oldcapacity * 2 : 1024;
+		writer->strings = xcalloc(writer->strings_capacity, sizeof(*writer->strings));
+
+		for (size_t i = 0; i < oldcapacity; ++i)
+		{
+			if (old[i].str)
+			{
+				insert_string(writer, old[i].hash, old[i].id, old[i].str);
+			}
+		}
+
+		xfree(old);
+	}
+
+	insert_string(writer, hash, writer->nstrings, strdup(str));
+
+	len = strlen(str);
+	put_byte(writer, RECORD_STRING);
+	put_varint(writer, len);
+	put_bytes(writer, str, len);
+
+	return writer->nstrings++;
+}
+
+static size_t *intern_string_list(struct record_writer *writer, char **list, size_t *count)
+{
+	size_t *ids;
+
+	*count = 0;
+	for (char **ptr = list; ptr && *ptr; ++ptr)
+	{
+		(*count)++;
+	}
+
+	ids = xmalloc(sizeof(*ids) * (*count + 1));
+
+	for (size_t i = 0; i < *count; ++i)
+	{
+		ids[i] = intern_string(writer, list[i]);
+	}
+
+	return ids;
+}
+
+static void put_string_list(struct record_writer *writer, char **list, size_t *ids, size_t count)
+{
+	/* Zero encodes a NULL list. */
+	put_varint(writer, list ? count + 1 : 0);
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		put_varint(writer, ids[i]);
+	}
+}
+
+static int flush_block(struct record_writer *writer)
+{
+	unsigned char header[RECORD_BLOCK_HEADER_SIZE];
+
+	if (writer->nevents == 0)
+	{
+		return 0;
+	}
+
+	put_u32(header, writer->len);
+	put_u32(header + 4, writer->nevents);
+
+	if (write_all(writer->fd, header, sizeof(header)) < 0
+	    || write_all(writer->fd, writer->buf, writer->len) < 0)
+	{
+		return -1;
+	}
+
+	writer->blocks = xrealloc(writer->blocks, sizeof(*writer->blocks) * (writer->nblocks + 1));
+	writer->blocks[writer->nblocks].offset = writer->offset;
+	writer->blocks[writer->nblocks].nevents = writer->nevents;
+	writer->nblocks++;
+
+	writer->offset += sizeof(header) + writer->len;
+	writer->len = 0;
+	writer->nevents = 0;
+
+	return 0;
+}
+
+int record_open(struct record_writer *writer, const char *path)
+{
+	memset(writer, 0, sizeof(*writer));
+
+	writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	if (writer->fd < 0)
+	{
+		return -1;
+	}
+
+	if (write_all(writer->fd, RECORD_MAGIC, RECORD_MAGIC_SIZE) < 0)
+	{
+		close(writer->fd);
+		return -1;
+	}
+
+	writer->offset = RECORD_MAGIC_SIZE;
+
+	return 0;
+}
+
+void record_write(struct record_writer *writer, struct event *event)
+{
+	size_t *argv_ids = NULL, *envp_ids = NULL;
+	size_t argc = 0, envc = 0;
+	size_t cwd_id = 0;
+	size_t path_id = 0;
+	long long delta;
+
+	/* String definitions have to precede the event that uses them. */
+	switch (event->type)
+	{
+	case EVENT_EXEC:
+		argv_ids = intern_string_list(writer, event->argv, &argc);
+		envp_ids = intern_string_list(writer, event->envp, &envc);
+		break;
+
+	case EVENT_CHDIR:
+		cwd_id = event->cwd ? intern_string(writer, event->cwd) + 1 : 0;
+		break;
+
+	case EVENT_FILE:
+		path_id = event->path ? intern_string(writer, event->path) + 1 : 0;
+		break;
+
+	default:
+		break;
+	}
+
+	delta = (long long) (event->time - writer->last_time);
+	writer->last_time = event->time;
+
+	put_byte(writer, RECORD_SPAWN + event->type);
+	put_varint(writer, event->tid);
+	put_varint(writer, ((unsigned long long) delta << 1) ^ (unsigned long long) (delta >> 63));
+
+	switch (event->type)
+	{
+	case EVENT_SPAWN:
+		put_varint(writer, event->parent);
+		put_byte(writer, event->is_a_thread);
+		break;
+
+	case EVENT_EXEC:
+		put_string_list(writer, event->argv, argv_ids, argc);
+		put_string_list(writer, event->envp, envp_ids, envc);
+		put_varint(writer, event->exec_time);
+		put_varint(writer, event->failed_execs);
+		break;
+
+	case EVENT_EXIT:
+		put_varint(writer, event->failed_execs);
+		put_byte(writer, event->has_status);
+		put_varint(writer, event->status);
+		break;
+
+	case EVENT_CHDIR:
+		put_varint(writer, cwd_id);
+		break;
+
+	case EVENT_FILE:
+		put_varint(writer, path_id);
+		put_byte(writer, event->written);
+		put_varint(writer, event->digest);
+		break;
+
+	case EVENT_SAMPLE:
+		put_varint(writer, event->cpu_us);
+		put_varint(writer, event->rss_kb);
+		break;
+
+	default:
+		break;
+	}
+
+	xfree(argv_ids);
+	xfree(envp_ids);
+
+	writer->nevents++;
+
+	if (writer->len >= RECORD_BLOCK_SIZE)
+	{
+		if (flush_block(writer) < 0)
+		{
+			fprintf(stderr, "Failed to write capture: %s\n", strerror(errno));
+		}
+	}
+}
+
+int record_flush(struct record_writer *writer)
+{
+	return flush_block(writer);
+}
+
+int record_close(struct record_writer *writer)
+{
+	unsigned char marker[RECORD_BLOCK_HEADER_SIZE];
+	unsigned char trailer[RECORD_TRAILER_SIZE];
+	off_t index_offset, previous = 0;
+	int result = 0;
+
+	if (flush_block(writer) < 0)
+	{
+		result = -1;
+		goto done;
+	}
+
+	index_offset = writer->offset;
+
+	put_u32(marker, RECORD_INDEX_MARKER);
+	put_u32(marker + 4, writer->nblocks);
+
+	for (size_t i = 0; i < writer->nblocks; ++i)
+	{
+		put_varint(writer, writer->blocks[i].offset - previous);
+		put_varint(writer, writer->blocks[i].nevents);
+		previous = writer->blocks[i].offset;
+	}
+
+	put_u32(trailer, index_offset);
+	put_u32(trailer + 4, (unsigned long long) index_offset >> 32);
+	memcpy(trailer + 8, RECORD_INDEX_MAGIC, 8);
+
+	if (write_all(writer->fd, marker, sizeof(marker)) < 0
+	    || write_all(writer->fd, writer->buf, writer->len) < 0
+	    || write_all(writer->fd, trailer, sizeof(trailer)) < 0)
+	{
+		result = -1;
+	}
+
+done:
+	if (close(writer->fd) < 0)
+	{
+		result = -1;
+	}
+
+	for (size_t i = 0; i < writer->strings_capacity; ++i)
+	{
+		xfree(writer->strings[i].str);
+	}
+
+	xfree(writer->strings);
+	xfree(writer->blocks);
+	xfree(writer->buf);
+
+	return result;
+}
+
+/*
+ * State of reading a capture.
+ */
+struct reader
+{
+	/* String table, pointing into the mapped file. */
+	struct
+	{
+		const unsigned char *data;
+		size_t len;
+	} *strings;
+	size_t nstrings;
+	size_t strings_capacity;
+
+	timestamp_t last_time;
+};
+
+struct cursor
+{
+	const unsigned char *ptr;
+	const unsigned char *end;
+	bool error;
+};
+
+static unsigned long long get_varint(struct cursor *cursor)
+{
+	unsigned long long value = 0;
+
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		if (cursor->ptr >= cursor->end)
+		{
+			break;
+		}
+
+		unsigned char byte = *cursor->ptr++;
+		value |= (unsigned long long) (byte & 0x7f) << shift;
+
+		if (!(byte & 0x80))
+		{
+			return value;
+		}
+	}
+
+	cursor->error = true;
+	return 0;
+}
+
+static unsigned char get_byte(struct cursor *cursor)
+{
+	if (cursor->ptr >= cursor->end)
+	{
+		cursor->error = true;
+		return 0;
+	}
+
+	return *cursor->ptr++;
+}
+
+static char *get_string(struct reader *reader, struct cursor *cursor, size_t id)
+{
+	if (id >= reader->nstrings)
+	{
+		cursor->error = true;
+		return NULL;
+	}
+
+	return strndup((const char *) reader->strings[id].data, reader->strings[id].len);
+}
+
+static char **get_string_list(struct reader *reader, struct cursor *cursor)
+{
+	size_t count = get_varint(cursor);
+	char **list;
+
+	if (count == 0 || cursor->error)
+	{
+		return NULL;
+	}
+
+	count--;
+
+	/* Every entry takes at least one byte. */
+	if (count > (size_t) (cursor->end - cursor->ptr))
+	{
+		cursor->error = true;
+		return NULL;
+	}
+
+	list = xcalloc(count + 1, sizeof(*list));
+
+	for (size_t i = 0; i < count && !cursor->error; ++i)
+	{
+		list[i] = get_string(reader, cursor, get_varint(cursor));
+	}
+
+	return list;
+}
+
+static int replay_block(struct reader *reader, struct cursor *cursor,
+                        void (*fn)(struct event *event, void *data), void *data)
+{
+	while (cursor->ptr < cursor->end && !cursor->error)
+	{
+		unsigned char type = get_byte(cursor);
+
+		if (type == RECORD_STRING)
+		{
+			size_t len = get_varint(cursor);
+
+			if (cursor->error || len > (size_t) (cursor->end - cursor->ptr))
+			{
+				cursor->error = true;
+				break;
+			}
+
+			if (reader->nstrings == reader->strings_capacity)
+			{
+				reader->strings_capacity = reader->strings_capacity ? reader->strings_capacity * 2 : 1024;
+				reader->strings = xrealloc(reader->strings, sizeof(*reader->strings) * reader->strings_capacity);
+			}
+
+			reader->strings[reader->nstrings].data = cursor->ptr;
+			reader->strings[reader->nstrings].len = len;
+			reader->nstrings++;
+
+			cursor->ptr += len;
+			continue;
+		}
+
+		if (type < RECORD_SPAWN || type > RECORD_SAMPLE)
+		{
+			cursor->error = true;
+			break;
+		}
+
+		struct event event = {0};
+		unsigned long long zigzag;
+		size_t cwd_id, path_id;
+
+		event.type = type - RECORD_SPAWN;
+		event.tid = get_varint(cursor);
+
+		zigzag = get_varint(cursor);
+		reader->last_time += (timestamp_t) ((zigzag >> 1) ^ -(zigzag & 1));
+		event.time = reader->last_time;
+
+		switch (event.type)
+		{
+		case EVENT_SPAWN:
+			event.parent = get_varint(cursor);
+			event.is_a_thread = get_byte(cursor);
+			break;
+
+		case EVENT_EXEC:
+			event.argv = get_string_list(reader, cursor);
+			event.envp = get_string_list(reader, cursor);
+			event.exec_time = get_varint(cursor);
+			event.failed_execs = get_varint(cursor);
+			break;
+
+		case EVENT_EXIT:
+			event.failed_execs = get_varint(cursor);
+			event.has_status = get_byte(cursor);
+			event.status = get_varint(cursor);
+			break;
+
+		case EVENT_CHDIR:
+			cwd_id = get_varint(cursor);
+			event.cwd = cwd_id ? get_string(reader, cursor, cwd_id - 1) : NULL;
+			break;
+
+		case EVENT_FILE:
+			path_id = get_varint(cursor);
+			event.path = path_id ? get_string(reader, cursor, path_id - 1) : NULL;
+			event.written = get_byte(cursor);
+			event.digest = get_varint(cursor);
+			break;
+
+		case EVENT_SAMPLE:
+			event.cpu_us = get_varint(cursor);
+			event.rss_kb = get_varint(cursor);
+			break;
+
+		default:
+			break;
+		}
+
+		if (cursor->error)
+		{
+			event_free_data(&event);
+			break;
+		}
+
+		fn(&event, data);
+	}
+
+	return cursor->error ? -1 : 0;
+}
+
+/* Read the block index, returns the number of blocks or -1 if there is no valid index. */
+static long read_index(const unsigned char *map, size_t size, off_t **offsets)
+{
+	struct cursor cursor;
+	unsigned long long index_offset;
+	size_t nblocks;
+	off_t offset = 0;
+
+	if (size < RECORD_MAGIC_SIZE + RECORD_BLOCK_HEADER_SIZE + RECORD_TRAILER_SIZE)
+	{
+		return -1;
+	}
+
+	const unsigned char *trailer = map + size - RECORD_TRAILER_SIZE;
+
+	if (memcmp(trailer + 8, RECORD_INDEX_MAGIC, 8) != 0)
+	{
+		return -1;
+	}
+
+	index_offset = get_u32(trailer) | (unsigned long long) get_u32(trailer + 4) << 32;
+
+	if (index_offset < RECORD_MAGIC_SIZE || index_offset > size - RECORD_TRAILER_SIZE - RECORD_BLOCK_HEADER_SIZE
+	    || get_u32(map + index_offset) != RECORD_INDEX_MARKER)
+	{
+		return -1;
+	}
+
+	nblocks = get_u32(map + index_offset + 4);
+	cursor.ptr = map + index_offset + RECORD_BLOCK_HEADER_SIZE;
+	cursor.end = trailer;
+	cursor.error = false;
+
+	if (nblocks > (size_t) (cursor.end - cursor.ptr))
+	{
+		return -1;
+	}
+
+	*offsets = xmalloc(sizeof(**offsets) * (nblocks + 1));
+
+	for (size_t i = 0; i < nblocks; ++i)
+	{
+		offset += get_varint(&cursor);
+		(void) get_varint(&cursor);
+
+		if (cursor.error || offset < RECORD_MAGIC_SIZE || (size_t) offset >= index_offset)
+		{
+			xfree(*offsets);
+			return -1;
+		}
+
+		(*offsets)[i] = offset;
+	}
+
+	return nblocks;
+}
+
+/* Free a capture that was mapped, or else decompressed into memory. */
+static void release(unsigned char *map, size_t size, bool mapped)
+{
+	if (mapped)
+	{
+		munmap(map, size);
+	}
+	else
+	{
+		xfree(map);
+	}
+}
+
+int record_replay(const char *path, void (*fn)(struct event *event, void *data), void *data)
+{
+	struct reader reader = {0};
+	struct stat st;
+	unsigned char *map;
+	size_t size;
+	off_t *offsets = NULL;
+	long nblocks;
+	off_t offset;
+	bool mapped = false;
+	int result = 0;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0 || fstat(fd, &st) < 0)
+	{
+		fprintf(stderr, "Failed to open capture %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (st.st_size < RECORD_MAGIC_SIZE)
+	{
+		fprintf(stderr, "%s is not a capture file\n", path);
+		close(fd);
+		return -1;
+	}
+
+	size = st.st_size;
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	if (map == MAP_FAILED)
+	{
+		fprintf(stderr, "Failed to map capture %s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	/* Compressed captures are decompressed into memory as a whole. */
+	if (compress_detect(map, size))
+	{
+		munmap(map, size);
+		map = compress_read_all(fd, &size);
+
+		if (map == NULL)
+		{
+			fprintf(stderr, "Failed to decompress capture %s: %s\n", path, strerror(errno));
+			close(fd);
+			return -1;
+		}
+	}
+	else
+	{
+		(void) madvise(map, size, MADV_SEQUENTIAL);
+		mapped = true;
+	}
+
+	close(fd);
+
+	if (size < RECORD_MAGIC_SIZE || memcmp(map, RECORD_MAGIC, RECORD_MAGIC_SIZE) != 0)
+	{
+		fprintf(stderr, "%s is not a capture file\n", path);
+		release(map, size, mapped);
+		return -1;
+	}
+
+	nblocks = read_index(map, size, &offsets);
+	offset = RECORD_MAGIC_SIZE;
+
+	for (long i = 0; nblocks < 0 || i < nblocks; ++i)
+	{
+		struct cursor cursor;
+		size_t len;
+
+		if (nblocks >= 0)
+		{
+			offset = offsets[i];
+		}
+
+		/* Without an index, the capture ends at the first incomplete block. */
+		if (offset + RECORD_BLOCK_HEADER_SIZE > size)
+		{
+			break;
+		}
+
+		len = get_u32(map + offset);
+
+		if (len == RECORD_INDEX_MARKER || offset + RECORD_BLOCK_HEADER_SIZE + len > size)
+		{
+			break;
+		}
+
+		cursor.ptr = map + offset + RECORD_BLOCK_HEADER_SIZE;
+		cursor.end = cursor.ptr + len;
+		cursor.error = false;
+
+		if (replay_block(&reader, &cursor, fn, data) < 0)
+		{
+			fprintf(stderr, "Corrupt block at offset %lld in capture %s\n", (long long) offset, path);
+			result = -1;
+			break;
+		}
+
+		offset += RECORD_BLOCK_HEADER_SIZE + len;
+	}
+
+	xfree(offsets);
+	xfree(reader.strings);
+	release(map, size, mapped);
+
+	return result;
+}
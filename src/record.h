@@ -0,0 +1,93 @@
+#ifndef RECORD_H_INCLUDED
+#define RECORD_H_INCLUDED
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "event.h"
+
+/*
+ * Writer for the binary capture format (.ptb).
+ *
+ * A capture is an append-only log of events. The file starts with a
+ * magic header, followed by blocks of encoded records, each block
+ * prefixed with its size and number of events. Tids and timestamps are
+ * varint encoded, timestamps as the difference to the previous event.
+ * Strings are interned: the first use of a string emits a definition
+ * record, and every later use refers to it by index. When the capture
+ * is closed, an index of all blocks and a trailer pointing to it is
+ * appended. A capture without an index, for example after a crash,
+ * is still readable by scanning the blocks.
+ */
+struct record_writer
+{
+	/* Output file descriptor. */
+	int fd;
+
+	/* Encoded records of the current block. */
+	unsigned char *buf;
+	size_t len;
+	size_t capacity;
+
+	/* Number of events in the current block. */
+	size_t nevents;
+
+	/* File offset where the current block will be written. */
+	off_t offset;
+
+	/* Offset and number of events of every written block. */
+	struct record_block
+	{
+		off_t offset;
+		size_t nevents;
+	} *blocks;
+	size_t nblocks;
+
+	/* Timestamp of the previous event. */
+	timestamp_t last_time;
+
+	/* Interned strings, using open addressing on the string hash. */
+	struct record_string
+	{
+		unsigned long hash;
+		size_t id;
+		char *str;
+	} *strings;
+	size_t nstrings;
+	size_t strings_capacity;
+};
+
+/*
+ * Create the capture file at path and write the header.
+ * Returns 0 on success and -1 on failure, errno is set by the
+ * corresponding libc call.
+ */
+int record_open(struct record_writer *writer, const char *path);
+
+/*
+ * Append an event to the capture. The event is not modified.
+ */
+void record_write(struct record_writer *writer, struct event *event);
+
+/*
+ * Write the events appended so far to the file as a block.
+ * Returns 0 on success and -1 on failure, errno is set by the
+ * corresponding libc call.
+ */
+int record_flush(struct record_writer *writer);
+
+/*
+ * Flush the last block, write the index and close the file.
+ * Returns 0 on success and -1 on failure, errno is set by the
+ * corresponding libc call.
+ */
+int record_close(struct record_writer *writer);
+
+/*
+ * Read the capture at path and call fn with every event in order.
+ * fn takes ownership of the strings in the event.
+ * Returns 0 on success and -1 on failure, printing a diagnostic.
+ */
+int record_replay(const char *path, void (*fn)(struct event *event, void *data), void *data);
+
+#endif
@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/resource.h>
+
+#include <linux/limits.h>
+
+#include "sampler.h"
+#include "xmalloc.h"
+
+static int open_proc_file(long tid, const char *name)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "/proc/%ld/%s", tid, name);
+	return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+/* Read a file from /proc, through fd if it is open. Returns the length read or -1. */
+static ssize_t read_proc_file(long tid, int fd, const char *name, char *buf, size_t size)
+{
+	ssize_t len;
+
+	if (fd >= 0)
+	{
+		len = pread(fd, buf, size - 1, 0);
+	}
+	else
+	{
+		if ((fd = open_proc_file(tid, name)) < 0)
+		{
+			return -1;
+		}
+
+		len = read(fd, buf, size - 1);
+		close(fd);
+	}
+
+	if (len >= 0)
+	{
+		buf[len] = 0;
+	}
+
+	return len;
+}
+
+void sampler_init(struct sampler *sampler)
+{
+	memset(sampler, 0, sizeof(*sampler));
+	sampler->ticks_per_sec = sysconf(_SC_CLK_TCK);
+	sampler->page_size = sysconf(_SC_PAGESIZE);
+}
+
+void sampler_raise_limit(void)
+{
+	struct rlimit limit;
+
+	/* Two files stay open for every process, processes that don't fit are
+	   sampled by opening their files every time. */
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		(void) setrlimit(RLIMIT_NOFILE, &limit);
+	}
+}
+
+void sampler_add(struct sampler *sampler, long tid)
+{
+	struct sampler_entry *entry;
+
+	if (tidmap_get(&sampler->index, tid))
+	{
+		return;
+	}
+
+	if (sampler->count == sampler->capacity)
+	{
+		sampler->capacity = sampler->capacity ? sampler->capacity * 2 : 64;
+		sampler->entries = xrealloc(sampler->entries, sampler->capacity * sizeof(*sampler->entries));
+	}
+
+	entry = &sampler->entries[sampler->count++];
+	entry->tid = tid;
+	entry->stat_fd = open_proc_file(tid, "stat");
+	entry->statm_fd = open_proc_file(tid, "statm");
+	entry->ticks = 0;
+
+	tidmap_put(&sampler->index, tid, (void *) sampler->count);
+}
+
+static void close_entry(struct sampler_entry *entry)
+{
+	if (entry->stat_fd >= 0)
+	{
+		close(entry->stat_fd);
+	}
+
+	if (entry->statm_fd >= 0)
+	{
+		close(entry->statm_fd);
+	}
+}
+
+void sampler_remove(struct sampler *sampler, long tid)
+{
+	size_t index = (size_t) tidmap_remove(&sampler->index, tid);
+	struct sampler_entry *last;
+
+	if (index == 0)
+	{
+		return;
+	}
+
+	close_entry(&sampler->entries[index - 1]);
+
+	/* Move the last entry into the gap. */
+	last = &sampler->entries[--sampler->count];
+
+	if (last != &sampler->entries[index - 1])
+	{
+		sampler->entries[index - 1] = *last;
+		tidmap_put(&sampler->index, last->tid, (void *) index);
+	}
+}
+
+/* CPU time of the process in clock ticks, from the utime and stime fields of stat. */
+static int parse_ticks(const char *stat, unsigned long long *ticks)
+{
+	unsigned long long utime, stime;
+
+	/* The command name may contain any character, the fields follow it. */
+	const char *end = strrchr(stat, ')');
+
+	if (end == NULL || sscanf(end + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+	                          &utime, &stime) != 2)
+	{
+		return -1;
+	}
+
+	*ticks = utime + stime;
+	return 0;
+}
+
+void sampler_sample(struct sampler *sampler, void (*emit)(struct event *event, void *data), void *data)
+{
+	timestamp_t time = timestamp_now();
+	char buf[1024];
+
+	for (size_t i = 0; i < sampler->count; ++i)
+	{
+		struct sampler_entry *entry = &sampler->entries[i];
+		struct event sample = { .type = EVENT_SAMPLE, .tid = entry->tid, .time = time };
+		unsigned long long ticks, resident;
+
+		if (read_proc_file(entry->tid, entry->stat_fd, "stat", buf, sizeof(buf)) <= 0
+		 || parse_ticks(buf, &ticks) < 0)
+		{
+			continue;
+		}
+
+		if (read_proc_file(entry->tid, entry->statm_fd, "statm", buf, sizeof(buf)) <= 0
+		 || sscanf(buf, "%*u %llu", &resident) != 1)
+		{
+			continue;
+		}
+
+		sample.cpu_us = (ticks - entry->ticks) * 1000000ull / sampler->ticks_per_sec;
+		sample.rss_kb = resident * sampler->page_size / 1024;
+		entry->ticks = ticks;
+
+		emit(&sample, data);
+	}
+}
+
+void sampler_clear(struct sampler *sampler)
+{
+	for (size_t i = 0; i < sampler->count; ++i)
+	{
+		close_entry(&sampler->entries[i]);
+	}
+
+	xfree(sampler->entries);
+	tidmap_clear(&sampler->index);
+	memset(sampler, 0, sizeof(*sampler));
+}
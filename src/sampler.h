@@ -0,0 +1,72 @@
+#ifndef SAMPLER_H_INCLUDED
+#define SAMPLER_H_INCLUDED
+
+#include <stddef.h>
+
+#include "tidmap.h"
+#include "event.h"
+#include "timestamp.h"
+
+/*
+ * Samples CPU time and resident memory of running processes from /proc.
+ * Processes are kept in a dense list, so that sampling reads each one
+ * without walking the tree, and the files of each one stay open so that
+ * a sample costs one read of each.
+ */
+struct sampler
+{
+	/* Sampled processes, in no particular order. */
+	struct sampler_entry
+	{
+		long tid;
+
+		/* /proc/<tid>/stat and /proc/<tid>/statm, or -1 if they couldn't be opened. */
+		int stat_fd;
+		int statm_fd;
+
+		/* CPU time in clock ticks at the previous sample. */
+		unsigned long long ticks;
+	} *entries;
+	size_t count;
+	size_t capacity;
+
+	/* One more than the index of each process in entries, by tid. */
+	struct tidmap index;
+
+	long ticks_per_sec;
+	long page_size;
+};
+
+/*
+ * Initialize a sampler without any processes.
+ */
+void sampler_init(struct sampler *sampler);
+
+/*
+ * Raise the soft limit of open files to the hard limit. Called once the
+ * commands were started, so that they don't inherit it.
+ */
+void sampler_raise_limit(void);
+
+/*
+ * Start sampling process tid.
+ */
+void sampler_add(struct sampler *sampler, long tid);
+
+/*
+ * Stop sampling process tid.
+ */
+void sampler_remove(struct sampler *sampler, long tid);
+
+/*
+ * Sample all processes, calling emit with an EVENT_SAMPLE for each one
+ * that could be read.
+ */
+void sampler_sample(struct sampler *sampler, void (*emit)(struct event *event, void *data), void *data);
+
+/*
+ * Stop sampling all processes.
+ */
+void sampler_clear(struct sampler *sampler);
+
+#endif
@@ -0,0 +1,564 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+
+#include "server.h"
+#include "output.h"
+#include "options.h"
+#include "collapse.h"
+#include "xmalloc.h"
+
+/* Clients that leave more output than this unread are disconnected. */
+#define SERVER_MAX_PENDING (4 << 20)
+
+static void drop_client(struct server *server, struct server_client *client)
+{
+	struct server_client **link = &server->clients;
+
+	while (*link != client)
+	{
+		link = &(*link)->next;
+	}
+
+	*link = client->next;
+
+	if (client->streaming)
+	{
+		server->streaming--;
+	}
+
+	loop_remove_fd(server->loop, client->fd);
+	close(client->fd);
+
+	xfree(client->out);
+	xfree(client);
+}
+
+/* Write as much pending output as the socket accepts. */
+static void flush_client(struct server_client *client)
+{
+	size_t sent = 0;
+
+	while (sent < client->outlen)
+	{
+		ssize_t n = send(client->fd, client->out + sent, client->outlen - sent,
+		                 MSG_NOSIGNAL | MSG_DONTWAIT);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				client->closed = true;
+			}
+
+			break;
+		}
+
+		sent += n;
+	}
+
+	client->outlen -= sent;
+	memmove(client->out, client->out + sent, client->outlen);
+
+	bool writable = client->outlen > 0 && !client->closed;
+
+	if (writable != client->writable)
+	{
+		client->writable = writable;
+		(void) loop_set_writable(client->server->loop, client->fd, writable);
+	}
+}
+
+/* Queue a frame with the JSON document payload. */
+static void send_frame(struct server_client *client, const char *payload, size_t len)
+{
+	uint32_t header = htonl(len);
+
+	if (client->closed)
+	{
+		return;
+	}
+
+	if (client->outlen + sizeof(header) + len > SERVER_MAX_PENDING)
+	{
+		client->closed = true;
+		return;
+	}
+
+	if (client->outlen + sizeof(header) + len > client->outcap)
+	{
+		client->outcap = (client->outlen + sizeof(header) + len) * 2;
+		client->out = xrealloc(client->out, client->outcap);
+	}
+
+	memcpy(client->out + client->outlen, &header, sizeof(header));
+	memcpy(client->out + client->outlen + sizeof(header), payload, len);
+	client->outlen += sizeof(header) + len;
+
+	/* Output queued behind a full socket is written once it is writable. */
+	if (!client->writable)
+	{
+		flush_client(client);
+	}
+}
+
+static void write_string(FILE *f, const char *str)
+{
+	fputc('"', f);
+	output_json_escaped(f, str, strlen(str));
+	fputc('"', f);
+}
+
+static void write_arguments(FILE *f, char **argv)
+{
+	fprintf(f, ",\"arguments\":[");
+
+	for (char **arg = argv; *arg; ++arg)
+	{
+		if (arg != argv)
+		{
+			fputc(',', f);
+		}
+
+		write_string(f, *arg);
+	}
+
+	fprintf(f, "]");
+}
+
+static void write_live(FILE *f, struct tree *tree)
+{
+	bool first = true;
+
+	fprintf(f, "[");
+
+	for (size_t i = 0; i < tree->live.capacity; ++i)
+	{
+		struct tidmap_entry *entry = &tree->live.entries[i];
+		struct tracee *tracee = entry->value;
+
+		if (entry->tid == 0)
+		{
+			continue;
+		}
+
+		fprintf(f, "%s{\"tid\":%ld", first ? "" : ",", tracee->tid);
+		first = false;
+
+		if (tracee->generation > 0)
+		{
+			fprintf(f, ",\"generation\":%lu", tracee->generation);
+		}
+
+		if (tracee->parent && tracee->parent->tid != 0)
+		{
+			fprintf(f, ",\"parent\":%ld", tracee->parent->tid);
+		}
+
+		if (tracee->is_a_thread)
+		{
+			fprintf(f, ",\"thread\":true");
+		}
+
+		if (tracee->argv)
+		{
+			write_arguments(f, tracee->argv);
+		}
+
+		fprintf(f, "}");
+	}
+
+	fprintf(f, "]");
+}
+
+static void write_exited(FILE *f, struct tree *tree)
+{
+	size_t capacity = tree->retain ? tree->retain : tree->nfinished;
+
+	fprintf(f, "[");
+
+	for (size_t i = 0; i < tree->nfinished; ++i)
+	{
+		struct tracee *tracee = tree->finished[(tree->finished_head + i) % capacity];
+
+		fprintf(f, "%s{\"tid\":%ld", i > 0 ? "," : "", tracee->tid);
+
+		if (tracee->generation > 0)
+		{
+			fprintf(f, ",\"generation\":%lu", tracee->generation);
+		}
+
+		fprintf(f, ",\"start\":%.6f,\"end\":%.6f", timestamp_to_seconds(tracee->start_time),
+		        timestamp_to_seconds(tracee->end_time));
+
+		if (tracee->argv)
+		{
+			write_arguments(f, tracee->argv);
+		}
+
+		fprintf(f, "}");
+	}
+
+	fprintf(f, "]");
+}
+
+static void write_subtree(FILE *f, struct server *server, char *arg)
+{
+	struct tracee *tracee = server->tree->root;
+	long tid = 0;
+
+	if (arg)
+	{
+		tid = strtol(arg, NULL, 10);
+		tracee = tid > 0 ? tidmap_get(&server->tree->live, tid) : NULL;
+	}
+
+	if (tracee == NULL)
+	{
+		fprintf(f, "{\"error\":\"No running process %ld\"}", tid);
+		return;
+	}
+
+	if (server->options->collapse)
+	{
+		collapse_compute_shapes(tracee, server->options);
+	}
+
+	get_output_fn("json")(f, tracee, server->options);
+}
+
+static void write_stats(FILE *f, struct tree *tree)
+{
+	struct tree_stats *stats = &tree->stats;
+
+	fprintf(f, "{\"live\":%zu,\"processes\":%zu,\"threads\":%zu,\"execs\":%zu,\"exited\":%zu}",
+	        tree->live.count, stats->processes, stats->threads, stats->execs, stats->exited);
+}
+
+static void handle_request(struct server_client *client, char *line)
+{
+	struct server *server = client->server;
+	char *request = strtok(line, " \t\r");
+	char *arg = strtok(NULL, " \t\r");
+	char *payload = NULL;
+	size_t len = 0;
+	FILE *f;
+
+	if (request == NULL)
+	{
+		return;
+	}
+
+	if (strcmp(request, "events") == 0)
+	{
+		if (!client->streaming)
+		{
+			client->streaming = true;
+			server->streaming++;
+		}
+
+		return;
+	}
+
+	f = open_memstream(&payload, &len);
+	if (f == NULL)
+	{
+		client->closed = true;
+		return;
+	}
+
+	if (strcmp(request, "live") == 0)
+	{
+		write_live(f, server->tree);
+	}
+	else if (strcmp(request, "exited") == 0)
+	{
+		write_exited(f, server->tree);
+	}
+	else if (strcmp(request, "subtree") == 0)
+	{
+		write_subtree(f, server, arg);
+	}
+	else if (strcmp(request, "stats") == 0)
+	{
+		write_stats(f, server->tree);
+	}
+	else
+	{
+		fprintf(f, "{\"error\":\"Invalid request '");
+		output_json_escaped(f, request, strlen(request));
+		fprintf(f, "'\"}");
+	}
+
+	fclose(f);
+
+	send_frame(client, payload, len);
+	xfree(payload);
+}
+
+static void read_requests(struct server_client *client)
+{
+	ssize_t n = read(client->fd, client->in + client->inlen, sizeof(client->in) - client->inlen);
+
+	if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+	{
+		return;
+	}
+
+	if (n <= 0)
+	{
+		client->closed = true;
+		return;
+	}
+
+	client->inlen += n;
+
+	char *line = client->in;
+	char *newline;
+
+	while ((newline = memchr(line, '\n', client->in + client->inlen - line)))
+	{
+		*newline = 0;
+		handle_request(client, line);
+		line = newline + 1;
+	}
+
+	client->inlen -= line - client->in;
+	memmove(client->in, line, client->inlen);
+
+	/* No valid request is this long. */
+	if (client->inlen == sizeof(client->in))
+	{
+		client->closed = true;
+	}
+}
+
+static void handle_client(long events, void *data)
+{
+	struct server_client *client = data;
+
+	if (events & EPOLLOUT)
+	{
+		flush_client(client);
+	}
+
+	if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+	{
+		read_requests(client);
+	}
+
+	if (client->closed)
+	{
+		drop_client(client->server, client);
+	}
+}
+
+static void handle_listen(long events, void *data)
+{
+	struct server *server = data;
+	int fd;
+
+	while ((fd = accept(server->fd, NULL, NULL)) >= 0)
+	{
+		struct server_client *client = xcalloc(1, sizeof(*client));
+
+		client->fd = fd;
+		client->server = server;
+
+		if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0
+		 || fcntl(fd, F_SETFD, FD_CLOEXEC) < 0
+		 || loop_add_fd(server->loop, fd, handle_client, client) < 0)
+		{
+			close(fd);
+			xfree(client);
+			continue;
+		}
+
+		client->next = server->clients;
+		server->clients = client;
+	}
+}
+
+int server_open(struct server *server, const char *path, struct loop *loop,
+                struct tree *tree, struct options *options)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	memset(server, 0, sizeof(*server));
+	server->fd = -1;
+	server->loop = loop;
+	server->tree = tree;
+	server->options = options;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	strcpy(addr.sun_path, path);
+
+	server->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (server->fd < 0)
+	{
+		return -1;
+	}
+
+	if (bind(server->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+	{
+		int saved = errno;
+		close(server->fd);
+		server->fd = -1;
+		errno = saved;
+		return -1;
+	}
+
+	server->path = strdup(path);
+
+	if (listen(server->fd, SOMAXCONN) < 0 || loop_add_fd(loop, server->fd, handle_listen, server) < 0)
+	{
+		int saved = errno;
+		server_close(server);
+		errno = saved;
+		return -1;
+	}
+
+	return 0;
+}
+
+void server_publish(struct server *server, struct event *event)
+{
+	static const char *types[] = {
+		[EVENT_SPAWN] = "spawn",
+		[EVENT_EXEC] = "exec",
+		[EVENT_CHDIR] = "chdir",
+		[EVENT_EXIT] = "exit",
+		[EVENT_FILE] = "file",
+		[EVENT_SAMPLE] = "sample",
+	};
+
+	struct server_client *client, *next;
+	char *payload = NULL;
+	size_t len = 0;
+	FILE *f;
+
+	if (server->streaming == 0)
+	{
+		return;
+	}
+
+	f = open_memstream(&payload, &len);
+	if (f == NULL)
+	{
+		return;
+	}
+
+	fprintf(f, "{\"type\":\"%s\",\"tid\":%ld,\"time\":%.6f",
+	        types[event->type], event->tid, timestamp_to_seconds(event->time));
+
+	if (event->type == EVENT_SPAWN && event->parent)
+	{
+		fprintf(f, ",\"parent\":%ld", event->parent);
+	}
+
+	if (event->is_a_thread)
+	{
+		fprintf(f, ",\"thread\":true");
+	}
+
+	if (event->argv)
+	{
+		write_arguments(f, event->argv);
+	}
+
+	if (event->has_status)
+	{
+		fprintf(f, ",\"status\":%d", event->status);
+	}
+
+	if (event->failed_execs)
+	{
+		fprintf(f, ",\"failed_execs\":%lu", event->failed_execs);
+	}
+
+	if (event->exec_time)
+	{
+		fprintf(f, ",\"exec_time\":%.6f", timestamp_to_seconds(event->exec_time));
+	}
+
+	if (event->cwd)
+	{
+		fprintf(f, ",\"directory\":");
+		write_string(f, event->cwd);
+	}
+
+	if (event->path)
+	{
+		fprintf(f, ",\"path\":");
+		write_string(f, event->path);
+		fprintf(f, ",\"written\":%s", event->written ? "true" : "false");
+	}
+
+	if (event->type == EVENT_SAMPLE)
+	{
+		fprintf(f, ",\"cpu_us\":%lu,\"rss_kb\":%lu", event->cpu_us, event->rss_kb);
+	}
+
+	fprintf(f, "}");
+	fclose(f);
+
+	for (client = server->clients; client; client = next)
+	{
+		next = client->next;
+
+		if (!client->streaming)
+		{
+			continue;
+		}
+
+		send_frame(client, payload, len);
+
+		if (client->closed)
+		{
+			drop_client(server, client);
+		}
+	}
+
+	xfree(payload);
+}
+
+void server_close(struct server *server)
+{
+	while (server->clients)
+	{
+		drop_client(server, server->clients);
+	}
+
+	if (server->fd >= 0)
+	{
+		loop_remove_fd(server->loop, server->fd);
+		close(server->fd);
+		server->fd = -1;
+	}
+
+	if (server->path)
+	{
+		unlink(server->path);
+		xfree(server->path);
+		server->path = NULL;
+	}
+}
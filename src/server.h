@@ -0,0 +1,86 @@
+#ifndef SERVER_H_INCLUDED
+#define SERVER_H_INCLUDED
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "loop.h"
+#include "tree.h"
+#include "event.h"
+
+struct options;
+
+/*
+ * Answers queries about the live tree on a Unix socket.
+ *
+ * Requests are lines of text:
+ *   * live           Running tracees, without their children.
+ *   * subtree [tid]  A running tracee with its children, or the root.
+ *   * stats          Counters of the session.
+ *   * events         Stream every following event.
+ *
+ * Every response and streamed event is a JSON document, preceded by
+ * its length as a 32 bit unsigned integer in network byte order.
+ * Queries are answered from the indexes of the tree, without walking it,
+ * except for the requested subtree.
+ */
+struct server
+{
+	/* The listening socket, or -1. */
+	int fd;
+	char *path;
+
+	struct loop *loop;
+	struct tree *tree;
+	struct options *options;
+
+	/* Number of clients streaming events. */
+	size_t streaming;
+
+	struct server_client
+	{
+		int fd;
+		struct server *server;
+
+		/* The client requested the event stream. */
+		bool streaming;
+
+		/* The unfinished request line. */
+		char in[256];
+		size_t inlen;
+
+		/* Output not yet accepted by the socket. */
+		char *out;
+		size_t outlen;
+		size_t outcap;
+
+		/* Waiting for the socket to become writable. */
+		bool writable;
+
+		/* To be disconnected once its current callback returns. */
+		bool closed;
+
+		struct server_client *next;
+	} *clients;
+};
+
+/*
+ * Listen on the Unix socket path and answer queries about tree from loop.
+ * Returns 0 on success and -1 on failure, errno is set by the
+ * corresponding libc call.
+ */
+int server_open(struct server *server, const char *path, struct loop *loop,
+                struct tree *tree, struct options *options);
+
+/*
+ * Send event to clients streaming events. Must be called before the
+ * event is applied to the tree.
+ */
+void server_publish(struct server *server, struct event *event);
+
+/*
+ * Disconnect all clients and remove the socket.
+ */
+void server_close(struct server *server);
+
+#endif
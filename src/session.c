@@ -0,0 +1,349 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <err.h>
+
+#include <sys/wait.h>
+
+#include "session.h"
+#include "options.h"
+#include "worker.h"
+
+/* Interval at which recorded events are written to the capture file. */
+#define FLUSH_INTERVAL NS_PER_SEC
+
+static void emit(struct event *event, void *data)
+{
+	struct session *session = data;
+	struct session_callbacks *callbacks = &session->callbacks;
+	session_fn_t fn = NULL;
+
+	if (event->type == EVENT_SPAWN && event->parent == 0)
+	{
+		tidmap_put(&session->roots, event->tid, &session->roots);
+	}
+	else if (event->type == EVENT_EXIT && tidmap_remove(&session->roots, event->tid)
+	                                   && session->roots.count == 0)
+	{
+		session->finished = true;
+	}
+
+	/* Threads are sampled along with their process. */
+	if (session->options->sample_interval)
+	{
+		if (event->type == EVENT_SPAWN && !event->is_a_thread)
+		{
+			sampler_add(&session->sampler, event->tid);
+		}
+		else if (event->type == EVENT_EXIT)
+		{
+			sampler_remove(&session->sampler, event->tid);
+		}
+	}
+
+	switch (event->type)
+	{
+	case EVENT_SPAWN:
+		fn = callbacks->on_spawn;
+		break;
+	case EVENT_EXEC:
+		fn = callbacks->on_exec;
+		break;
+	case EVENT_CHDIR:
+		fn = callbacks->on_chdir;
+		break;
+	case EVENT_EXIT:
+		fn = callbacks->on_exit;
+		break;
+	case EVENT_FILE:
+		fn = callbacks->on_file;
+		break;
+	case EVENT_SAMPLE:
+		fn = callbacks->on_sample;
+		break;
+	}
+
+	if (fn)
+	{
+		fn(event, callbacks->data);
+	}
+
+	server_publish(&session->server, event);
+	export_apply(&session->export, event);
+
+	if (session->options->record)
+	{
+		record_write(&session->recorder, event);
+		event_free_data(event);
+		return;
+	}
+
+	tree_apply_event(&session->tree, event);
+}
+
+static void handle_tracees(struct session *session)
+{
+	long tid;
+
+	while ((tid = tracer_wait(&session->tracer, WNOHANG)) > 0);
+
+	/* A server keeps running after all tracees are gone. */
+	if (tid < 0 && errno != EINTR && !(errno == ECHILD && session->finished))
+	{
+		warn("waitpid() failed");
+		session->failed = true;
+	}
+}
+
+static void handle_signal(long sig, void *data)
+{
+	handle_tracees(data);
+}
+
+static void handle_queue(long events, void *data)
+{
+	struct session *session = data;
+
+	queue_drain(&session->queue, emit, session);
+}
+
+static void handle_connector(long events, void *data)
+{
+	struct session *session = data;
+
+	connector_read(&session->connector);
+}
+
+static void handle_flush_timer(long expirations, void *data)
+{
+	struct session *session = data;
+
+	if (record_flush(&session->recorder) < 0)
+	{
+		warn("Failed to write capture file %s", session->options->record);
+	}
+}
+
+static void handle_sample_timer(long expirations, void *data)
+{
+	struct session *session = data;
+
+	sampler_sample(&session->sampler, emit, session);
+}
+
+static int setup_loop(struct session *session)
+{
+	struct options *options = session->options;
+	sigset_t signals;
+
+	if (loop_init(&session->loop) < 0)
+	{
+		warn("Failed to create event loop");
+		return -1;
+	}
+
+	/* SIGCHLD is raised by every stop of a tracee. Worker threads wait
+	   for their own tracees, and are only reached through the queue. */
+	if (options->backend == BACKEND_CONNECTOR)
+	{
+		if (connector_open(&session->connector, options, emit, session) < 0)
+		{
+			warn("Failed to subscribe to process events");
+			return -1;
+		}
+
+		if (loop_add_fd(&session->loop, session->connector.fd, handle_connector, session) < 0)
+		{
+			warn("Failed to wait for process events");
+			return -1;
+		}
+	}
+	else if (options->backend == BACKEND_PERF)
+	{
+		if (perf_open(&session->perf, &session->loop, options, emit, session) < 0)
+		{
+			warn("Failed to record scheduler tracepoints");
+			return -1;
+		}
+	}
+	else if (options->jobs > 1)
+	{
+		if (queue_init(&session->queue) < 0)
+		{
+			warn("Failed to create eventfd");
+			return -1;
+		}
+
+		if (loop_add_fd(&session->loop, session->queue.fd, handle_queue, session) < 0)
+		{
+			warn("Failed to wait for events");
+			return -1;
+		}
+	}
+	else
+	{
+		sigemptyset(&signals);
+		sigaddset(&signals, SIGCHLD);
+
+		if (loop_add_signals(&session->loop, &signals, handle_signal, session) < 0)
+		{
+			warn("Failed to create signalfd");
+			return -1;
+		}
+	}
+
+	/* Write the events of long running sessions to disk regularly,
+	   so that little is lost if the tracer is killed. */
+	if (options->record && loop_add_timer(&session->loop, FLUSH_INTERVAL, handle_flush_timer, session) < 0)
+	{
+		warn("Failed to create timerfd");
+		return -1;
+	}
+
+	if (options->sample_interval)
+	{
+		sampler_init(&session->sampler);
+
+		if (loop_add_timer(&session->loop, options->sample_interval, handle_sample_timer, session) < 0)
+		{
+			warn("Failed to create timerfd");
+			return -1;
+		}
+	}
+
+	if (options->serve && server_open(&session->server, options->serve, &session->loop,
+	                                  &session->tree, options) < 0)
+	{
+		warn("Failed to listen on %s", options->serve);
+		return -1;
+	}
+
+	return 0;
+}
+
+int session_init(struct session *session, struct options *options,
+                 const struct session_callbacks *callbacks)
+{
+	memset(session, 0, sizeof(*session));
+
+	session->options = options;
+	session->server.fd = -1;
+	session->export.fd = -1;
+	session->recorder.fd = -1;
+	session->connector.fd = -1;
+
+	if (callbacks)
+	{
+		session->callbacks = *callbacks;
+	}
+
+	if (options->ring)
+	{
+		tree_set_retention(&session->tree, options->ring);
+	}
+
+	if (options->cache_keys)
+	{
+		tree_set_cache_keys(&session->tree, options->cache_env);
+	}
+
+	if (options->record && record_open(&session->recorder, options->record) < 0)
+	{
+		warn("Failed to open capture file %s", options->record);
+		return -1;
+	}
+
+	if (options->shm && export_open(&session->export, options->shm, options) < 0)
+	{
+		warn("Failed to create export file %s", options->shm);
+		return -1;
+	}
+
+	return setup_loop(session);
+}
+
+static int start_tracing(struct session *session)
+{
+	if (session->options->backend == BACKEND_CONNECTOR)
+	{
+		return connector_start(&session->connector);
+	}
+
+	if (session->options->backend == BACKEND_PERF)
+	{
+		return perf_start(&session->perf);
+	}
+
+	if (session->options->jobs > 1)
+	{
+		session->workers = workers_start(session->options->jobs, session->options, &session->queue);
+		return session->workers ? 0 : -1;
+	}
+
+	tracer_init(&session->tracer, session->options, emit, session);
+	return tracer_start(&session->tracer);
+}
+
+int session_start(struct session *session)
+{
+	if (start_tracing(session) < 0)
+	{
+		return -1;
+	}
+
+	if (session->options->sample_interval)
+	{
+		sampler_raise_limit();
+	}
+
+	return 0;
+}
+
+bool session_run(struct session *session, size_t iterations)
+{
+	for (size_t i = 0; iterations == 0 ? !session->finished : i < iterations; ++i)
+	{
+		if (session->failed)
+		{
+			break;
+		}
+
+		if (loop_run_once(&session->loop) < 0)
+		{
+			warn("epoll_wait() failed");
+			session->failed = true;
+		}
+	}
+
+	return !session->finished && !session->failed;
+}
+
+int session_fd(struct session *session)
+{
+	return session->loop.epfd;
+}
+
+int session_stop(struct session *session)
+{
+	if (session->workers)
+	{
+		workers_stop(session->workers);
+		session->workers = NULL;
+	}
+
+	tracer_detach_all(&session->tracer);
+	connector_close(&session->connector);
+	perf_close(&session->perf);
+	server_close(&session->server);
+	export_close(&session->export);
+	sampler_clear(&session->sampler);
+
+	if (session->options->record)
+	{
+		return record_close(&session->recorder);
+	}
+
+	return 0;
+}
@@ -0,0 +1,132 @@
+#ifndef SESSION_H_INCLUDED
+#define SESSION_H_INCLUDED
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "tidmap.h"
+#include "event.h"
+#include "tree.h"
+#include "record.h"
+#include "tracer.h"
+#include "queue.h"
+#include "loop.h"
+#include "server.h"
+#include "export.h"
+#include "connector.h"
+#include "perf.h"
+#include "sampler.h"
+
+struct options;
+struct worker;
+
+/*
+ * Called with an event before it is applied to the tree or recorded.
+ * The event and its strings are only valid during the call.
+ */
+typedef void (*session_fn_t)(struct event *event, void *data);
+
+/*
+ * Callbacks of a session, each one optional.
+ */
+struct session_callbacks
+{
+	session_fn_t on_spawn;
+	session_fn_t on_exec;
+	session_fn_t on_chdir;
+	session_fn_t on_exit;
+	session_fn_t on_file;
+	session_fn_t on_sample;
+
+	/* Passed to the callbacks. */
+	void *data;
+};
+
+/*
+ * Traces the commands and pids given in options, and builds a tree of
+ * them or records them. Only one session may run at a time, as tracing
+ * uses signals of the process.
+ *
+ * Embedding programs may wait for the session fd to become readable,
+ * and call session_run() with one iteration to handle it.
+ */
+struct session
+{
+	struct options *options;
+	struct session_callbacks callbacks;
+
+	/* Tree built from events, unless events are recorded. */
+	struct tree tree;
+	struct record_writer recorder;
+
+	/* Roots that have not exited yet. */
+	struct tidmap roots;
+
+	/* All roots have exited. */
+	bool finished;
+
+	/* Tracing failed, after printing a warning. */
+	bool failed;
+
+	/* Tracer of all tracees, unless worker threads are used. */
+	struct tracer tracer;
+
+	/* Worker threads tracing the tracees instead, with more than one job. */
+	struct worker *workers;
+
+	/* Events from worker threads. */
+	struct queue queue;
+
+	/* Follows processes instead of the tracer, with the connector backend. */
+	struct connector connector;
+
+	/* Follows processes instead of the tracer, with the perf backend. */
+	struct perf perf;
+
+	/* Running processes, sampled at the sample interval. */
+	struct sampler sampler;
+
+	struct loop loop;
+	struct server server;
+	struct export export;
+};
+
+/*
+ * Set up a session without starting to trace. Sources may be added to
+ * the loop of the session before it is started.
+ * Returns 0 on success and -1 on failure, after printing a warning.
+ */
+int session_init(struct session *session, struct options *options,
+                 const struct session_callbacks *callbacks);
+
+/*
+ * Start the commands and attach to the pids.
+ * Returns 0 on success and -1 if none of them could be traced, after
+ * printing a warning for each one.
+ */
+int session_start(struct session *session);
+
+/*
+ * Run iterations of the event loop, each one waiting for and handling at
+ * least one event, or run it until all roots have exited if iterations is
+ * zero.
+ * Returns true if the session is still running, and false once all roots
+ * have exited or tracing failed, see failed.
+ */
+bool session_run(struct session *session, size_t iterations);
+
+/*
+ * File descriptor that becomes readable when the session has events to handle.
+ */
+int session_fd(struct session *session);
+
+/*
+ * Detach from all tracees, stop the worker threads, finish the capture
+ * and close the server and export. Tracees under the file filter are
+ * killed instead, as they can't run untraced. The tree stays valid.
+ * Returns 0 on success and -1 if the capture could not be written,
+ * errno is set by the corresponding libc call.
+ */
+int session_stop(struct session *session);
+
+#endif
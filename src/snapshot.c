@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <stdbool.h>
+
+#include <linux/limits.h>
+
+#include "snapshot.h"
+#include "options.h"
+#include "collapse.h"
+
+/* Open a temporary file to be renamed to path once complete. */
+static FILE *open_temporary(const char *path, char *tmppath, size_t size)
+{
+	if (snprintf(tmppath, size, "%s.tmp", path) >= (int) size)
+	{
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+
+	return fopen(tmppath, "w");
+}
+
+/* Close a temporary file, and rename it to path unless failed. */
+static int finish_temporary(FILE *f, const char *tmppath, const char *path, bool failed)
+{
+	failed = ferror(f) || failed;
+
+	if (fclose(f) != 0 || failed)
+	{
+		int saved = errno;
+		remove(tmppath);
+		errno = saved;
+		return -1;
+	}
+
+	return rename(tmppath, path);
+}
+
+int snapshot_write(struct tracee *root, output_fn_t fn, struct options *options, char *path, size_t size)
+{
+	char stamp[32];
+	char tmppath[PATH_MAX];
+	char envpath[PATH_MAX];
+	char envtmppath[PATH_MAX];
+	FILE *env_table = options->env_table;
+	FILE *envf = NULL;
+	struct timespec now;
+	struct tm tm;
+	FILE *f;
+	int result;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	localtime_r(&now.tv_sec, &tm);
+	strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%S", &tm);
+
+	int len = snprintf(path, size, "%s/%s-%s.%03ld.%s",
+	                   options->snapshot_dir, options->program_name,
+	                   stamp, now.tv_nsec / 1000000, get_output_format_name(fn));
+
+	if (len < 0 || (size_t) len >= size)
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	/* Environment ids restart with every table, so each snapshot has an
+	   environment table of its own rather than appending to the one of -N. */
+	if (env_table && !options->exclude_environ && fn == get_output_fn("table"))
+	{
+		len = snprintf(envpath, sizeof(envpath), "%s/%s-%s.%03ld.env.%s",
+		               options->snapshot_dir, options->program_name,
+		               stamp, now.tv_nsec / 1000000, get_output_format_name(fn));
+
+		if (len < 0 || (size_t) len >= sizeof(envpath))
+		{
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+
+		if ((envf = open_temporary(envpath, envtmppath, sizeof(envtmppath))) == NULL)
+		{
+			snprintf(path, size, "%s", envpath);
+			return -1;
+		}
+	}
+
+	if ((f = open_temporary(path, tmppath, sizeof(tmppath))) == NULL)
+	{
+		if (envf)
+		{
+			int saved = errno;
+			fclose(envf);
+			remove(envtmppath);
+			errno = saved;
+		}
+
+		return -1;
+	}
+
+	if (options->collapse)
+	{
+		collapse_compute_shapes(root, options);
+	}
+
+	options->env_table = envf;
+	output_sections(f, root, fn, options);
+	options->env_table = env_table;
+
+	if (envf && finish_temporary(envf, envtmppath, envpath, false) < 0)
+	{
+		int saved = errno;
+		finish_temporary(f, tmppath, path, true);
+		snprintf(path, size, "%s", envpath);
+		errno = saved;
+		return -1;
+	}
+
+	result = finish_temporary(f, tmppath, path, false);
+
+	if (result < 0 && envf)
+	{
+		int saved = errno;
+		remove(envpath);
+		errno = saved;
+	}
+
+	return result;
+}
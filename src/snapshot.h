@@ -0,0 +1,26 @@
+#ifndef SNAPSHOT_H_INCLUDED
+#define SNAPSHOT_H_INCLUDED
+
+#include <stddef.h>
+
+#include "tracee.h"
+#include "output.h"
+
+struct options;
+
+/*
+ * Write the tree at root with fn to a new file in the snapshot directory,
+ * named after the program, the current time and the format, for example
+ * process-tree-20240131T120000.123.json. The file is written under a
+ * temporary name and renamed when complete, so it never appears partially
+ * written. Table snapshots written with an environment table have their
+ * own, with .env before the format, for example
+ * process-tree-20240131T120000.123.env.table. The path of the file is
+ * stored in path, which holds size bytes, or the path of the environment
+ * table if that failed.
+ * Returns 0 on success and -1 on failure, errno is set by the corresponding
+ * libc call.
+ */
+int snapshot_write(struct tracee *root, output_fn_t fn, struct options *options, char *path, size_t size);
+
+#endif
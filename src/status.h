@@ -13,6 +13,9 @@
 #define status_is_fork_event(status) (WIFSTOPPED(status) && ((status) >> 8 == (SIGTRAP | (PTRACE_EVENT_FORK << 8))))
 #define status_is_vfork_event(status) (WIFSTOPPED(status) && ((status) >> 8 == (SIGTRAP | (PTRACE_EVENT_VFORK << 8))))
 #define status_is_clone_event(status) (WIFSTOPPED(status) && ((status) >> 8 == (SIGTRAP | (PTRACE_EVENT_CLONE << 8))))
+#define status_is_signal(status) (WIFSTOPPED(status) && ((status) >> 16) == 0 && WSTOPSIG(status) != (SIGTRAP | 0x80))
+#define status_is_group_stop(status) (WIFSTOPPED(status) && ((status) >> 16 == PTRACE_EVENT_STOP) && WSTOPSIG(status) != SIGTRAP)
+#define status_is_seccomp_event(status) (WIFSTOPPED(status) && ((status) >> 8 == (SIGTRAP | (PTRACE_EVENT_SECCOMP << 8))))
 #define status_is_execve_event(status) (WIFSTOPPED(status) && ((status) >> 8 == (SIGTRAP | (PTRACE_EVENT_EXEC << 8))))
 
 #endif
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "strcap.h"
+#include "xmalloc.h"
+
+/* Longest suffix of a truncated string, or of the entry of dropped strings. */
+#define SUFFIX_MAX 64
+
+/* Start of the entry of dropped strings. */
+#define DROPPED_PREFIX "..."
+
+static size_t limit(size_t value)
+{
+	return value == 0 ? SIZE_MAX : value;
+}
+
+static size_t min(size_t a, size_t b)
+{
+	return a < b ? a : b;
+}
+
+void strcap_init(struct strcap *cap, const struct strcap_limits *limits)
+{
+	memset(cap, 0, sizeof(*cap));
+
+	cap->limits = limits;
+	cap->node_left = limits ? limit(limits->node) : SIZE_MAX;
+	cap->list_left = SIZE_MAX;
+}
+
+void strcap_list_begin(struct strcap *cap)
+{
+	cap->list = NULL;
+	cap->count = 0;
+	cap->capacity = 0;
+	cap->dropped = 0;
+	cap->dropped_bytes = 0;
+	cap->list_left = cap->limits ? limit(cap->limits->list) : SIZE_MAX;
+	hash64_init(&cap->dropped_hash, 0);
+}
+
+void strcap_string_begin(struct strcap *cap)
+{
+	cap->string = NULL;
+	cap->length = 0;
+	cap->total = 0;
+	cap->keep = min(cap->limits ? limit(cap->limits->string) : SIZE_MAX,
+	                min(cap->list_left, cap->node_left));
+
+	/* Strings that are dropped whole are hashed from the start. */
+	if (cap->keep == 0)
+	{
+		hash64_init(&cap->hash, 0);
+	}
+}
+
+void strcap_string_append(struct strcap *cap, const char *data, size_t size)
+{
+	size_t stored = min(size, cap->keep - cap->length);
+
+	if (stored > 0)
+	{
+		cap->string = xrealloc(cap->string, cap->length + stored + SUFFIX_MAX);
+		memcpy(cap->string + cap->length, data, stored);
+		cap->length += stored;
+	}
+
+	/* The hash starts with the kept prefix once the string goes above its limit. */
+	if (cap->total + size > cap->keep)
+	{
+		if (cap->total <= cap->keep)
+		{
+			hash64_init(&cap->hash, 0);
+			hash64_update(&cap->hash, cap->string, cap->length);
+		}
+
+		hash64_update(&cap->hash, data + stored, size - stored);
+	}
+
+	cap->total += size;
+}
+
+char *strcap_string_end(struct strcap *cap)
+{
+	char *string = cap->string;
+
+	cap->string = NULL;
+	cap->list_left -= cap->length;
+	cap->node_left -= cap->length;
+
+	if (cap->keep == 0)
+	{
+		return NULL;
+	}
+
+	if (string == NULL)
+	{
+		string = xmalloc(SUFFIX_MAX);
+	}
+
+	if (cap->total > cap->keep)
+	{
+		snprintf(string + cap->length, SUFFIX_MAX, "...[%zu bytes %016llx]",
+		         cap->total, (unsigned long long) hash64_digest(&cap->hash));
+	}
+	else
+	{
+		string[cap->length] = 0;
+	}
+
+	return string;
+}
+
+static void append(struct strcap *cap, char *string)
+{
+	if (cap->count + 1 >= cap->capacity)
+	{
+		cap->capacity = cap->capacity ? cap->capacity * 2 : 16;
+		cap->list = xrealloc(cap->list, sizeof(*cap->list) * cap->capacity);
+	}
+
+	cap->list[cap->count++] = string;
+}
+
+void strcap_list_add(struct strcap *cap)
+{
+	char *string = strcap_string_end(cap);
+
+	if (string)
+	{
+		append(cap, string);
+		return;
+	}
+
+	uint64_t digest = hash64_digest(&cap->hash);
+
+	cap->dropped++;
+	cap->dropped_bytes += cap->total;
+	hash64_update(&cap->dropped_hash, &digest, sizeof(digest));
+}
+
+char **strcap_list_end(struct strcap *cap)
+{
+	char **list;
+
+	if (cap->dropped > 0)
+	{
+		char *string = xmalloc(SUFFIX_MAX);
+
+		snprintf(string, SUFFIX_MAX, DROPPED_PREFIX "[%zu more %zu bytes %016llx]", cap->dropped,
+		         cap->dropped_bytes, (unsigned long long) hash64_digest(&cap->dropped_hash));
+		append(cap, string);
+	}
+
+	append(cap, NULL);
+
+	list = cap->list;
+	cap->list = NULL;
+	cap->list_left = SIZE_MAX;
+
+	return list;
+}
+
+char **strcap_copy_list(struct strcap *cap, char **list)
+{
+	strcap_list_begin(cap);
+
+	for (; *list; ++list)
+	{
+		strcap_string_begin(cap);
+		strcap_string_append(cap, *list, strlen(*list));
+		strcap_list_add(cap);
+	}
+
+	return strcap_list_end(cap);
+}
+
+bool strcap_split_variable(const char *entry, size_t *name_length, const char **value)
+{
+	const char *eq = strchr(entry, '=');
+
+	if (eq)
+	{
+		*name_length = eq - entry;
+		*value = eq + 1;
+		return true;
+	}
+
+	if (strncmp(entry, DROPPED_PREFIX "[", strlen(DROPPED_PREFIX "[")) == 0)
+	{
+		*name_length = strlen(DROPPED_PREFIX);
+		*value = entry + strlen(DROPPED_PREFIX);
+		return true;
+	}
+
+	return false;
+}
@@ -0,0 +1,111 @@
+#ifndef STRCAP_H_INCLUDED
+#define STRCAP_H_INCLUDED
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "hash.h"
+
+/*
+ * Limits on the bytes kept of the arguments and environment of an exec.
+ * Zero means unlimited.
+ */
+struct strcap_limits
+{
+	/* Bytes of each argument or variable. */
+	size_t string;
+
+	/* Bytes of all arguments, or of all variables. */
+	size_t list;
+
+	/* Bytes of the arguments and environment together. */
+	size_t node;
+};
+
+/*
+ * Builds strings and lists of strings from pieces as they are read, within
+ * limits. A string above its limit keeps a prefix followed by its length
+ * and a hash of the whole value, as in "gcc -DX=...[70000 bytes 0123456789abcdef]",
+ * and strings that don't fit in their list at all are replaced by one
+ * entry at its end, with their count, length and hash. Hashes are only
+ * computed for values above the limits, and dropped bytes are never stored,
+ * so huge values cost their reading but not their memory.
+ */
+struct strcap
+{
+	const struct strcap_limits *limits;
+
+	/* Bytes left for the current node, and for the current list. */
+	size_t node_left;
+	size_t list_left;
+
+	/* The list being built. */
+	char **list;
+	size_t count;
+	size_t capacity;
+
+	/* Strings dropped from the list being built. */
+	size_t dropped;
+	size_t dropped_bytes;
+	struct hash64 dropped_hash;
+
+	/* The string being built, and the number of its bytes that is kept. */
+	char *string;
+	size_t length;
+	size_t total;
+	size_t keep;
+	struct hash64 hash;
+};
+
+/*
+ * Start a node within limits, which may be NULL for no limits.
+ */
+void strcap_init(struct strcap *cap, const struct strcap_limits *limits);
+
+/*
+ * Start a list of strings.
+ */
+void strcap_list_begin(struct strcap *cap);
+
+/*
+ * Start a string, on its own or in the current list.
+ */
+void strcap_string_begin(struct strcap *cap);
+
+/*
+ * Add size bytes at data to the current string, which must not contain
+ * its terminating null byte.
+ */
+void strcap_string_append(struct strcap *cap, const char *data, size_t size);
+
+/*
+ * Finish the current string. Returns it, or NULL if none of it could be kept.
+ */
+char *strcap_string_end(struct strcap *cap);
+
+/*
+ * Finish the current string and add it to the current list.
+ */
+void strcap_list_add(struct strcap *cap);
+
+/*
+ * Finish the current list. Returns it, NULL terminated.
+ */
+char **strcap_list_end(struct strcap *cap);
+
+/*
+ * Copy the NULL terminated list, within the limits of cap, as a list of
+ * its own. Returns the copy, NULL terminated.
+ */
+char **strcap_copy_list(struct strcap *cap, char **list);
+
+/*
+ * Split an environment variable into its name, of name_length bytes at
+ * its start, and its value. The entry of dropped variables has no '=',
+ * and is split into the name "..." and the rest, so that it is output
+ * like a variable rather than skipped.
+ * Returns false for entries without a name.
+ */
+bool strcap_split_variable(const char *entry, size_t *name_length, const char **value);
+
+#endif
@@ -0,0 +1,313 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include <linux/limits.h>
+#include <linux/sched.h>
+
+#include "task.h"
+#include "xmalloc.h"
+
+typedef unsigned long word_t;
+
+/* Most bytes of a string read from a task at once, at most a page. */
+#define READ_CHUNK 4096
+
+struct task *task_create(long tid, long owner)
+{
+	struct task *task = xcalloc(1, sizeof(struct task));
+
+	task->tid = tid;
+	task->owner = owner;
+
+	return task;
+}
+
+void task_destroy(struct task *task)
+{
+	xfree(task->execve_path);
+	xfree(task->file_paths[0]);
+	xfree(task->file_paths[1]);
+	xfree(task);
+}
+
+void task_detach(struct task *task)
+{
+	if (task->filtered)
+	{
+		kill(task->tid, SIGKILL);
+		return;
+	}
+
+	(void) ptrace(PTRACE_DETACH, task->tid);
+}
+
+/* Read a string word by word, where process_vm_readv() is not permitted.
+   Fails if the address is not mapped, where the syscall itself fails. */
+static int peek_string(struct task *task, unsigned long addr, struct strcap *cap)
+{
+	long tid = task->tid;
+
+	for (;; addr += sizeof(word_t))
+	{
+		word_t data;
+		char *end;
+
+		errno = 0;
+		data = ptrace(PTRACE_PEEKTEXT, tid, addr);
+
+		if (errno != 0)
+		{
+			return -1;
+		}
+
+		/* Check if the word contains a NULL byte. */
+		end = memchr(&data, 0, sizeof(data));
+		strcap_string_append(cap, (char *) &data, end ? end - (char *) &data : sizeof(data));
+
+		if (end)
+		{
+			return 0;
+		}
+	}
+}
+
+/* Add the string at addr to cap, whole pages at a time where possible. */
+static int read_string(struct task *task, unsigned long addr, struct strcap *cap)
+{
+	static size_t page_size;
+	char buf[READ_CHUNK];
+	size_t len = 0;
+
+	if (page_size == 0)
+	{
+		page_size = sysconf(_SC_PAGESIZE);
+	}
+
+	for (;;)
+	{
+		/* Never read across a page boundary, the next page may not be mapped. */
+		size_t chunk = page_size - (addr + len) % page_size;
+		struct iovec local, remote;
+		ssize_t count;
+		char *end;
+
+		if (chunk > sizeof(buf))
+		{
+			chunk = sizeof(buf);
+		}
+
+		local.iov_base = buf;
+		local.iov_len = chunk;
+		remote.iov_base = (void *) (addr + len);
+		remote.iov_len = chunk;
+
+		count = process_vm_readv(task->tid, &local, 1, &remote, 1, 0);
+
+		if (count <= 0)
+		{
+			return peek_string(task, addr + len, cap);
+		}
+
+		end = memchr(buf, 0, count);
+		strcap_string_append(cap, buf, end ? end - buf : count);
+
+		if (end)
+		{
+			return 0;
+		}
+
+		len += count;
+	}
+}
+
+char *task_read_string(struct task *task, unsigned long addr)
+{
+	struct strcap cap;
+
+	if (addr == 0)
+	{
+		return NULL;
+	}
+
+	strcap_init(&cap, NULL);
+	strcap_string_begin(&cap);
+
+	if (read_string(task, addr, &cap) < 0)
+	{
+		xfree(strcap_string_end(&cap));
+		return NULL;
+	}
+
+	return strcap_string_end(&cap);
+}
+
+static char **read_string_list_from_file(const char *path, struct strcap *cap)
+{
+	char buf[8192];
+	size_t len;
+	FILE *f;
+
+	f = fopen(path, "r");
+
+	if (f == NULL)
+	{
+		return NULL;
+	}
+
+	strcap_list_begin(cap);
+	strcap_string_begin(cap);
+
+	while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+	{
+		char *start = buf;
+		char *end;
+
+		while ((end = memchr(start, 0, buf + len - start)))
+		{
+			strcap_string_append(cap, start, end - start);
+			strcap_list_add(cap);
+			strcap_string_begin(cap);
+			start = end + 1;
+		}
+
+		strcap_string_append(cap, start, buf + len - start);
+	}
+
+	fclose(f);
+
+	/* The last string may be missing its null byte. */
+	if (cap->total > 0)
+	{
+		strcap_list_add(cap);
+	}
+	else
+	{
+		xfree(strcap_string_end(cap));
+	}
+
+	return strcap_list_end(cap);
+}
+
+int task_read_args_from_proc_dir(struct task *task, const struct strcap_limits *limits,
+                                 char ***argv, char ***envp)
+{
+	struct strcap cap;
+	char cmdline_path[PATH_MAX];
+	char environ_path[PATH_MAX];
+	long tid = task->tid;
+
+	snprintf(cmdline_path, sizeof(cmdline_path), "/proc/%ld/cmdline", tid);
+	snprintf(environ_path, sizeof(environ_path), "/proc/%ld/environ", tid);
+
+	strcap_init(&cap, limits);
+	*argv = read_string_list_from_file(cmdline_path, &cap);
+	*envp = read_string_list_from_file(environ_path, &cap);
+
+	if (*argv == NULL || *envp == NULL)
+	{
+		free_string_list(*argv);
+		free_string_list(*envp);
+		return -1;
+	}
+
+	return 0;
+}
+
+int task_read_info_from_proc_dir(struct task *task, const struct strcap_limits *limits,
+                                 char ***argv, char ***envp, char **cwd)
+{
+	char cwd_path[PATH_MAX];
+	char cwd_buf[PATH_MAX];
+	ssize_t cwd_len;
+
+	snprintf(cwd_path, sizeof(cwd_path), "/proc/%ld/cwd", task->tid);
+
+	cwd_len = readlink(cwd_path, cwd_buf, sizeof(cwd_buf) - 1);
+
+	if (cwd_len < 0 || task_read_args_from_proc_dir(task, limits, argv, envp) < 0)
+	{
+		return -1;
+	}
+
+	cwd_buf[cwd_len] = 0;
+	*cwd = strdup(cwd_buf);
+
+	return 0;
+}
+
+int task_get_syscall_info(struct task *task, struct ptrace_syscall_info *info)
+{
+	const size_t size = sizeof(struct ptrace_syscall_info);
+	return ptrace(PTRACE_GET_SYSCALL_INFO, task->tid, size, info) == size ? 0 : -1;
+}
+
+long task_get_event_tid(struct task *task)
+{
+	long tid;
+
+	if (ptrace(PTRACE_GETEVENTMSG, task->tid, 0, &tid) < 0)
+	{
+		tid = -1;
+	}
+
+	return tid;
+}
+
+int task_set_ptrace_options(struct task *task)
+{
+	if (task->ptrace_options_set)
+	{
+		return 0;
+	}
+
+	/* Syscalls stopped by the filter fail without the tracer, so filtered
+	   tasks don't outlive it. */
+	long options = TASK_PTRACE_OPTIONS | (task->filtered ? PTRACE_O_EXITKILL : 0);
+	int result = ptrace(PTRACE_SETOPTIONS, task->tid, 0, options);
+	task->ptrace_options_set = result == 0;
+	return result;
+}
+
+int task_read_clone_flags(struct task *task, struct ptrace_syscall_info *info)
+{
+	unsigned long cl_args_addr;
+	unsigned long flags_addr;
+	unsigned long flags;
+	struct clone_args *cl_args;
+
+	/* The seccomp stop carries the arguments the same way as the entry stop. */
+	assert(info->op == PTRACE_SYSCALL_INFO_ENTRY || info->op == PTRACE_SYSCALL_INFO_SECCOMP);
+	assert(info->entry.nr == SYS_clone || info->entry.nr == SYS_clone3);
+
+	if (info->entry.nr == SYS_clone)
+	{
+		/* The flags are passed directly as the first argument. */
+		task->next_child_is_a_thread = info->entry.args[0] & CLONE_THREAD;
+		return 0;
+	}
+
+	cl_args_addr = info->entry.args[0];
+	cl_args = (struct clone_args *) cl_args_addr;
+	flags_addr = (unsigned long) &cl_args->flags;
+
+	errno = 0;
+	flags = ptrace(PTRACE_PEEKTEXT, task->tid, flags_addr);
+
+	if (errno != 0)
+	{
+		return -1;
+	}
+
+	task->next_child_is_a_thread = flags & CLONE_THREAD;
+
+	return 0;
+}
@@ -0,0 +1,147 @@
+#ifndef TASK_H_INCLUDED
+#define TASK_H_INCLUDED
+
+#include <stdbool.h>
+
+#include <linux/ptrace.h>
+
+#include "tracee.h"
+#include "strcap.h"
+
+/*
+ * Ptrace options set for every task.
+ */
+#define TASK_PTRACE_OPTIONS \
+	(PTRACE_O_TRACEEXEC | PTRACE_O_TRACEFORK | \
+	 PTRACE_O_TRACEVFORK | PTRACE_O_TRACECLONE | \
+	 PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACESECCOMP)
+
+/*
+ * Represents a thread that is currently being traced.
+ * Every traced thread has a task, but not necessarily its own tracee:
+ * when threads are folded into their thread group leader, events
+ * from the task of a thread are attributed to the leader.
+ */
+struct task
+{
+	/* Thread ID of this task. */
+	long tid;
+
+	/* Thread ID of the tracee that events from this task are attributed to. */
+	long owner;
+
+	/* Path passed to the execve in progress, and the time of the first
+	   attempt to exec since the previous exec. Arguments and environment
+	   are only read once the exec succeeded. */
+	char *execve_path;
+	timestamp_t execve_time;
+
+	/* Attempts to exec that failed since the previous exec. */
+	unsigned long failed_execs;
+
+	/* Ptrace options have been set for this task. */
+	bool ptrace_options_set;
+
+	/* The next child to be created by this task is a thread. */
+	bool next_child_is_a_thread;
+
+	/* The task has not stopped since it was created. */
+	bool starting;
+
+	/* The task is a new process, which may be handed over to another
+	   tracer at its first stop. */
+	bool may_hand_off;
+
+	/* The task was handed over from another tracer, stopped with a SIGSTOP. */
+	bool handed_over;
+
+	/* The syscalls that are handled stop through the seccomp filter of
+	   traced files, and the task doesn't stop at every other syscall. */
+	bool filtered;
+
+	/* An execve is in progress, and its exit tells whether it failed. */
+	bool execve_pending;
+
+	/* Started by the tracer, whose execvp() searches PATH for the command.
+	   Its attempts to exec are not counted until one of them succeeded. */
+	bool spawned;
+
+	/* Paths passed to the file syscall in progress, reported at its
+	   exit if it succeeds. */
+	char *file_paths[2];
+	bool file_written;
+};
+
+/*
+ * Allocate a new task for tid, with events attributed to the tracee owner.
+ */
+struct task *task_create(long tid, long owner);
+
+/*
+ * Free memory used by task.
+ */
+void task_destroy(struct task *task);
+
+/*
+ * Detach from the thread of this task, or kill it if it is filtered.
+ */
+void task_detach(struct task *task);
+
+/*
+ * Read a string from task at the specified address. Whole pages are read
+ * at once with process_vm_readv() where possible.
+ * Returns NULL if the address is 0 or the string could not be read.
+ */
+char *task_read_string(struct task *task, unsigned long addr);
+
+/*
+ * Get environment and command line arguments from /proc/<pid>, within
+ * limits, which may be NULL. Used at the exec of a traced process.
+ * Returns 0 on success and -1 on failure, errno is set by the
+ * corresponding libc call.
+ */
+int task_read_args_from_proc_dir(struct task *task, const struct strcap_limits *limits,
+                                 char ***argv, char ***envp);
+
+/*
+ * Get working directory, environment and command line arguments from /proc/<pid>,
+ * with arguments and environment within limits, which may be NULL.
+ * Used when attaching to an external process.
+ * Returns 0 on success and -1 on failure, errno is set by the
+ * corresponding libc call.
+ */
+int task_read_info_from_proc_dir(struct task *task, const struct strcap_limits *limits,
+                                 char ***argv, char ***envp, char **cwd);
+
+ /*
+  * Get syscall info if task stopped from a syscall.
+  * Returns 0 on success and -1 on failure, errno is
+  * set by the corresponding ptrace call.
+  */
+int task_get_syscall_info(struct task *task, struct ptrace_syscall_info *info);
+
+ /*
+  * Get the message of the event that task stopped from. For fork, vfork
+  * and clone this is the tid of the new thread, for exec it is the
+  * former tid of the thread that called execve.
+  * Returns -1 on failure, errno is set by the corresponding ptrace call.
+  */
+long task_get_event_tid(struct task *task);
+
+/*
+ * Set the appropriate ptrace options for this task.
+ * Returns 0 on success and -1 on failure, errno is set
+ * by the corresponding ptrace call.
+ */
+int task_set_ptrace_options(struct task *task);
+
+/*
+ * Set `next_child_is_a_thread` field based on the flags argument to
+ * clone, or the `cl_args` argument to clone3, at the entry or seccomp
+ * stop of the syscall.
+ * Returns 0 on success and -1 on failure, errno is set
+ * by the corresponding ptrace call.
+ */
+int task_read_clone_flags(struct task *task, struct ptrace_syscall_info *info);
+
+#endif
@@ -0,0 +1,134 @@
+#include <stdio.h>
+
+#include "tidmap.h"
+#include "xmalloc.h"
+
+static size_t slot_of(struct tidmap *map, long tid)
+{
+	unsigned long hash = (unsigned long) tid * 0x9e3779b97f4a7c15ul;
+	return (hash >> 16) & (map->capacity - 1);
+}
+
+static void grow(struct tidmap *map)
+{
+	struct tidmap_entry *old = map->entries;
+	size_t oldcapacity = map->capacity;
+
+	map->capacity = oldcapacity ? oldcapacity * 2 : 64;
+	map->entries = xcalloc(map->capacity, sizeof(*map->entries));
+	map->count = 0;
+
+	for (size_t i = 0; i < oldcapacity; ++i)
+	{
+		if (old[i].tid)
+		{
+			tidmap_put(map, old[i].tid, old[i].value);
+		}
+	}
+
+	xfree(old);
+}
+
+void *tidmap_get(struct tidmap *map, long tid)
+{
+	if (map->count == 0)
+	{
+		return NULL;
+	}
+
+	for (size_t i = slot_of(map, tid);; i = (i + 1) & (map->capacity - 1))
+	{
+		if (map->entries[i].tid == tid)
+		{
+			return map->entries[i].value;
+		}
+
+		if (map->entries[i].tid == 0)
+		{
+			return NULL;
+		}
+	}
+}
+
+void tidmap_put(struct tidmap *map, long tid, void *value)
+{
+	/* Keep load factor below 3/4. */
+	if ((map->count + 1) * 4 > map->capacity * 3)
+	{
+		grow(map);
+	}
+
+	size_t i = slot_of(map, tid);
+	while (map->entries[i].tid != 0 && map->entries[i].tid != tid)
+	{
+		i = (i + 1) & (map->capacity - 1);
+	}
+
+	if (map->entries[i].tid == 0)
+	{
+		map->count++;
+	}
+
+	map->entries[i].tid = tid;
+	map->entries[i].value = value;
+}
+
+void *tidmap_remove(struct tidmap *map, long tid)
+{
+	size_t mask = map->capacity - 1;
+	size_t i, j;
+	void *value;
+
+	if (map->count == 0)
+	{
+		return NULL;
+	}
+
+	for (i = slot_of(map, tid); map->entries[i].tid != tid; i = (i + 1) & mask)
+	{
+		if (map->entries[i].tid == 0)
+		{
+			return NULL;
+		}
+	}
+
+	value = map->entries[i].value;
+	map->count--;
+
+	/* Shift following entries of the probe sequence back, so that
+	   lookups never need tombstones. */
+	for (j = (i + 1) & mask; map->entries[j].tid != 0; j = (j + 1) & mask)
+	{
+		size_t home = slot_of(map, map->entries[j].tid);
+
+		if (((j - home) & mask) >= ((j - i) & mask))
+		{
+			map->entries[i] = map->entries[j];
+			i = j;
+		}
+	}
+
+	map->entries[i].tid = 0;
+	map->entries[i].value = NULL;
+
+	return value;
+}
+
+void tidmap_foreach(struct tidmap *map, void (*fn)(long tid, void *value))
+{
+	for (size_t i = 0; i < map->capacity; ++i)
+	{
+		if (map->entries[i].tid)
+		{
+			fn(map->entries[i].tid, map->entries[i].value);
+		}
+	}
+}
+
+void tidmap_clear(struct tidmap *map)
+{
+	xfree(map->entries);
+	map->entries = NULL;
+	map->count = 0;
+	map->capacity = 0;
+}
@@ -0,0 +1,52 @@
+#ifndef TIDMAP_H_INCLUDED
+#define TIDMAP_H_INCLUDED
+
+#include <stddef.h>
+
+/*
+ * Hash map from thread IDs to arbitrary pointers.
+ * Zero is not a valid key.
+ */
+struct tidmap
+{
+	/* Number of occupied slots. */
+	size_t count;
+
+	/* Number of allocated slots, always zero or a power of two. */
+	size_t capacity;
+
+	/* Slots, a zero tid marks an empty slot. */
+	struct tidmap_entry
+	{
+		long tid;
+		void *value;
+	} *entries;
+};
+
+/*
+ * Get the value stored for tid, or NULL if there is none.
+ */
+void *tidmap_get(struct tidmap *map, long tid);
+
+/*
+ * Store value for tid, replacing any previous value.
+ */
+void tidmap_put(struct tidmap *map, long tid, void *value);
+
+/*
+ * Remove tid from the map and return the value that was stored,
+ * or NULL if there was none.
+ */
+void *tidmap_remove(struct tidmap *map, long tid);
+
+/*
+ * Call fn for every entry in the map. The map must not be modified by fn.
+ */
+void tidmap_foreach(struct tidmap *map, void (*fn)(long tid, void *value));
+
+/*
+ * Free memory used by the map. Values are not freed.
+ */
+void tidmap_clear(struct tidmap *map);
+
+#endif
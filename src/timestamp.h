@@ -0,0 +1,25 @@
+#ifndef TIMESTAMP_H_INCLUDED
+#define TIMESTAMP_H_INCLUDED
+
+#include <time.h>
+
+/*
+ * Timestamps are nanoseconds of the monotonic clock.
+ */
+typedef unsigned long long timestamp_t;
+
+#define NS_PER_SEC 1000000000ull
+
+static inline timestamp_t timestamp_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (timestamp_t) ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static inline double timestamp_to_seconds(timestamp_t t)
+{
+	return (double) t / NS_PER_SEC;
+}
+
+#endif
@@ -2,9 +2,11 @@
 #define TRACEE_H_INCLUDED
 
 #include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
 
-#include <linux/ptrace.h>
+#include "timestamp.h"
+#include "pathset.h"
 
 /*
  * Represents a process that is or has been traced.
@@ -13,6 +15,12 @@ struct tracee
 {
 	/* Thread ID of this tracee. */
 	long tid;
+
+	/* Number of tracees with the same tid before this one, as tids are reused. */
+	unsigned long generation;
+
+	/* The tracee with the same tid before this one, while it is in the tree. */
+	struct tracee *older;
 	
 	/* Command line argument list, or NULL if this
 	   tracee resulted from fork/vfork/clone and
@@ -24,23 +32,69 @@ struct tracee
 	   execvp has not been executed. */
 	char **envp;
 
+	/* The tracee that created this tracee, or NULL for a root. */
+	struct tracee *parent;
+
 	/* Number of child processes/threads of this tracee. */
 	size_t nchildren;
 
-	/* A list of child processes/threads of this tracee. */
+	/* A list of child processes/threads of this tracee, with room for
+	   children_capacity of them. May be allocated while nchildren is zero. */
 	struct tracee **children;
+	size_t children_capacity;
+
+	/* Attempts to exec that failed, and the total time from the first
+	   attempt to each exec, when seen by the tracer. */
+	unsigned long failed_execs;
+	timestamp_t exec_time;
 
-	/* Last working directory of this tracee. */
+	/* Last working directory of this tracee, in a buffer of cwd_size bytes. */
 	char *cwd;
+	size_t cwd_size;
+
+	/* Files only read by this tracee, and files it wrote, created, renamed
+	   or removed, when files are traced. */
+	struct pathset inputs;
+	struct pathset outputs;
+
+	/* Parts of the cache key of this tracee, when cache keys are computed,
+	   and the key of its whole subtree, see cachekey.h. */
+	unsigned long long exec_key;
+	unsigned long long inputs_key;
+	unsigned long long cache_key;
+
+	/* CPU time and memory sampled at regular intervals while running. */
+	struct tracee_sample
+	{
+		timestamp_t time;
 
-	/* Ptrace options have been set for this tracee. */
-	bool ptrace_options_set;
+		/* CPU time used since the previous sample, in microseconds. */
+		uint32_t cpu_us;
+
+		/* Resident memory, in KiB. */
+		uint32_t rss_kb;
+	} *samples;
+	size_t nsamples;
 
 	/* This tracee is a thread. */
 	bool is_a_thread;
 
-	/* The next child to be registered for this tracee is a thread. */
-	bool next_child_is_a_thread;
+	/* Time when this tracee was first seen. */
+	timestamp_t start_time;
+
+	/* Time when this tracee exited, or zero if it is still running. */
+	timestamp_t end_time;
+
+	/* Wait status of this tracee once it exited, if known. */
+	int exit_status;
+	bool has_exit_status;
+
+	/* Identifier of the shape of this subtree, see collapse.h. */
+	size_t shape;
+
+	/* This tracee has exited and dropped out of the retention window,
+	   it is only kept as the ancestor of retained tracees. */
+	bool expired;
 };
 
 /*
@@ -53,30 +107,21 @@ struct tracee *tracee_create(void);
  */
 void tracee_destroy(struct tracee *tracee);
 
-/*
- * Detach from tracee and all children.
- */
-void tracee_detach(struct tracee *tracee);
-
 /*
  * Add a child tracee to the parent tracee.
  */
 void tracee_add_child(struct tracee *parent, struct tracee *child);
 
 /*
- * Find the tracee matching the provided tid in the tree.
- */
-struct tracee *tracee_find_tid(struct tracee *root, long tid);
-
-/*
- * Read a string from tracee at the specified address.
+ * Remove a child tracee from the parent tracee. The child is not freed.
  */
-char *tracee_read_string(struct tracee *tracee, unsigned long addr);
+void tracee_remove_child(struct tracee *parent, struct tracee *child);
 
 /*
- * Read a NULL terminated list of strings from tracee at the specified address.
+ * Set the working directory of the tracee, reusing its buffer when it is
+ * large enough. cwd may be NULL for an unknown directory.
  */
-char **tracee_read_string_list(struct tracee *tracee, unsigned long addr);
+void tracee_set_cwd(struct tracee *tracee, const char *cwd);
 
 /*
  * Change the working directory of the tracee and all non-thread children.
@@ -84,43 +129,11 @@ char **tracee_read_string_list(struct tracee *tracee, unsigned long addr);
 void tracee_chdir(struct tracee *tracee, const char *dir);
 
 /*
- * Get working directory, environment and command line arguments from /proc/<pid>.
- * Used when attaching to an external process.
- * Returns 0 on success and -1 on failure, errno is set by the
- * corresponding libc call.
- */
-int tracee_read_info_from_proc_dir(struct tracee *tracee);
-
-/*
- * Get working directory from chdir arguments.
- */
-int tracee_set_cwd_from_chdir_call(struct tracee *tracee, struct ptrace_syscall_info *info);
-
- /*
-  * Get syscall info if tracee stopped from a syscall.
-  * Returns 0 on success and -1 on failure, errno is
-  * set by the corresponding ptrace call.
-  */
-int tracee_get_syscall_info(struct tracee *tracee, struct ptrace_syscall_info *info);
-
- /*
-  * Get the returned tid tracee stopped from an event coming from fork, vfork or clone.
-  * Returns -1 on failure, errno is set by the corresponding ptrace call.
-  */
-long tracee_get_event_tid(struct tracee *tracee);
-
-/*
- * Set the appropriate ptrace options for this tracee.
- * Returns 0 on success and -1 on failure, errno is set
- * by the corresponding ptrace call.
- */
-int tracee_set_ptrace_options(struct tracee *tracee);
-
-/* Set `next_child_is_thread` field based on the `cl_args` arugment to clone3.
- * Returns 0 on success and -1 on failure, errno is set
- * by the corresponding ptrace call.
+ * Resolve path against the directory dir unless it is absolute, and
+ * remove "." and ".." components and repeated slashes. The result is
+ * relative if dir is NULL or relative.
  */
-int tracee_read_cl_args(struct tracee *tracee, struct ptrace_syscall_info *info);
+char *join_path(const char *dir, const char *path);
 
 /*
  * Copy a NULL terminated list of strings.
@@ -0,0 +1,1064 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <err.h>
+
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <sys/prctl.h>
+
+#include <linux/limits.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <linux/audit.h>
+
+#include "tracer.h"
+#include "options.h"
+#include "task.h"
+#include "status.h"
+#include "cachekey.h"
+#include "xmalloc.h"
+
+#if defined(__x86_64__)
+#define AUDIT_ARCH_NATIVE AUDIT_ARCH_X86_64
+#elif defined(__aarch64__)
+#define AUDIT_ARCH_NATIVE AUDIT_ARCH_AARCH64
+#elif defined(__i386__)
+#define AUDIT_ARCH_NATIVE AUDIT_ARCH_I386
+#elif defined(__riscv) && __riscv_xlen == 64
+#define AUDIT_ARCH_NATIVE AUDIT_ARCH_RISCV64
+#else
+#error "Unsupported architecture"
+#endif
+
+/* Exit status of a child that failed before executing its command, like
+   the one of a shell. Children leave with _exit(), as the tracer may be
+   embedded in a program whose atexit handlers must not run twice. */
+#define EXIT_CHILD_FAILURE 127
+
+extern char **environ;
+
+static void emit(struct tracer *tracer, struct event *event)
+{
+	tracer->emit(event, tracer->data);
+}
+
+static void continue_tracee(struct task *task, int sig)
+{
+	/* The exit of a file syscall or execve tells whether it succeeded. */
+	if (task->filtered && task->file_paths[0] == NULL && !task->execve_pending)
+	{
+		if (ptrace(PTRACE_CONT, task->tid, 0, sig) < 0 && errno != ESRCH)
+		{
+			warn("ptrace(PTRACE_CONT, %ld) failed", task->tid);
+		}
+
+		return;
+	}
+
+	/* A tracee killed while stopped is reported by its exit. */
+	if (ptrace(PTRACE_SYSCALL, task->tid, 0, sig) < 0 && errno != ESRCH)
+	{
+		warn("ptrace(PTRACE_SYSCALL, %ld) failed", task->tid);
+	}
+}
+
+static void listen_tracee(long tid)
+{
+	if (ptrace(PTRACE_LISTEN, tid, 0, 0) < 0 && errno != ESRCH)
+	{
+		warn("ptrace(PTRACE_LISTEN, %ld) failed", tid);
+	}
+}
+
+/* Handle the first stop of a new task, by handing it over or letting it run. */
+static void start_task(struct tracer *tracer, struct task *task, int status)
+{
+	task->starting = false;
+
+	if (task->may_hand_off && tracer->handoff && tracer->handoff(task->tid, task->filtered, tracer->data))
+	{
+		tidmap_remove(&tracer->tasks, task->tid);
+		task_destroy(task);
+		return;
+	}
+
+	if (status_is_group_stop(status))
+	{
+		/* A process that was handed over may have entered a group-stop
+		   for the SIGSTOP that kept it stopped in between. Any other
+		   stopped process is left stopped until it is continued. */
+		if (!task->handed_over)
+		{
+			listen_tracee(task->tid);
+			return;
+		}
+
+		kill(task->tid, SIGCONT);
+	}
+
+	(void) task_set_ptrace_options(task);
+	continue_tracee(task, 0);
+}
+
+static void handle_exit(struct tracer *tracer, struct task *task, int status)
+{
+	/* Threads folded into their leader don't exit on their own. */
+	if (task->tid == task->owner)
+	{
+		struct event event = { .type = EVENT_EXIT, .tid = task->owner, .time = timestamp_now() };
+		event.failed_execs = task->failed_execs;
+		event.status = status;
+		event.has_status = WIFEXITED(status) || WIFSIGNALED(status);
+		emit(tracer, &event);
+	}
+
+	tidmap_remove(&tracer->tasks, task->tid);
+	task_destroy(task);
+}
+
+/* Read the path argument at addr of a syscall, resolved against the
+   directory fd dirfd unless it is AT_FDCWD. Paths relative to the working
+   directory are resolved when the event is applied. */
+static char *read_path(struct task *task, long dirfd, unsigned long addr)
+{
+	char path[PATH_MAX];
+	char dir[PATH_MAX];
+	ssize_t len;
+	char *name = task_read_string(task, addr);
+
+	if (name == NULL || name[0] == '/' || (int) dirfd == AT_FDCWD)
+	{
+		return name;
+	}
+
+	snprintf(path, sizeof(path), "/proc/%ld/fd/%d", task->tid, (int) dirfd);
+	len = readlink(path, dir, sizeof(dir) - 1);
+
+	if (len < 0)
+	{
+		return name;
+	}
+
+	dir[len] = 0;
+
+	char *joined = join_path(dir, name);
+	xfree(name);
+	return joined;
+}
+
+/* Whether open() flags may change the file, rather than only read it. */
+static bool open_writes(unsigned long flags)
+{
+	return (flags & O_ACCMODE) != O_RDONLY || (flags & (O_CREAT | O_TRUNC));
+}
+
+/* Keep the paths of a file syscall at its entry, to report them at its exit. */
+static void start_file_syscall(struct task *task, struct ptrace_syscall_info *info)
+{
+	unsigned long long *args = info->entry.args;
+	unsigned long flags = 0;
+	long dirfd = AT_FDCWD;
+	unsigned long addr;
+
+	switch (info->entry.nr)
+	{
+#ifdef SYS_open
+	case SYS_open:
+		addr = args[0];
+		flags = args[1];
+		break;
+#endif
+#ifdef SYS_creat
+	case SYS_creat:
+		addr = args[0];
+		flags = O_CREAT | O_WRONLY | O_TRUNC;
+		break;
+#endif
+	case SYS_openat:
+		dirfd = args[0];
+		addr = args[1];
+		flags = args[2];
+		break;
+
+	case SYS_openat2:
+		/* The flags are the first field of struct open_how. */
+		dirfd = args[0];
+		addr = args[1];
+		errno = 0;
+		flags = ptrace(PTRACE_PEEKDATA, task->tid, args[2]);
+
+		if (errno != 0)
+		{
+			return;
+		}
+		break;
+#ifdef SYS_rename
+	case SYS_rename:
+		task->file_paths[1] = read_path(task, AT_FDCWD, args[1]);
+		addr = args[0];
+		flags = O_WRONLY;
+		break;
+#endif
+	case SYS_renameat:
+	case SYS_renameat2:
+		task->file_paths[1] = read_path(task, args[2], args[3]);
+		dirfd = args[0];
+		addr = args[1];
+		flags = O_WRONLY;
+		break;
+#ifdef SYS_unlink
+	case SYS_unlink:
+		addr = args[0];
+		flags = O_WRONLY;
+		break;
+#endif
+	case SYS_unlinkat:
+		dirfd = args[0];
+		addr = args[1];
+		flags = O_WRONLY;
+		break;
+
+	default:
+		return;
+	}
+
+	/* Directories are listed or used for lookups, not read as inputs. */
+	if (flags & (O_DIRECTORY | O_PATH))
+	{
+		return;
+	}
+
+	task->file_paths[0] = read_path(task, dirfd, addr);
+	task->file_written = open_writes(flags);
+}
+
+/* Hash the contents of a file read by task, with a path relative to its working directory. */
+static unsigned long long digest_input(struct tracer *tracer, struct task *task, const char *path)
+{
+	char buf[PATH_MAX + 64];
+
+	if (path[0] == '/')
+	{
+		return cachekey_digest_file(&tracer->digests, path);
+	}
+
+	snprintf(buf, sizeof(buf), "/proc/%ld/cwd/%s", task->tid, path);
+	return cachekey_digest_file(&tracer->digests, buf);
+}
+
+/* Report the paths of a file syscall if it succeeded. */
+static void finish_file_syscall(struct tracer *tracer, struct task *task, bool success)
+{
+	for (size_t i = 0; i < sizeof(task->file_paths) / sizeof(*task->file_paths); ++i)
+	{
+		if (task->file_paths[i] && success)
+		{
+			struct event event = { .type = EVENT_FILE, .tid = task->owner, .time = timestamp_now() };
+			event.path = task->file_paths[i];
+			event.written = task->file_written;
+
+			if (!event.written && tracer->options->cache_inputs)
+			{
+				event.digest = digest_input(tracer, task, event.path);
+			}
+
+			emit(tracer, &event);
+		}
+		else
+		{
+			xfree(task->file_paths[i]);
+		}
+
+		task->file_paths[i] = NULL;
+	}
+}
+
+static void handle_syscall(struct tracer *tracer, struct task *task)
+{
+	struct ptrace_syscall_info info;
+	(void) task_get_syscall_info(task, &info);
+
+	if (info.op == PTRACE_SYSCALL_INFO_EXIT)
+	{
+		/* A successful execve is reported by its event before its exit. */
+		if (task->execve_pending)
+		{
+			task->execve_pending = false;
+			task->failed_execs += info.exit.is_error;
+		}
+
+		finish_file_syscall(tracer, task, !info.exit.is_error);
+		return;
+	}
+
+	/* Filtered tasks, also when handed over between tracers, only stop for
+	   handled syscalls, through seccomp. Other tasks stop at every entry. */
+	if (info.op != (task->filtered ? PTRACE_SYSCALL_INFO_SECCOMP : PTRACE_SYSCALL_INFO_ENTRY))
+	{
+		return;
+	}
+
+	switch (info.entry.nr)
+	{
+	case SYS_execve:
+		/* Without the filter, started commands are only traced from their exec on. */
+		if (task->spawned)
+		{
+			break;
+		}
+
+		/* A failed attempt, like a miss of a search of PATH, would
+		   waste reading the arguments and environment. */
+		xfree(task->execve_path);
+		task->execve_path = task_read_string(task, info.entry.args[0]);
+		task->execve_pending = true;
+
+		if (task->execve_time == 0)
+		{
+			task->execve_time = timestamp_now();
+		}
+		break;
+
+	case SYS_chdir:
+	{
+		struct event event = { .type = EVENT_CHDIR, .tid = task->owner, .time = timestamp_now() };
+		event.cwd = task_read_string(task, info.entry.args[0]);
+
+		/* The call fails with EFAULT for an unreadable path. */
+		if (event.cwd)
+		{
+			emit(tracer, &event);
+		}
+		break;
+	}
+
+	case SYS_clone:
+	case SYS_clone3:
+		(void) task_read_clone_flags(task, &info);
+		break;
+
+	default:
+		if (tracer->options->files)
+		{
+			start_file_syscall(task, &info);
+		}
+		break;
+	}
+}
+
+static void handle_new_tracee(struct tracer *tracer, struct task *task)
+{
+	struct task *child;
+	long newtid;
+	bool is_a_thread;
+
+	newtid = task_get_event_tid(task);
+	if (newtid < 0)
+	{
+		/* Only fails if the tracee was killed meanwhile. */
+		warn("ptrace(PTRACE_GETEVENTMSG, %ld, ...) failed", task->tid);
+		return;
+	}
+
+	is_a_thread = task->next_child_is_a_thread;
+	task->next_child_is_a_thread = false;
+
+	if (is_a_thread && tracer->options->no_threads)
+	{
+		/* Fold the thread into the tracee of its thread group leader. */
+		child = task_create(newtid, task->owner);
+	}
+	else
+	{
+		struct event event = { .type = EVENT_SPAWN, .tid = newtid, .time = timestamp_now() };
+		event.parent = task->owner;
+		event.is_a_thread = is_a_thread;
+		emit(tracer, &event);
+
+		child = task_create(newtid, newtid);
+	}
+
+	child->starting = true;
+	child->may_hand_off = !is_a_thread;
+	child->filtered = task->filtered;
+	tidmap_put(&tracer->tasks, newtid, child);
+
+	void *early = tidmap_remove(&tracer->early_stops, newtid);
+
+	if (early)
+	{
+		start_task(tracer, child, (long) early);
+	}
+}
+
+static void handle_execve_event(struct tracer *tracer, struct task *task)
+{
+	struct task *caller = task;
+	struct task *former = NULL;
+	long formertid;
+
+	/* When a thread other than the leader calls execve, it takes over
+	   the tid of the leader and its former tid is never reported again. */
+	formertid = task_get_event_tid(task);
+
+	if (formertid > 0 && formertid != task->tid)
+	{
+		former = tidmap_remove(&tracer->tasks, formertid);
+	}
+
+	if (former)
+	{
+		caller = former;
+	}
+
+	struct event event = { .type = EVENT_EXEC, .tid = task->owner, .time = timestamp_now() };
+
+	/* The new program has its arguments and environment at the top of its stack. */
+	if (task_read_args_from_proc_dir(task, &tracer->options->limits, &event.argv, &event.envp) < 0
+	 && caller->execve_path)
+	{
+		event.argv = xcalloc(2, sizeof(*event.argv));
+		event.argv[0] = caller->execve_path;
+		caller->execve_path = NULL;
+	}
+
+	if (caller->execve_time)
+	{
+		event.exec_time = event.time - caller->execve_time;
+	}
+
+	event.failed_execs = caller->failed_execs;
+
+	xfree(caller->execve_path);
+	caller->execve_path = NULL;
+	caller->execve_time = 0;
+	caller->failed_execs = 0;
+	task->execve_pending = false;
+	task->spawned = false;
+
+	emit(tracer, &event);
+
+	if (former)
+	{
+		task_destroy(former);
+	}
+}
+
+static void handle_status(struct tracer *tracer, long tid, int status)
+{
+	struct task *task = tidmap_get(&tracer->tasks, tid);
+
+	if (task == NULL)
+	{
+		/* A new thread may report its first stop before its parent reports
+		   creating it. Keep it stopped until then, so none of its events are missed. */
+		if (WIFSTOPPED(status))
+		{
+			tidmap_put(&tracer->early_stops, tid, (void *) (long) status);
+		}
+
+		return;
+	}
+
+	if (WIFEXITED(status) || WIFSIGNALED(status) || status_is_exit_event(status))
+	{
+		handle_exit(tracer, task, status);
+		return;
+	}
+
+	if (task->starting)
+	{
+		start_task(tracer, task, status);
+		return;
+	}
+
+	if (!task->ptrace_options_set)
+	{
+		(void) task_set_ptrace_options(task);
+	}
+
+	bool is_new_tracee = status_is_clone_event(status)
+	                  || status_is_fork_event(status)
+	                  || status_is_vfork_event(status);
+
+	if (is_new_tracee)
+	{
+		handle_new_tracee(tracer, task);
+	}
+	else if (status_is_syscall(status) || status_is_seccomp_event(status))
+	{
+		handle_syscall(tracer, task);
+	}
+	else if (status_is_execve_event(status))
+	{
+		handle_execve_event(tracer, task);
+	}
+	else if (status_is_group_stop(status))
+	{
+		listen_tracee(tid);
+		return;
+	}
+	else if (status_is_signal(status))
+	{
+		/* Deliver the signal the tracee stopped for. */
+		continue_tracee(task, WSTOPSIG(status));
+		return;
+	}
+
+	continue_tracee(task, 0);
+}
+
+/* Processes seized when attaching. */
+struct attach
+{
+	/* Seized processes, by pid. */
+	struct tidmap seized;
+
+	/* Seized processes, in order. Children of the ones from `next` are still to be seized. */
+	long *pending;
+	size_t next;
+	size_t count;
+
+	/* Children can't be read from /proc, scan all processes instead. */
+	bool scan;
+};
+
+/* Seize and interrupt tid, and add a task for it. */
+static int seize_thread(struct tracer *tracer, long tid, long owner)
+{
+	if (tracer_seize(tid, false) < 0)
+	{
+		return -1;
+	}
+
+	(void) ptrace(PTRACE_INTERRUPT, tid, 0, 0);
+
+	struct task *task = task_create(tid, owner);
+	task->ptrace_options_set = true;
+	task->starting = true;
+	tidmap_put(&tracer->tasks, tid, task);
+
+	return 0;
+}
+
+/* Seize the threads of pid that are not traced yet, until no new ones appear.
+   Returns the number of threads seized. */
+static size_t seize_threads(struct tracer *tracer, long pid)
+{
+	char path[PATH_MAX];
+	size_t total = 0, count;
+	struct dirent *entry;
+	DIR *dir;
+
+	snprintf(path, sizeof(path), "/proc/%ld/task", pid);
+
+	do
+	{
+		count = 0;
+		dir = opendir(path);
+
+		if (dir == NULL)
+		{
+			break;
+		}
+
+		while ((entry = readdir(dir)))
+		{
+			long tid = strtol(entry->d_name, NULL, 10);
+
+			if (tid <= 0 || tidmap_get(&tracer->tasks, tid))
+			{
+				continue;
+			}
+
+			bool fold = tracer->options->no_threads;
+
+			if (seize_thread(tracer, tid, fold ? pid : tid) < 0)
+			{
+				continue;
+			}
+
+			if (!fold)
+			{
+				struct event spawn = { .type = EVENT_SPAWN, .tid = tid, .time = timestamp_now() };
+				spawn.parent = pid;
+				spawn.is_a_thread = true;
+				emit(tracer, &spawn);
+			}
+
+			count++;
+		}
+
+		closedir(dir);
+		total += count;
+	}
+	while (count > 0);
+
+	return total;
+}
+
+/* Seize all threads of the process pid, whose parent is the traced process parent. */
+static int seize_process(struct tracer *tracer, struct attach *attach, long pid, long parent)
+{
+	struct task *task;
+	timestamp_t start_time = timestamp_now();
+
+	if (seize_thread(tracer, pid, pid) < 0)
+	{
+		return -1;
+	}
+
+	struct event spawn = { .type = EVENT_SPAWN, .tid = pid, .time = start_time, .parent = parent };
+	struct event exec = { .type = EVENT_EXEC, .tid = pid, .time = start_time };
+	struct event chdir = { .type = EVENT_CHDIR, .tid = pid, .time = start_time };
+
+	task = tidmap_get(&tracer->tasks, pid);
+	emit(tracer, &spawn);
+
+	/* Processes without access to these, like kernel threads, keep no arguments. */
+	if (task_read_info_from_proc_dir(task, &tracer->options->limits, &exec.argv, &exec.envp, &chdir.cwd) == 0)
+	{
+		/* The working directory at the exec is part of the cache key. */
+		emit(tracer, &chdir);
+		emit(tracer, &exec);
+	}
+
+	seize_threads(tracer, pid);
+
+	tidmap_put(&attach->seized, pid, attach);
+	attach->pending = xrealloc(attach->pending, sizeof(*attach->pending) * (attach->count + 1));
+	attach->pending[attach->count++] = pid;
+
+	return 0;
+}
+
+/* Seize the children of every thread of the traced process pid.
+   Returns -1 if children can't be read from /proc. */
+static int seize_children(struct tracer *tracer, struct attach *attach, long pid)
+{
+	char path[PATH_MAX];
+	struct dirent *entry;
+	DIR *dir;
+	int result = 0;
+
+	snprintf(path, sizeof(path), "/proc/%ld/task", pid);
+
+	dir = opendir(path);
+	if (dir == NULL)
+	{
+		return 0;
+	}
+
+	while ((entry = readdir(dir)) && result == 0)
+	{
+		long tid = strtol(entry->d_name, NULL, 10);
+		long child;
+		FILE *f;
+
+		if (tid <= 0)
+		{
+			continue;
+		}
+
+		/* Read after the thread was seized, so that children it creates
+		   later are reported as events instead. */
+		snprintf(path, sizeof(path), "/proc/%ld/task/%ld/children", pid, tid);
+
+		f = fopen(path, "r");
+		if (f == NULL)
+		{
+			result = errno == ENOENT && tidmap_get(&tracer->tasks, tid) ? -1 : 0;
+			continue;
+		}
+
+		while (fscanf(f, "%ld", &child) == 1)
+		{
+			if (!tidmap_get(&attach->seized, child))
+			{
+				(void) seize_process(tracer, attach, child, pid);
+			}
+		}
+
+		fclose(f);
+	}
+
+	closedir(dir);
+
+	return result;
+}
+
+/* Seize processes whose parent is seized, by reading the parent of every process.
+   Returns the number of processes seized. */
+static size_t scan_processes(struct tracer *tracer, struct attach *attach)
+{
+	char path[PATH_MAX];
+	char stat[512];
+	struct dirent *entry;
+	size_t count = 0;
+	DIR *dir;
+
+	dir = opendir("/proc");
+	if (dir == NULL)
+	{
+		return 0;
+	}
+
+	while ((entry = readdir(dir)))
+	{
+		long pid = strtol(entry->d_name, NULL, 10);
+		long parent;
+		ssize_t len;
+		char *end;
+		int fd;
+
+		if (pid <= 0 || tidmap_get(&attach->seized, pid))
+		{
+			continue;
+		}
+
+		snprintf(path, sizeof(path), "/proc/%ld/stat", pid);
+
+		fd = open(path, O_RDONLY);
+		if (fd < 0)
+		{
+			continue;
+		}
+
+		len = read(fd, stat, sizeof(stat) - 1);
+		close(fd);
+
+		if (len <= 0)
+		{
+			continue;
+		}
+
+		stat[len] = 0;
+
+		/* The command name may contain any character, the state and parent follow it. */
+		end = strrchr(stat, ')');
+
+		if (end == NULL || sscanf(end + 1, " %*c %ld", &parent) != 1)
+		{
+			continue;
+		}
+
+		if (tidmap_get(&attach->seized, parent) && seize_process(tracer, attach, pid, parent) == 0)
+		{
+			count++;
+		}
+	}
+
+	closedir(dir);
+
+	return count;
+}
+
+/* Stop only at the syscalls handled by the tracer, through seccomp. The
+   filter is inherited by all descendants, which fail these syscalls with
+   ENOSYS if they run without a tracer. */
+static void install_file_filter(void)
+{
+	static const long handled[] = {
+		SYS_execve, SYS_chdir, SYS_clone, SYS_clone3,
+		SYS_openat, SYS_openat2, SYS_renameat, SYS_renameat2, SYS_unlinkat,
+#ifdef SYS_open
+		SYS_open, SYS_creat, SYS_rename, SYS_unlink,
+#endif
+	};
+
+	const size_t nhandled = sizeof(handled) / sizeof(*handled);
+	struct sock_filter filter[4 + 2 * nhandled + 1];
+	struct sock_fprog program = { .filter = filter };
+	size_t len = 0;
+
+	/* Syscall numbers of other architectures mean other syscalls. */
+	filter[len++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, arch));
+	filter[len++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, AUDIT_ARCH_NATIVE, 1, 0);
+	filter[len++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW);
+	filter[len++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr));
+
+	for (size_t i = 0; i < nhandled; ++i)
+	{
+		filter[len++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, handled[i], 0, 1);
+		filter[len++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE);
+	}
+
+	filter[len++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW);
+	program.len = len;
+
+	if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0
+	 || prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &program) < 0)
+	{
+		warn("Failed to install seccomp filter");
+		_exit(EXIT_CHILD_FAILURE);
+	}
+}
+
+void tracer_init(struct tracer *tracer, struct options *options,
+                 void (*emit)(struct event *event, void *data), void *data)
+{
+	memset(tracer, 0, sizeof(*tracer));
+
+	tracer->options = options;
+	tracer->emit = emit;
+	tracer->data = data;
+}
+
+/* Prepare the child process of a command to execute it. */
+static void prepare_exec(struct options *options)
+{
+	/* Signals received through signalfds are blocked in the tracer, and
+	   the signal mask is inherited across exec. */
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigprocmask(SIG_SETMASK, &signals, NULL);
+
+	if (options->silent)
+	{
+		FILE *devnull = fopen("/dev/null", "a");
+
+		if (devnull == NULL)
+		{
+			warn("Failed to open /dev/null");
+			_exit(EXIT_CHILD_FAILURE);
+		}
+
+		if (dup2(fileno(devnull), STDOUT_FILENO) < 0)
+		{
+			warn("Failed to redirect stdout to /dev/null");
+			_exit(EXIT_CHILD_FAILURE);
+		}
+
+		if (dup2(fileno(devnull), STDERR_FILENO) < 0)
+		{
+			warn("Failed to redirect stderr to /dev/null");
+			_exit(EXIT_CHILD_FAILURE);
+		}
+	}
+	else if (options->redirect)
+	{
+		if (dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+		{
+			warn("Failed to redirect stdout to stderr");
+			_exit(EXIT_CHILD_FAILURE);
+		}
+	}
+}
+
+static void __attribute__((noreturn)) execute(char **command)
+{
+	if (execvp(command[0], command) < 0)
+	{
+		warn("Failed to execute %s", command[0]);
+		_exit(EXIT_CHILD_FAILURE);
+	}
+
+	__builtin_unreachable();
+}
+
+void __attribute__((noreturn)) tracer_exec(struct options *options, char **command)
+{
+	prepare_exec(options);
+	execute(command);
+}
+
+long tracer_spawn(struct tracer *tracer, char **command)
+{
+	char cwdbuf[PATH_MAX];
+	struct strcap cap;
+	long pid;
+
+	timestamp_t start_time = timestamp_now();
+
+	pid = fork();
+
+	if (pid < 0)
+	{
+		return -1;
+	}
+
+	if (pid > 0)
+	{
+		struct event spawn = { .type = EVENT_SPAWN, .tid = pid, .time = start_time };
+		struct event exec = { .type = EVENT_EXEC, .tid = pid, .time = start_time };
+		struct event chdir = { .type = EVENT_CHDIR, .tid = pid, .time = start_time };
+
+		/* Within the same limits as the execs read from the tracees. */
+		strcap_init(&cap, &tracer->options->limits);
+		exec.argv = strcap_copy_list(&cap, command);
+		exec.envp = strcap_copy_list(&cap, environ);
+		chdir.cwd = strdup(getcwd(cwdbuf, sizeof(cwdbuf)));
+
+		emit(tracer, &spawn);
+		emit(tracer, &chdir);
+
+		/* The first stop is the SIGTRAP of the exec, or the SIGSTOP before
+		   the filter is installed, after which the exec is reported by
+		   the tracer as the options are set by then. */
+		struct task *task = task_create(pid, pid);
+		task->starting = true;
+		task->spawned = true;
+		task->filtered = tracer->options->files;
+		tidmap_put(&tracer->tasks, pid, task);
+
+		if (task->filtered)
+		{
+			event_free_data(&exec);
+		}
+		else
+		{
+			emit(tracer, &exec);
+		}
+
+		return pid;
+	}
+
+	if (ptrace(PTRACE_TRACEME) < 0)
+	{
+		warn("ptrace(PTRACE_TRACEME) failed");
+		_exit(EXIT_CHILD_FAILURE);
+	}
+
+	/* Files opened to redirect the output are not reported. */
+	prepare_exec(tracer->options);
+
+	/* Syscalls stopped by the filter fail unless the tracer has set
+	   PTRACE_O_TRACESECCOMP, which it does at the first stop. */
+	if (tracer->options->files)
+	{
+		raise(SIGSTOP);
+		install_file_filter();
+	}
+
+	execute(command);
+}
+
+long tracer_attach(struct tracer *tracer, long pid)
+{
+	struct attach attach = {0};
+
+	/* Already traced as a descendant of another root. */
+	if (tidmap_get(&tracer->tasks, pid))
+	{
+		return pid;
+	}
+
+	if (seize_process(tracer, &attach, pid, 0) < 0)
+	{
+		return -1;
+	}
+
+	for (;;)
+	{
+		while (attach.next < attach.count)
+		{
+			long process = attach.pending[attach.next++];
+
+			if (seize_children(tracer, &attach, process) < 0)
+			{
+				attach.scan = true;
+			}
+		}
+
+		/* Without /proc/<pid>/task/<tid>/children, find the descendants by
+		   the parent of every process, until no new ones are found. */
+		if (!attach.scan || scan_processes(tracer, &attach) == 0)
+		{
+			break;
+		}
+	}
+
+	xfree(attach.pending);
+	tidmap_clear(&attach.seized);
+
+	return pid;
+}
+
+int tracer_start(struct tracer *tracer)
+{
+	struct options *options = tracer->options;
+	size_t started = 0;
+
+	for (size_t i = 0; i < options->ncommands; ++i)
+	{
+		if (tracer_spawn(tracer, options->commands[i]) < 0)
+		{
+			warn("Failed to start %s", options->commands[i][0]);
+			continue;
+		}
+
+		started++;
+	}
+
+	for (size_t i = 0; i < options->nattach; ++i)
+	{
+		if (tracer_attach(tracer, options->attach[i]) < 0)
+		{
+			warn("Failed to attach to process %ld", options->attach[i]);
+			continue;
+		}
+
+		started++;
+	}
+
+	return started > 0 ? 0 : -1;
+}
+
+void tracer_adopt(struct tracer *tracer, long tid, bool filtered)
+{
+	struct task *task = task_create(tid, tid);
+
+	task->ptrace_options_set = true;
+	task->filtered = filtered;
+	task->starting = true;
+	task->handed_over = true;
+	tidmap_put(&tracer->tasks, tid, task);
+
+	void *early = tidmap_remove(&tracer->early_stops, tid);
+
+	if (early)
+	{
+		start_task(tracer, task, (long) early);
+	}
+}
+
+int tracer_seize(long tid, bool filtered)
+{
+	long options = TASK_PTRACE_OPTIONS | (filtered ? PTRACE_O_EXITKILL : 0);
+
+	return ptrace(PTRACE_SEIZE, tid, 0, options) < 0 ? -1 : 0;
+}
+
+long tracer_wait(struct tracer *tracer, int flags)
+{
+	int status;
+	long tid;
+
+	tid = waitpid(-1, &status, __WALL | flags);
+
+	if (tid > 0)
+	{
+		handle_status(tracer, tid, status);
+	}
+
+	return tid;
+}
+
+static void detach_task(long tid, void *task)
+{
+	task_detach(task);
+}
+
+void tracer_detach_all(struct tracer *tracer)
+{
+	tidmap_foreach(&tracer->tasks, detach_task);
+}
@@ -0,0 +1,105 @@
+#ifndef TRACER_H_INCLUDED
+#define TRACER_H_INCLUDED
+
+#include <stdbool.h>
+
+#include "tidmap.h"
+#include "event.h"
+
+struct options;
+
+/*
+ * Traces a set of threads with ptrace and turns their stops into events.
+ * Ptrace requests must come from the thread that traces the tracee, so
+ * a tracer must only be used by one thread. New threads and processes are
+ * traced by the same tracer as the thread that created them.
+ */
+struct tracer
+{
+	/* All traced threads, by tid. */
+	struct tidmap tasks;
+
+	/* New threads that stopped before the event of their creation, by tid. */
+	struct tidmap early_stops;
+
+	/* Hashes of the contents of files read, see cachekey_digest_file(). */
+	struct tidmap digests;
+
+	/* Options of the session. */
+	struct options *options;
+
+	/* Called with every event. Takes ownership of the strings in the event. */
+	void (*emit)(struct event *event, void *data);
+
+	/* Called at the first stop of a new process, which is filtered if it
+	   runs under the file filter. May detach from it to hand it over to
+	   another tracer, and returns true if it did. Optional. */
+	bool (*handoff)(long tid, bool filtered, void *data);
+
+	/* Passed to emit and handoff. */
+	void *data;
+};
+
+/*
+ * Initialize a tracer without any tracees.
+ */
+void tracer_init(struct tracer *tracer, struct options *options,
+                 void (*emit)(struct event *event, void *data), void *data);
+
+/*
+ * Start command as a tracee.
+ * Returns its pid on success and -1 on failure, errno is set by fork().
+ */
+long tracer_spawn(struct tracer *tracer, char **command);
+
+/*
+ * Execute command in a new child process, after redirecting its output
+ * as requested by options. Does not return.
+ */
+void __attribute__((noreturn)) tracer_exec(struct options *options, char **command);
+
+/*
+ * Attach to the running process pid and its descendants, unless it is
+ * traced already.
+ * Returns pid on success and -1 on failure, errno is set by the
+ * corresponding ptrace call.
+ */
+long tracer_attach(struct tracer *tracer, long pid);
+
+/*
+ * Start all commands and attach to all pids given in the options, with a
+ * warning for each one that could not be traced.
+ * Returns 0 on success and -1 if none of them could be traced.
+ */
+int tracer_start(struct tracer *tracer);
+
+/*
+ * Start tracing tid, which was seized with tracer_seize() by the calling
+ * thread and its events are attributed to its own tracee. filtered is
+ * passed on from the tracer that handed it over.
+ */
+void tracer_adopt(struct tracer *tracer, long tid, bool filtered);
+
+/*
+ * Seize tid with the options of a tracer, and kill it when the calling
+ * thread exits if it runs under the file filter. Only makes a system call,
+ * so it may be used from a signal handler.
+ * Returns 0 on success and -1 on failure, errno is set by the
+ * corresponding ptrace call.
+ */
+int tracer_seize(long tid, bool filtered);
+
+/*
+ * Wait for a stop of one of the tracees and handle it. flags are
+ * passed on to waitpid().
+ * Returns the tid that stopped, 0 if WNOHANG was given and no tracee has
+ * stopped, or -1 on failure, errno is set by waitpid().
+ */
+long tracer_wait(struct tracer *tracer, int flags);
+
+/*
+ * Detach from all tracees.
+ */
+void tracer_detach_all(struct tracer *tracer);
+
+#endif
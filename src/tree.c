@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "tree.h"
+#include "cachekey.h"
+#include "xmalloc.h"
+
+static struct tracee *allocate(struct tree *tree)
+{
+	struct tracee *tracee = tree->pool;
+
+	if (tracee == NULL)
+	{
+		return tracee_create();
+	}
+
+	tree->pool = tracee->parent;
+	tracee->parent = NULL;
+
+	return tracee;
+}
+
+/* Unlink tracee from the tracees with its tid. Generations are counted from
+   the most recent one left, so they stay distinct within the tree. */
+static void forget_generation(struct tree *tree, struct tracee *tracee)
+{
+	struct tracee *newer = tidmap_get(&tree->generations, tracee->tid);
+
+	if (newer == tracee)
+	{
+		if (tracee->older)
+		{
+			tidmap_put(&tree->generations, tracee->tid, tracee->older);
+		}
+		else
+		{
+			tidmap_remove(&tree->generations, tracee->tid);
+		}
+
+		return;
+	}
+
+	while (newer && newer->older != tracee)
+	{
+		newer = newer->older;
+	}
+
+	if (newer)
+	{
+		newer->older = tracee->older;
+	}
+}
+
+/* Free the data of a removed tracee and keep it for reuse, along with its
+   list of children and working directory buffer, so that spawning doesn't
+   allocate once the pool is warm. Its next owner sets the directory again. */
+static void recycle(struct tree *tree, struct tracee *tracee)
+{
+	struct tracee **children = tracee->children;
+	size_t children_capacity = tracee->children_capacity;
+	char *cwd = tracee->cwd;
+	size_t cwd_size = tracee->cwd_size;
+
+	forget_generation(tree, tracee);
+	free_string_list(tracee->argv);
+	free_string_list(tracee->envp);
+	pathset_clear(&tracee->inputs);
+	pathset_clear(&tracee->outputs);
+	xfree(tracee->samples);
+
+	memset(tracee, 0, sizeof(*tracee));
+
+	tracee->children = children;
+	tracee->children_capacity = children_capacity;
+	tracee->cwd = cwd;
+	tracee->cwd_size = cwd_size;
+
+	tracee->parent = tree->pool;
+	tree->pool = tracee;
+}
+
+/* Remove tracee from the tree, along with ancestors that are only kept for its sake. */
+static void expire(struct tree *tree, struct tracee *tracee)
+{
+	struct tracee *parent;
+
+	tracee->expired = true;
+
+	while (tracee != tree->root && tracee->expired && tracee->nchildren == 0)
+	{
+		parent = tracee->parent;
+
+		tracee_remove_child(parent, tracee);
+		recycle(tree, tracee);
+
+		tracee = parent;
+	}
+}
+
+/* Add an exited tracee to the retention window, expiring the oldest one if it is full. */
+static void retire(struct tree *tree, struct tracee *tracee)
+{
+	size_t tail;
+
+	if (tree->retain == 0)
+	{
+		if (tree->nfinished == tree->finished_capacity)
+		{
+			tree->finished_capacity = tree->finished_capacity ? tree->finished_capacity * 2 : 64;
+			tree->finished = xrealloc(tree->finished, sizeof(*tree->finished) * tree->finished_capacity);
+		}
+
+		tree->finished[tree->nfinished++] = tracee;
+		return;
+	}
+
+	if (tree->nfinished == tree->retain)
+	{
+		expire(tree, tree->finished[tree->finished_head]);
+		tree->finished_head = (tree->finished_head + 1) % tree->retain;
+		tree->nfinished--;
+	}
+
+	tail = (tree->finished_head + tree->nfinished) % tree->retain;
+	tree->finished[tail] = tracee;
+	tree->nfinished++;
+}
+
+void tree_set_retention(struct tree *tree, size_t count)
+{
+	tree->retain = count;
+	tree->finished = xrealloc(tree->finished, sizeof(*tree->finished) * (count + 1));
+	tree->finished_head = 0;
+	tree->nfinished = 0;
+	tree->finished_capacity = count + 1;
+}
+
+/* Make the root a child of a new session tracee, which becomes the root. */
+static void start_session(struct tree *tree)
+{
+	struct tracee *session = allocate(tree);
+
+	/* Not tracee_add_child(), the root keeps its working directory. */
+	tracee_set_cwd(session, NULL);
+	session->start_time = tree->root->start_time;
+	if (session->children_capacity == 0)
+	{
+		session->children = xmalloc(sizeof(*session->children));
+		session->children_capacity = 1;
+	}
+
+	session->children[0] = tree->root;
+	session->nchildren = 1;
+
+	tree->root->parent = session;
+	tree->root = session;
+}
+
+static void apply_spawn(struct tree *tree, struct event *event)
+{
+	struct tracee *parent = NULL;
+	struct tracee *tracee, *older;
+
+	/* A tracee with the same tid is still live if its exit was lost, like
+	   when the buffers of the connector or perf backends overflowed. */
+	tracee = tidmap_remove(&tree->live, event->tid);
+
+	if (tracee)
+	{
+		tracee->end_time = event->time;
+		tree->stats.exited++;
+		retire(tree, tracee);
+	}
+
+	older = tidmap_get(&tree->generations, event->tid);
+
+	tracee = allocate(tree);
+	tracee->tid = event->tid;
+	tracee->generation = older ? older->generation + 1 : 0;
+	tracee->older = older;
+	tidmap_put(&tree->generations, tracee->tid, tracee);
+	tracee->is_a_thread = event->is_a_thread;
+	tracee->start_time = event->time;
+
+	if (event->parent)
+	{
+		parent = tidmap_get(&tree->live, event->parent);
+	}
+	else if (tree->root && tree->root->tid != 0)
+	{
+		start_session(tree);
+	}
+
+	/* Roots and tracees whose parent is not known are adopted by the root. */
+	if (parent == NULL)
+	{
+		parent = tree->root;
+	}
+
+	if (parent)
+	{
+		tracee_add_child(parent, tracee);
+	}
+	else
+	{
+		tracee_set_cwd(tracee, NULL);
+		tree->root = tracee;
+	}
+
+	tidmap_put(&tree->live, tracee->tid, tracee);
+
+	if (tracee->is_a_thread)
+	{
+		tree->stats.threads++;
+	}
+	else
+	{
+		tree->stats.processes++;
+	}
+}
+
+void tree_set_cache_keys(struct tree *tree, char **environment)
+{
+	tree->cache_keys = true;
+	tree->cache_env = environment;
+}
+
+void tree_apply_event(struct tree *tree, struct event *event)
+{
+	struct tracee *tracee;
+
+	if (event->type == EVENT_SPAWN)
+	{
+		apply_spawn(tree, event);
+		event_free_data(event);
+		return;
+	}
+
+	tracee = tidmap_get(&tree->live, event->tid);
+
+	if (tracee == NULL)
+	{
+		event_free_data(event);
+		return;
+	}
+
+	switch (event->type)
+	{
+	case EVENT_EXEC:
+		tree->stats.execs++;
+
+		free_string_list(tracee->argv);
+		free_string_list(tracee->envp);
+
+		tracee->argv = event->argv;
+		tracee->envp = event->envp;
+		tracee->failed_execs += event->failed_execs;
+		tracee->exec_time += event->exec_time;
+
+		event->argv = NULL;
+		event->envp = NULL;
+
+		if (tree->cache_keys)
+		{
+			cachekey_exec(tracee, tree->cache_env);
+		}
+		break;
+
+	case EVENT_CHDIR:
+		/* The directory is passed to chdir() as is, and may be relative. */
+		if (event->cwd && event->cwd[0] != '/' && tracee->cwd)
+		{
+			char *cwd = join_path(tracee->cwd, event->cwd);
+			xfree(event->cwd);
+			event->cwd = cwd;
+		}
+
+		tracee_set_cwd(tracee, event->cwd);
+		break;
+
+	case EVENT_FILE:
+		if (event->path)
+		{
+			char *path = join_path(tracee->cwd, event->path);
+			struct pathset *set = event->written ? &tracee->outputs : &tracee->inputs;
+
+			if (pathset_add(set, path) && !event->written && tree->cache_keys)
+			{
+				cachekey_input(tracee, path, event->digest);
+			}
+
+			xfree(path);
+		}
+		break;
+
+	case EVENT_EXIT:
+		tracee->failed_execs += event->failed_execs;
+		tracee->exit_status = event->status;
+		tracee->has_exit_status = event->has_status;
+		tracee->end_time = event->time;
+		tidmap_remove(&tree->live, tracee->tid);
+		tree->stats.exited++;
+		retire(tree, tracee);
+		break;
+
+	case EVENT_SAMPLE:
+		/* The capacity is the next power of two, and at least 4. */
+		if (tracee->nsamples == 0
+		 || (tracee->nsamples >= 4 && (tracee->nsamples & (tracee->nsamples - 1)) == 0))
+		{
+			size_t capacity = tracee->nsamples ? tracee->nsamples * 2 : 4;
+			tracee->samples = xrealloc(tracee->samples, capacity * sizeof(*tracee->samples));
+		}
+
+		tracee->samples[tracee->nsamples].time = event->time;
+		tracee->samples[tracee->nsamples].cpu_us = event->cpu_us;
+		tracee->samples[tracee->nsamples].rss_kb = event->rss_kb;
+		tracee->nsamples++;
+		break;
+
+	default:
+		break;
+	}
+
+	event_free_data(event);
+}
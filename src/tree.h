@@ -0,0 +1,77 @@
+#ifndef TREE_H_INCLUDED
+#define TREE_H_INCLUDED
+
+#include "tracee.h"
+#include "tidmap.h"
+#include "event.h"
+
+/*
+ * A tree of tracees built from events.
+ */
+struct tree
+{
+	/* The first tracee spawned without a parent, or NULL. When several
+	   tracees are spawned without a parent, a session tracee with tid zero
+	   and no arguments, whose children they are. */
+	struct tracee *root;
+
+	/* Tracees that have not exited yet, by tid. Events are only ever
+	   looked up here, so lookups don't depend on how many have exited,
+	   and never find an exited tracee whose tid was reused. */
+	struct tidmap live;
+
+	/* Most recent tracee with each tid that is still in the tree, with the
+	   older ones chained through tracee->older, see tracee->generation.
+	   Tids leave it with their last tracee, so it doesn't grow with the
+	   number of tids used when tracees are expired. */
+	struct tidmap generations;
+
+	/* Maximum number of exited tracees to keep, or zero to keep all. */
+	size_t retain;
+
+	/* Exited tracees in the order they exited, oldest at `finished_head`.
+	   An append-only archive of all of them when all are kept, or else a
+	   ring of the `retain` most recent ones. */
+	struct tracee **finished;
+	size_t finished_head;
+	size_t nfinished;
+	size_t finished_capacity;
+
+	/* Compute cache keys, including the environment variables named in
+	   the NULL terminated list cache_env, see cachekey.h. */
+	bool cache_keys;
+	char **cache_env;
+
+	/* Tracees removed from the tree, reused for new ones. */
+	struct tracee *pool;
+
+	/* Counters kept up to date by every event, so they can be queried
+	   without walking the tree. */
+	struct tree_stats
+	{
+		size_t processes;
+		size_t threads;
+		size_t execs;
+		size_t exited;
+	} stats;
+};
+
+/*
+ * Only keep the `count` most recently exited tracees, along with all
+ * tracees that are still running and their ancestors.
+ */
+void tree_set_retention(struct tree *tree, size_t count);
+
+/*
+ * Compute cache keys of tracees, with the environment variables named in
+ * the NULL terminated list environment, which may be NULL. The list must
+ * stay valid as long as the tree is used.
+ */
+void tree_set_cache_keys(struct tree *tree, char **environment);
+
+/*
+ * Apply an event to the tree. The tree takes ownership of the strings in the event.
+ */
+void tree_apply_event(struct tree *tree, struct event *event);
+
+#endif
@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+#include <err.h>
+
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+#include "worker.h"
+#include "options.h"
+#include "xmalloc.h"
+
+/* Signal telling a worker that processes were handed over to it. */
+#define SIGHANDOFF SIGRTMIN
+
+/* Worker of the calling thread. */
+static __thread struct worker *current;
+
+/* Startup of the workers, which only trace once all of them were created. */
+static struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	/* All workers were created, or creating one of them failed. */
+	bool created;
+	bool failed;
+
+	/* The first worker started the commands, with this result. */
+	bool started;
+	int result;
+} startup = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static void push(_Atomic(struct handoff *) *stack, struct handoff *handoff)
+{
+	struct handoff *head = atomic_load_explicit(stack, memory_order_relaxed);
+
+	do
+	{
+		handoff->next = head;
+	}
+	while (!atomic_compare_exchange_weak_explicit(stack, &head, handoff,
+	                                              memory_order_release, memory_order_relaxed));
+}
+
+/* Seize processes handed over to the current worker. Ptrace requests must
+   come from the worker thread itself, so this is done in the signal handler. */
+static void handoff_signal_handler(int sig)
+{
+	struct handoff *handoff, *next;
+	int saved = errno;
+
+	handoff = atomic_exchange_explicit(&current->inbox, NULL, memory_order_acquire);
+
+	for (; handoff; handoff = next)
+	{
+		next = handoff->next;
+		handoff->error = tracer_seize(handoff->tid, handoff->filtered) < 0 ? errno : 0;
+		push(&current->seized, handoff);
+	}
+
+	errno = saved;
+}
+
+static void emit(struct event *event, void *data)
+{
+	struct worker *worker = data;
+	queue_push(worker->queue, event);
+}
+
+static bool handoff(long tid, bool filtered, void *data)
+{
+	struct worker *worker = data;
+	struct worker *target = worker;
+	size_t load = worker->tracer.tasks.count;
+
+	for (size_t i = 0; i < worker->nworkers; ++i)
+	{
+		size_t other = atomic_load_explicit(&worker->workers[i].load, memory_order_relaxed);
+
+		if (other + 1 < load)
+		{
+			target = &worker->workers[i];
+			load = other + 1;
+		}
+	}
+
+	if (target == worker)
+	{
+		return false;
+	}
+
+	/* The SIGSTOP is queued rather than passed to PTRACE_DETACH, which
+	   ignores it unless the process stopped for a signal. */
+	if (kill(tid, SIGSTOP) < 0 || ptrace(PTRACE_DETACH, tid, 0, 0) < 0)
+	{
+		return false;
+	}
+
+	struct handoff *handoff = xcalloc(1, sizeof(*handoff));
+	handoff->tid = tid;
+	handoff->filtered = filtered;
+
+	push(&target->inbox, handoff);
+	atomic_fetch_add_explicit(&target->load, 1, memory_order_relaxed);
+
+	pthread_kill(target->thread, SIGHANDOFF);
+
+	return true;
+}
+
+static void adopt_seized(struct worker *worker)
+{
+	struct handoff *handoff, *next;
+
+	handoff = atomic_exchange_explicit(&worker->seized, NULL, memory_order_acquire);
+
+	for (; handoff; handoff = next)
+	{
+		next = handoff->next;
+
+		if (handoff->error == 0)
+		{
+			tracer_adopt(&worker->tracer, handoff->tid, handoff->filtered);
+		}
+		else if (handoff->filtered)
+		{
+			/* Its syscalls stopped by the filter would fail untraced. */
+			errno = handoff->error;
+			warn("Failed to trace process %ld handed over between workers, it is killed",
+			     handoff->tid);
+			kill(handoff->tid, SIGKILL);
+		}
+		else
+		{
+			/* The process was detached and stopped by the worker that handed
+			   it over. Let it run untraced rather than leave it stopped forever.
+			   Whether it exits is not known, so it stays running in the tree. */
+			errno = handoff->error;
+			warn("Failed to trace process %ld handed over between workers, it runs untraced",
+			     handoff->tid);
+			kill(handoff->tid, SIGCONT);
+		}
+
+		xfree(handoff);
+	}
+}
+
+/* Wait until processes are handed over to a worker without tracees. */
+static void idle(struct worker *worker)
+{
+	sigset_t blocked, unblocked;
+
+	sigemptyset(&blocked);
+	sigaddset(&blocked, SIGHANDOFF);
+	pthread_sigmask(SIG_BLOCK, &blocked, &unblocked);
+
+	if (atomic_load(&worker->seized) == NULL)
+	{
+		sigsuspend(&unblocked);
+	}
+
+	pthread_sigmask(SIG_SETMASK, &unblocked, NULL);
+}
+
+/* Wait until all workers were created, and return whether they were. */
+static bool wait_created(void)
+{
+	bool failed;
+
+	pthread_mutex_lock(&startup.lock);
+
+	while (!startup.created)
+	{
+		pthread_cond_wait(&startup.cond, &startup.lock);
+	}
+
+	failed = startup.failed;
+	pthread_mutex_unlock(&startup.lock);
+
+	return !failed;
+}
+
+static void *worker_main(void *data)
+{
+	struct worker *worker = data;
+	siginfo_t info;
+
+	/* Workers are only cancelled while waiting, never in the middle of
+	   handling an event. */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	current = worker;
+
+	if (!wait_created())
+	{
+		return NULL;
+	}
+
+	if (worker == &worker->workers[0])
+	{
+		int result = tracer_start(&worker->tracer);
+
+		pthread_mutex_lock(&startup.lock);
+		startup.started = true;
+		startup.result = result;
+		pthread_cond_broadcast(&startup.cond);
+		pthread_mutex_unlock(&startup.lock);
+
+		if (result < 0)
+		{
+			return NULL;
+		}
+	}
+
+	for (;;)
+	{
+		int result;
+
+		adopt_seized(worker);
+		atomic_store_explicit(&worker->load, worker->tracer.tasks.count, memory_order_relaxed);
+
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+
+		/* Only wait for the tracees of this thread, and leave the one
+		   found waitable, to be handled once cancelling is disabled. */
+		result = waitid(P_ALL, 0, &info, WEXITED | WSTOPPED | WNOWAIT | __WALL | __WNOTHREAD);
+
+		if (result < 0 && errno == ECHILD)
+		{
+			idle(worker);
+		}
+
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+		if (result == 0)
+		{
+			tracer_wait(&worker->tracer, __WNOTHREAD | WNOHANG);
+		}
+	}
+
+	return NULL;
+}
+
+/* Let processes that were handed over but never adopted run untraced,
+   or kill them if they run under the file filter. */
+static void resume_handoffs(_Atomic(struct handoff *) *stack)
+{
+	struct handoff *handoff, *next;
+
+	handoff = atomic_exchange(stack, NULL);
+
+	for (; handoff; handoff = next)
+	{
+		next = handoff->next;
+		kill(handoff->tid, handoff->filtered ? SIGKILL : SIGCONT);
+		xfree(handoff);
+	}
+}
+
+struct worker *workers_start(size_t count, struct options *options, struct queue *queue)
+{
+	struct worker *workers = xcalloc(count, sizeof(*workers));
+	struct sigaction action = { .sa_handler = handoff_signal_handler, .sa_flags = SA_RESTART };
+	size_t created;
+	int error = 0, result;
+
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGHANDOFF, &action, NULL);
+
+	startup.created = false;
+	startup.failed = false;
+	startup.started = false;
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		struct worker *worker = &workers[i];
+
+		tracer_init(&worker->tracer, options, emit, worker);
+		worker->tracer.handoff = handoff;
+		worker->workers = workers;
+		worker->nworkers = count;
+		worker->queue = queue;
+	}
+
+	for (created = 0; created < count; ++created)
+	{
+		if ((error = pthread_create(&workers[created].thread, NULL, worker_main, &workers[created])) != 0)
+		{
+			break;
+		}
+	}
+
+	pthread_mutex_lock(&startup.lock);
+	startup.created = true;
+	startup.failed = error != 0;
+	pthread_cond_broadcast(&startup.cond);
+
+	while (error == 0 && !startup.started)
+	{
+		pthread_cond_wait(&startup.cond, &startup.lock);
+	}
+
+	result = startup.result;
+	pthread_mutex_unlock(&startup.lock);
+
+	if (error != 0)
+	{
+		errno = error;
+		warn("Failed to start worker thread");
+	}
+
+	if (error != 0 || result < 0)
+	{
+		workers->nworkers = created;
+		workers_stop(workers);
+		return NULL;
+	}
+
+	return workers;
+}
+
+void workers_stop(struct worker *workers)
+{
+	size_t count = workers->nworkers;
+
+	/* All workers are cancelled before any is joined, as the others may
+	   still hand processes over to them. */
+	for (size_t i = 0; i < count; ++i)
+	{
+		pthread_cancel(workers[i].thread);
+	}
+
+	/* Tracees of worker threads are detached by the kernel when they exit,
+	   and the filtered ones are killed. */
+	for (size_t i = 0; i < count; ++i)
+	{
+		pthread_join(workers[i].thread, NULL);
+	}
+
+	/* Processes handed over to a worker that stopped first were left stopped. */
+	for (size_t i = 0; i < count; ++i)
+	{
+		resume_handoffs(&workers[i].inbox);
+		resume_handoffs(&workers[i].seized);
+	}
+
+	xfree(workers);
+}
@@ -0,0 +1,75 @@
+#ifndef WORKER_H_INCLUDED
+#define WORKER_H_INCLUDED
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "tracer.h"
+#include "queue.h"
+
+struct options;
+
+/*
+ * A process handed over from one worker to another.
+ */
+struct handoff
+{
+	long tid;
+
+	/* The process runs under the file filter, and is killed rather than
+	   left to run untraced. */
+	bool filtered;
+
+	/* errno of seizing the process, or zero if it was seized. */
+	int error;
+
+	struct handoff *next;
+};
+
+/*
+ * A thread tracing a shard of the traced processes.
+ *
+ * Tracees stay with the worker that traces their parent, except for new
+ * processes, which are handed over to a less loaded worker at their first
+ * stop. The current worker detaches from the process with a SIGSTOP, which
+ * keeps it from running until the new worker has seized it.
+ */
+struct worker
+{
+	pthread_t thread;
+	struct tracer tracer;
+
+	/* Number of threads traced by this worker. */
+	atomic_size_t load;
+
+	/* Processes handed over to this worker, to be seized. */
+	_Atomic(struct handoff *) inbox;
+
+	/* Processes seized by this worker, to be adopted by its tracer. */
+	_Atomic(struct handoff *) seized;
+
+	/* All workers of the session. */
+	struct worker *workers;
+	size_t nworkers;
+
+	/* Queue all events are pushed to. */
+	struct queue *queue;
+};
+
+/*
+ * Start count workers pushing events to queue. The first worker starts
+ * the commands and attaches to the pids given in options.
+ * Returns the workers on success and NULL if none of the commands and
+ * pids could be traced or a thread could not be created, after printing
+ * a warning.
+ */
+struct worker *workers_start(size_t count, struct options *options, struct queue *queue);
+
+/*
+ * Stop and join the workers, which detaches them from their tracees,
+ * and free them.
+ */
+void workers_stop(struct worker *workers);
+
+#endif